@@ -0,0 +1,50 @@
+#ifndef ALLOCATIONSTATS_HH
+#define ALLOCATIONSTATS_HH
+
+#include <cstdint>
+
+///////////////////////////////////////////////////////////////////////////////
+// Opt-in heap instrumentation. The global operator new/delete are replaced
+// and, while counting is enabled, count the allocations, the allocated bytes
+// and the live bytes (usable size of the malloc blocks). Counters are global
+// to the process, a Scope measures everything allocated by all threads
+// during its lifetime. Disabled, the hooks only cost a relaxed atomic load.
+///////////////////////////////////////////////////////////////////////////////
+
+namespace AllocationStats {
+
+struct Counters
+{
+   uint64_t allocations = 0; // number of operator new calls
+   uint64_t bytes = 0;       // bytes allocated
+   int64_t peakBytes = 0;    // peak live bytes above the start of the scope
+};
+
+void
+setEnabled(bool);
+
+bool
+isEnabled();
+
+// Measures the allocations between its construction and get()
+class Scope
+{
+ public:
+   Scope();
+   ~Scope();
+
+   Scope(const Scope&) = delete;
+   Scope& operator=(const Scope&) = delete;
+
+   Counters get() const;
+
+ private:
+   uint64_t mAllocations;
+   uint64_t mBytes;
+   int64_t mLiveBytes;
+   int64_t mOuterPeak; // peak of the enclosing scope, restored at the end
+};
+
+} // namespace AllocationStats
+
+#endif // ALLOCATIONSTATS_HH
@@ -15,6 +15,7 @@ hash_value(const boost::dynamic_bitset<B, A>& a)
 } // namespace boost
 
 #include <boost/unordered_map.hpp>
+#include <cstdint>
 #include <map>
 #include <string>
 #include <vector>
@@ -31,6 +32,18 @@ typedef boost::unordered_map<bitSet, double> CodeProbabilityMap;
 bitSet
 readBinary(const std::string& inputPath, size_t maxSize);
 
+size_t
+getFileSize(const std::string& inputPath);
+
+bitSet
+readSample(const std::string& inputPath, size_t sampleSize, size_t blockSize);
+
+bitSet
+sampleBlocks(const bitSet& data, size_t sampleSize, size_t blockSize, size_t symbolSize);
+
+const bitSet&
+selectSample(const bitSet& data, size_t sampleSize, size_t symbolSize, bitSet& sample);
+
 void
 writeBinary(const std::string& outputPath, const bitSet& data);
 
@@ -55,6 +68,21 @@ findUnusedSymbol(const bitSet& data, bitSet& result, size_t symbolSize);
 size_t
 hashValue(const bitSet&);
 
+const std::vector<bitSet::block_type>&
+getBlocks(const bitSet&);
+
+bitSet
+fromBlocks(std::vector<bitSet::block_type>&& blocks, size_t numBits);
+
+std::vector<bitSet::block_type>
+takeBlocks(bitSet&&);
+
+std::vector<uint8_t>
+toBytes(const bitSet&);
+
+bitSet
+fromBytes(const std::vector<uint8_t>&);
+
 void
 reverseBits(bitSet&);
 
@@ -86,6 +114,30 @@ serialize(std::vector<bitSet> data, size_t numBytes);
 std::vector<bitSet>
 deserialize(const bitSet& data, size_t numBytes);
 
+///////////////////////////////////////////////////////////////////////////////
+// getSymbol / setSymbol
+// Symbol i of sizeof(T) * 8 bits in the blocks of a bitSet, the value is the
+// same as slice(b, i * sizeof(T) * 8, sizeof(T) * 8).to_ulong()
+///////////////////////////////////////////////////////////////////////////////
+
+template<typename T>
+inline T
+getSymbol(const bitSet::block_type* blocks, size_t i)
+{
+   const size_t perBlock = bitSet::bits_per_block / (sizeof(T) * 8);
+   return T(blocks[i / perBlock] >> (i % perBlock * sizeof(T) * 8));
+}
+
+template<typename T>
+inline void
+setSymbol(bitSet::block_type* blocks, size_t i, T symbol)
+{
+   const size_t perBlock = bitSet::bits_per_block / (sizeof(T) * 8);
+   const size_t shift = i % perBlock * sizeof(T) * 8;
+   bitSet::block_type& block = blocks[i / perBlock];
+   block = (block & ~(bitSet::block_type(T(~T(0))) << shift)) | bitSet::block_type(symbol) << shift;
+}
+
 } // namespace BinaryUtils
 
 #endif // BINARYUTILS_HH
\ No newline at end of file
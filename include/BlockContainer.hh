@@ -0,0 +1,121 @@
+#ifndef BLOCKCONTAINER_HH
+#define BLOCKCONTAINER_HH
+
+#include "IEncoder.hh"
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+///////////////////////////////////////////////////////////////////////////////
+// Container of independently encoded blocks with an index at the end of the
+// file:
+//   block 0 | block 1 | ... | index entry 0 | index entry 1 | ... | footer
+// Every block is serialize({ chain, encoded }, 4) padded to whole bytes, or
+// the raw bytes for stored blocks. An index entry holds the raw offset, the
+// compressed offset, the compressed length and the flags of its block, the
+// footer the raw size, the number of blocks, the format version and the
+// magic. All index fields are 64 bit little endian. Containers of version 1
+// (index entries without the flags, footer without the version) end with a
+// magic of their own and are rejected. The flags record the symbol size chosen for the
+// block, the decoder checks the chain of the block against it.
+// A reader only loads the footer and the index, blocks are read when they are
+// decoded: with pread from a file, or from a buffer or a Reader in memory.
+// Appending writes the new blocks over the old index and a new index behind
+// them, the blocks already written are neither read nor moved.
+///////////////////////////////////////////////////////////////////////////////
+
+class BlockContainer
+{
+ public:
+   enum BlockFlags
+   {
+      Stored = 0x1,       // Raw data, no encoder chain
+      SymbolSize8 = 0x2,  // Chain selected with 8 bit symbols
+      SymbolSize16 = 0x4, // Chain selected with 16 bit symbols
+      SymbolSizeMask = SymbolSize8 | SymbolSize16
+   };
+
+   struct IndexEntry
+   {
+      uint64_t rawOffset;
+      uint64_t compressedOffset;
+      uint64_t length;
+      uint64_t flags;
+   };
+
+   struct Block
+   {
+      bitSet data;      // packBlock() or the raw data of a stored block
+      uint64_t rawSize; // in bytes
+      uint64_t flags;
+   };
+
+   // Encoded block from the serialized chain and the data it encoded
+   static bitSet packBlock(const bitSet& serializedChain, const bitSet& encoded);
+
+   // Flag of a selected symbol size and back, 0 if none was recorded
+   static uint64_t getSymbolSizeFlag(size_t symbolSize);
+   static size_t getSymbolSize(uint64_t flags);
+
+   // Writes the blocks, the index and the footer
+   static void write(const std::string& path, const std::vector<Block>& blocks);
+
+   // Adds the blocks behind the blocks of the container at path and rewrites
+   // the index, creates the container if the file does not exist. Throws
+   // std::runtime_error if the file is not a container. Not atomic: the old
+   // index is lost if the writing fails.
+   static void append(const std::string& path, const std::vector<Block>& blocks);
+
+   // The bytes write() would write
+   static std::vector<uint8_t> pack(const std::vector<Block>& blocks);
+
+   // Index entries and footer of blocks written elsewhere
+   static std::vector<uint8_t> packIndex(const std::vector<IndexEntry>& index, uint64_t rawSize);
+
+   // Also true for containers of an unsupported version, reading them throws
+   static bool isContainer(const std::string& path);
+
+   // Reads size bytes at offset, throws std::runtime_error if they are not
+   // all available. Called concurrently when blocks are decoded in parallel.
+   typedef std::function<void(uint8_t* buffer, size_t size, uint64_t offset)> Reader;
+
+   explicit BlockContainer(const std::string& path);
+   // The buffer must outlive the container
+   BlockContainer(const uint8_t* data, size_t size);
+   BlockContainer(Reader reader, uint64_t size);
+   ~BlockContainer();
+
+   BlockContainer(const BlockContainer&) = delete;
+   BlockContainer& operator=(const BlockContainer&) = delete;
+
+   uint64_t getRawSize() const { return mRawSize; };
+   // Bytes of the blocks, the index starts there
+   uint64_t getDataSize() const { return mFileSize - mFooterSize - mIndex.size() * mEntrySize; };
+   const std::vector<IndexEntry>& getIndex() const { return mIndex; };
+
+   // Decodes block i
+   bitSet decodeBlock(size_t i) const;
+
+   // Decodes the bytes [start, start + length), only the covering blocks are read
+   bitSet decodeRange(uint64_t start, uint64_t length) const;
+
+ private:
+   static const uint64_t mMagic = 0x544e434b4c425448;   // "HTBLKCNT"
+   static const uint64_t mMagicV1 = 0x5844494b4c425448; // "HTBLKIDX"
+   static const uint64_t mVersion = 2;
+   static const size_t mEntrySize = 4 * 8;
+   static const size_t mFooterSize = 4 * 8;
+
+   void readIndex();
+   void readAt(uint8_t* buffer, size_t size, uint64_t offset) const;
+
+   int mFile; // -1 if not read from a file
+   Reader mReader;
+   uint64_t mFileSize;
+   uint64_t mRawSize;
+   std::vector<IndexEntry> mIndex;
+};
+
+#endif // BLOCKCONTAINER_HH
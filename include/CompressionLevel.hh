@@ -0,0 +1,75 @@
+#ifndef COMPRESSIONLEVEL_HH
+#define COMPRESSIONLEVEL_HH
+
+#include "BlockContainer.hh"
+#include "EncoderChain.hh"
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+///////////////////////////////////////////////////////////////////////////////
+// Presets of the encoder chain from 1 (fastest) to 9 (best ratio):
+//   1-3  8 bit symbols, Huffman trained on a sample, large blocks
+//   4-5  16 bit symbols, Markov + Huffman trained on a sample
+//   6    16 bit symbols, Markov + Huffman trained on every block (default)
+//   7-9  as 6 with more Markov predictions and smaller blocks
+// Decoding needs no level, the chain of every block is serialized.
+// selectSymbolSize() switches a level between 8 and 16 bit symbols per block,
+// whichever is estimated to give the smaller output, and drops Markov for
+// blocks it cannot encode.
+///////////////////////////////////////////////////////////////////////////////
+
+struct CompressionLevel
+{
+   static constexpr int Min = 1;
+   static constexpr int Max = 9;
+   static constexpr int Default = 6;
+   static constexpr size_t MinBlocks = 8; // blocks of the inputs encoded in parallel
+   static constexpr size_t MinBlockSize = 64 << 10; // smaller blocks pay more for the tables
+
+   int level;
+   size_t symbolSize;
+   bool markov;
+   double threshold;          // Markov prediction threshold
+   size_t trainingSampleSize; // bytes of a block the models see, 0 for all
+   size_t blockSize;          // max. bytes per block of the container
+
+   // Throws std::out_of_range outside of [Min, Max]
+   static CompressionLevel get(int level);
+
+   // Padder, Markov (if enabled) and Huffman
+   std::unique_ptr<EncoderChain> createChain(size_t numHuffmanThreads = 1) const;
+
+   // Estimated bits of the data encoded by the chain, tables included, without
+   // Markov if the MarkovEncoder cannot encode the data. If chain is given it
+   // receives the chain with the models trained for the estimate, which
+   // encodes the data without training them again.
+   double estimateSize(const bitSet& data,
+                       std::unique_ptr<EncoderChain>* chain = nullptr,
+                       size_t numHuffmanThreads = 1) const;
+
+   // This level with 8 or 16 bit symbols, whichever has the smaller estimate,
+   // without Markov if the MarkovEncoder cannot encode the data. The two
+   // estimates run in parallel, chain receives the one of the selection.
+   CompressionLevel selectSymbolSize(const bitSet& data,
+                                     double& estimatedSize,
+                                     std::unique_ptr<EncoderChain>* chain = nullptr,
+                                     size_t numHuffmanThreads = 1) const;
+
+   // Bytes per block of numBytes: at least MinBlocks blocks for the parallel
+   // encoding, at most blockSize bytes each for the random access. Blocks
+   // have at least MinBlockSize bytes, smaller inputs are a single block.
+   size_t getBlockSize(size_t numBytes) const;
+
+   // Block of the container with the chain of the selected symbol size, or
+   // the raw data if it does not shrink
+   BlockContainer::Block encodeBlock(bitSet raw, size_t numHuffmanThreads = 1) const;
+
+   // The blocks of blockSize bytes of data, encoded in parallel
+   std::vector<BlockContainer::Block> encodeBlocks(const bitSet& data,
+                                                   size_t blockSize,
+                                                   size_t numHuffmanThreads = 1) const;
+};
+
+#endif // COMPRESSIONLEVEL_HH
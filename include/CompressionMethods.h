@@ -0,0 +1,196 @@
+#ifndef COMPRESSIONMETHODS_H
+#define COMPRESSIONMETHODS_H
+
+/*****************************************************************************
+ * C API of libcompressionmethods
+ *
+ * Compressed data is the block container of --encode: a buffer compressed
+ * here decodes with "HuffmanTransducer --decode" and the other way round.
+ * Every block carries its own encoder chain, decoding needs no model.
+ *
+ * All functions are thread-safe for distinct contexts and models. A model is
+ * immutable after it is created and may be shared by concurrent calls. No
+ * exception crosses the API, errors are returned as cm_status.
+ *****************************************************************************/
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(__GNUC__)
+#define CM_API __attribute__((visibility("default")))
+#else
+#define CM_API
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define CM_VERSION_MAJOR 1
+#define CM_VERSION_MINOR 0
+#define CM_DEFAULT_LEVEL 0 /* level 6 */
+
+typedef enum cm_status
+{
+   CM_OK = 0,
+   CM_INVALID_ARGUMENT = 1, /* null pointer, unknown level, finished context */
+   CM_BUFFER_TOO_SMALL = 2, /* the required size is returned nevertheless */
+   CM_CORRUPT_DATA = 3,     /* not a container or a block does not decode */
+   CM_OUT_OF_MEMORY = 4,
+   CM_IO_ERROR = 5,         /* a read or write callback failed */
+   CM_INTERNAL_ERROR = 6
+} cm_status;
+
+/* (CM_VERSION_MAJOR << 16) | CM_VERSION_MINOR of the library */
+CM_API unsigned cm_version(void);
+CM_API const char* cm_status_string(cm_status status);
+
+/*****************************************************************************
+ * Threads
+ *
+ * Every parallel stage of the library runs on one pool, shared by all calls.
+ * Configure it before the first call or while no call is running.
+ *****************************************************************************/
+
+/* Threads per call, the calling one included; 0 for the number of hardware
+ * threads. Worker i is pinned to cpus[i % numCpus] if cpus is not NULL.
+ * Replaces the executor of cm_set_executor. */
+CM_API cm_status cm_set_threads(size_t numThreads, const int* cpus, size_t numCpus);
+
+/* Runs task(argument) once, on any thread */
+typedef void (*cm_task_fn)(void* argument);
+typedef void (*cm_executor_fn)(void* opaque, cm_task_fn task, void* argument);
+
+/* Hands the parallel work to the executor of the application (at most
+ * numThreads - 1 tasks per parallel stage), the library starts no threads.
+ * A NULL executor restores the pool. */
+CM_API cm_status cm_set_executor(cm_executor_fn executor, void* opaque, size_t numThreads);
+
+/*****************************************************************************
+ * Buffer to buffer
+ *****************************************************************************/
+
+/* Largest compressed size of srcSize bytes at any level */
+CM_API size_t cm_compress_bound(size_t srcSize);
+
+/* level: 1 (fastest) to 9 (best ratio), CM_DEFAULT_LEVEL for the default */
+CM_API cm_status cm_compress(const void* src,
+                             size_t srcSize,
+                             void* dst,
+                             size_t dstCapacity,
+                             size_t* dstSize,
+                             int level);
+
+CM_API cm_status cm_decompressed_size(const void* src, size_t srcSize, uint64_t* size);
+
+CM_API cm_status cm_decompress(const void* src,
+                               size_t srcSize,
+                               void* dst,
+                               size_t dstCapacity,
+                               size_t* dstSize);
+
+/* The bytes [offset, offset + length) of the original data, only the blocks
+ * covering them are decoded */
+CM_API cm_status cm_decompress_range(const void* src,
+                                     size_t srcSize,
+                                     uint64_t offset,
+                                     size_t length,
+                                     void* dst);
+
+/*****************************************************************************
+ * Models
+ *
+ * A model is an encoder chain trained once on a sample. Compressing with it
+ * skips the training of every block, which pays off for many small buffers
+ * of the same kind. Blocks the model cannot encode exactly (e.g. a symbol
+ * it reserved for its predictions occurs in them) are encoded with a chain
+ * trained on the block.
+ *****************************************************************************/
+
+typedef struct cm_model cm_model;
+
+CM_API cm_status cm_model_train(const void* sample, size_t size, int level, cm_model** model);
+
+/* Serialized model of cm_model_save */
+CM_API cm_status cm_model_load(const void* data, size_t size, cm_model** model);
+
+/* With dst == NULL only the size is returned */
+CM_API cm_status cm_model_save(const cm_model* model,
+                               void* dst,
+                               size_t dstCapacity,
+                               size_t* size);
+
+CM_API void cm_model_free(cm_model* model);
+
+CM_API cm_status cm_compress_with_model(const cm_model* model,
+                                        const void* src,
+                                        size_t srcSize,
+                                        void* dst,
+                                        size_t dstCapacity,
+                                        size_t* dstSize);
+
+/*****************************************************************************
+ * Streaming
+ *
+ * A compression context encodes the data written to it block by block and
+ * hands the container to the write callback as it grows, the index last.
+ * A decompression context reads the container with positional reads, e.g.
+ * pread on a file descriptor, and decodes one block at a time.
+ *****************************************************************************/
+
+/* Returns 0 on success */
+typedef int (*cm_write_fn)(void* opaque, const void* data, size_t size);
+
+/* Reads exactly size bytes at offset, returns 0 on success. May be called
+ * concurrently from several threads. */
+typedef int (*cm_read_fn)(void* opaque, void* buffer, size_t size, uint64_t offset);
+
+typedef struct cm_cctx cm_cctx;
+typedef struct cm_dctx cm_dctx;
+
+/* model may be NULL, otherwise it must outlive the context and level must be
+ * CM_DEFAULT_LEVEL: the blocks are encoded at the level the model was trained
+ * for. Any other level returns CM_INVALID_ARGUMENT. */
+CM_API cm_status cm_cctx_create(int level,
+                                const cm_model* model,
+                                cm_write_fn write,
+                                void* opaque,
+                                cm_cctx** cctx);
+
+CM_API cm_status cm_cctx_write(cm_cctx* cctx, const void* data, size_t size);
+
+/* Writes the remaining blocks and the index. The context starts a new
+ * container with the next write. */
+CM_API cm_status cm_cctx_end(cm_cctx* cctx);
+
+/* Continues the container of size bytes read by read instead of starting a
+ * new one: the next blocks follow its last block and cm_cctx_end writes the
+ * index of the old and the new blocks. Only the index of the container is
+ * read. The output replaces the container from *offset on (its old index).
+ * Must be called before the first write of a container. */
+CM_API cm_status cm_cctx_append(cm_cctx* cctx,
+                                cm_read_fn read,
+                                void* opaque,
+                                uint64_t size,
+                                uint64_t* offset);
+
+CM_API void cm_cctx_free(cm_cctx* cctx);
+
+/* size: bytes of the container */
+CM_API cm_status cm_dctx_create(cm_read_fn read, void* opaque, uint64_t size, cm_dctx** dctx);
+
+CM_API uint64_t cm_dctx_raw_size(const cm_dctx* dctx);
+
+/* Decodes the next bytes, *readSize is 0 at the end of the data */
+CM_API cm_status cm_dctx_read(cm_dctx* dctx, void* dst, size_t dstCapacity, size_t* readSize);
+
+/* Random access, does not move the position of cm_dctx_read */
+CM_API cm_status cm_dctx_read_at(cm_dctx* dctx, uint64_t offset, size_t length, void* dst);
+
+CM_API void cm_dctx_free(cm_dctx* dctx);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* COMPRESSIONMETHODS_H */
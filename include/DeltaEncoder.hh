@@ -0,0 +1,72 @@
+#ifndef DELTAENCODER_HH
+#define DELTAENCODER_HH
+
+#include "IEncoder.hh"
+
+#include <cstddef>
+#include <cstdint>
+
+///////////////////////////////////////////////////////////////////////////////
+// Replaces every field of the data by its difference to the field stride
+// bytes before it, so counters, timestamps and sequence numbers that grow
+// steadily become small repeating values for the Markov and Huffman stages
+// behind it. The fields are fieldWidth (1, 2, 4 or 8) bytes wide, the stride
+// is a multiple of the width: the width for an array of numbers, the record
+// size for a field of fixed size records (the other fields of the record are
+// then delta coded against their own predecessors as well).
+// Arithmetic deltas read the fields in the given byte order, XOR deltas do
+// not depend on it. The first stride bytes and the bytes after the last
+// whole field are kept as they are.
+///////////////////////////////////////////////////////////////////////////////
+
+class DeltaEncoder : public IEncoder
+{
+   static const uint16_t mEncoderId = 0x0004;
+
+ public:
+   enum DeltaType
+   {
+      Arithmetic = 0,
+      Xor = 1
+   };
+
+   enum ByteOrder
+   {
+      BigEndian = 0,
+      LittleEndian = 1
+   };
+
+   // Throws if the width or the stride is not supported
+   DeltaEncoder(size_t fieldWidth,
+                size_t stride,
+                DeltaType deltaType = Arithmetic,
+                ByteOrder byteOrder = BigEndian);
+   ~DeltaEncoder(){};
+
+   uint16_t getEncoderId() const override { return mEncoderId; };
+   static DeltaEncoder* deserializerFactory(const bitSet&);
+
+   // Inherited functions from IEncoder
+   bitSet encode(const bitSet&) override;
+   bitSet decode(const bitSet&) override;
+   void encodeInPlace(bitSet&) override;
+   void decodeInPlace(bitSet&) override;
+   bitSet serialize() const override;
+   size_t getTableSize() const override;
+   bool isValid() const override;
+   std::map<bitSet, bitSet> getEncodingMap() const override { return std::map<bitSet, bitSet>(); };
+   void setup(const bitSet&) override;
+   void reset() override;
+
+ private:
+   DeltaEncoder() = default;
+
+   static bool isSupported(size_t fieldWidth, size_t stride);
+
+   size_t mFieldWidth = 0;
+   size_t mStride = 0;
+   DeltaType mDeltaType = Arithmetic;
+   ByteOrder mByteOrder = BigEndian;
+};
+
+#endif // DELTAENCODER_HH
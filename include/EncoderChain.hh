@@ -1,14 +1,23 @@
 #ifndef ENCODERCHAIN_HH
 #define ENCODERCHAIN_HH
 
+#include "AllocationStats.hh"
 #include "IEncoder.hh"
 
 #include <memory>
+#include <string>
 #include <vector>
 
 class EncoderChain : public IEncoder
 {
  public:
+   struct StageStats
+   {
+      std::string name; // e.g. "padder", "markov+huffman" for fused stages
+      double seconds;
+      AllocationStats::Counters allocations;
+   };
+
    EncoderChain();
    ~EncoderChain(){};
 
@@ -16,10 +25,24 @@ class EncoderChain : public IEncoder
    uint16_t getEncoderId() const override { return 0x0000; };
    static uint16_t readEncoderId(const bitSet&);
    static EncoderChain* deserializerFactory(const bitSet&);
+   // Deserialized chain in encoding order, encodes more data with its models
+   static EncoderChain* encoderFactory(const bitSet&);
+
+   // Time and allocations of every stage of the last encode or decode. Only
+   // recorded while AllocationStats is enabled.
+   const std::vector<StageStats>& getStageStats() const { return mStageStats; };
+
+   // Encoders in the order they were added (deserialized chains: decode order)
+   size_t getNumEncoders() const { return mEncoderChain.size(); };
+   IEncoder& getEncoder(size_t i) const { return *mEncoderChain.at(i); };
 
    // Inherited functions from IEncoder
+   using IEncoder::decode;
+   using IEncoder::encode;
    bitSet encode(const bitSet&) override;
    bitSet decode(const bitSet&) override;
+   void encodeInPlace(bitSet&) override;
+   void decodeInPlace(bitSet&) override;
    bitSet serialize() const override;
    size_t getTableSize() const override;
    bool isValid() const override;
@@ -28,7 +51,12 @@ class EncoderChain : public IEncoder
    void reset() override;
 
  private:
+   // Runs the stages on result, the first one reads data instead if it is set
+   void encodeStages(const bitSet* data, bitSet& result);
+   void decodeStages(const bitSet* data, bitSet& result);
+
    std::vector<std::unique_ptr<IEncoder>> mEncoderChain;
+   std::vector<StageStats> mStageStats;
 };
 
 #endif // ENCODERCHAIN_HH
\ No newline at end of file
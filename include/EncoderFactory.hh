@@ -0,0 +1,25 @@
+#ifndef ENCODERFACTORY_HH
+#define ENCODERFACTORY_HH
+
+#include "HuffmanTransducer.hh"
+#include "MarkovEncoder.hh"
+
+#include <memory>
+
+///////////////////////////////////////////////////////////////////////////////
+// Selects the native implementation for 8, 16 and 32 bit symbols and the
+// dynamic one for any other symbol size.
+///////////////////////////////////////////////////////////////////////////////
+
+class EncoderFactory
+{
+ public:
+   static std::unique_ptr<MarkovEncoder> createMarkovEncoder(size_t symbolSize, double threshold);
+   static std::unique_ptr<HuffmanTransducer> createHuffmanTransducer(size_t symbolSize,
+                                                                     size_t numThreads = 1);
+
+   static MarkovEncoder* deserializeMarkovEncoder(const bitSet&);
+   static HuffmanTransducer* deserializeHuffmanTransducer(const bitSet&);
+};
+
+#endif // ENCODERFACTORY_HH
\ No newline at end of file
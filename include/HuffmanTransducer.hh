@@ -4,6 +4,7 @@
 #include "IEncoder.hh"
 
 #include <boost/unordered_map.hpp>
+#include <functional>
 #include <map>
 
 class HuffmanTransducer : public IEncoder
@@ -50,6 +51,8 @@ class HuffmanTransducer : public IEncoder
    double getEntropy() const;
    double getAvgCodeLength() const;
    static HuffmanTransducer* deserializerFactory(const bitSet&);
+   static size_t readEncodingMap(const bitSet&, std::map<bitSet, bitSet>&);
+   static size_t readEncodingMap(const bitSet&, std::map<bitSet, bitSet>&, bitSet& escapeSymbol);
 
    // Inherited functions
    bitSet encode(const bitSet&) override;
@@ -61,16 +64,48 @@ class HuffmanTransducer : public IEncoder
    uint16_t getEncoderId() const override { return mEncoderId; };
    void setup(const bitSet&) override;
    void reset() override;
-
- private:
+   size_t getSymbolSize() const { return mSymbolSize; };
+
+   // Setup from known symbol probabilities instead of the source data
+   virtual void setupByStatistics(const CodeProbabilityMap& probabilities);
+
+   // Only the maxCodes most frequent symbols get a code, the others are
+   // written as an escape code followed by the symbol itself. Bounds the
+   // table size for wide symbols, 0 disables the escape code. Applies to the
+   // next setup.
+   void setMaxCodes(size_t maxCodes) { mMaxCodes = maxCodes; };
+   size_t getMaxCodes() const { return mMaxCodes; };
+   bool hasEscape() const { return mEscapeSymbol.size(); };
+
+   // setup() builds the model from a sample of about sampleSize bytes of
+   // larger inputs, 0 uses the whole input. The model always reserves the
+   // escape code for the symbols the sample missed. Applies to the next setup.
+   void setTrainingSampleSize(size_t sampleSize) { mTrainingSampleSize = sampleSize; };
+   size_t getTrainingSampleSize() const { return mTrainingSampleSize; };
+
+ protected:
    HuffmanTransducer(const std::map<bitSet, bitSet>& symbolMap,
                      size_t symbolSize,
-                     size_t numThreads = 1);
-   void decodeChangeState(bool);
+                     size_t numThreads = 1,
+                     const bitSet& escapeSymbol = bitSet());
    void setupByProbability(CodeProbabilityMap&& symbolMap);
+   void forEachCode(const std::function<void(const bitSet&, const bitSet&)>&) const;
 
    size_t mSymbolSize;
    size_t mNumThreads;
+   size_t mMaxCodes;
+   size_t mTrainingSampleSize;
+
+   // Its code stands for the escape, the value is the smallest one without a
+   // code. Empty without escape code.
+   bitSet mEscapeSymbol;
+
+ private:
+   CodeProbabilityMap limitCodes(const CodeProbabilityMap& symbolMap);
+   bitSet encodeEscaped(const bitSet&) const;
+   bitSet decodeEscaped(const bitSet&) const;
+   void decodeChangeState(bool);
+
    bitSet mBuffer;
    state* mRootState;
    state* mCurrentState;
@@ -0,0 +1,84 @@
+#ifndef HUFFMANTRANSDUCERT_HH
+#define HUFFMANTRANSDUCERT_HH
+
+#include "HuffmanTransducer.hh"
+
+#include <array>
+#include <cstdint>
+#include <vector>
+
+///////////////////////////////////////////////////////////////////////////////
+// HuffmanTransducer specialized for symbols of sizeof(T) * 8 bits.
+// Codes and serialization are shared with HuffmanTransducer. Encoding uses a
+// native code table and a word based bit writer, decoding uses a lookup table
+// for the first mLookupBits bits of a code and a flat tree for the rest.
+// Falls back to HuffmanTransducer for partial symbols or codes that do not
+// fit into a machine word.
+///////////////////////////////////////////////////////////////////////////////
+
+template<typename T>
+class MarkovEncoderT;
+
+template<typename T>
+class HuffmanTransducerT : public HuffmanTransducer
+{
+ public:
+   HuffmanTransducerT(const bitSet& sourceData, size_t numThreads = 1);
+   HuffmanTransducerT(size_t numThreads = 1);
+   HuffmanTransducerT(const std::map<bitSet, bitSet>& symbolMap,
+                      size_t numThreads = 1,
+                      const bitSet& escapeSymbol = bitSet());
+
+   bitSet encode(const bitSet&) override;
+   bitSet decode(const bitSet&) override;
+   void setup(const bitSet&) override;
+   void setupByStatistics(const CodeProbabilityMap&) override;
+   void reset() override;
+
+   // Fused MarkovEncoderT and HuffmanTransducerT in a single pass over the
+   // symbols, the output is the same as that of the separate encoders
+   bitSet encodeMarkov(const bitSet& data, MarkovEncoderT<T>& markov);
+   bitSet decodeMarkov(const bitSet& data, MarkovEncoderT<T>& markov);
+
+ private:
+   static constexpr size_t mMaxCodeLength = 57;
+   static constexpr size_t mMaxLookupBits = 11;
+
+   struct lookupEntry
+   {
+      int32_t next;   // symbol index if length > 0, tree node otherwise
+      uint8_t length; // code length, 0 if the code is longer than mLookupBits
+   };
+
+   void buildTables();
+   bool findCode(T symbol, uint64_t& code, uint8_t& length) const;
+
+   template<typename F>
+   bitSet encodeSymbols(size_t numSymbols, F&& symbolAt) const;
+   template<typename F>
+   bitSet decodeSymbols(const bitSet& data, F&& map) const;
+
+   bool mNative;
+
+   // Encoding: dense tables for 8 and 16 bit symbols, hash map for wider ones
+   std::vector<uint64_t> mCodes;
+   std::vector<uint8_t> mCodeLengths;
+   boost::unordered_map<T, std::pair<uint64_t, uint8_t>> mCodeMap;
+
+   // Escape code, not in the encoding tables
+   uint64_t mEscapeCode;
+   uint8_t mEscapeLength;
+
+   // Decoding: children of the inner nodes, leaves are stored as ~symbolIdx
+   std::vector<std::array<int32_t, 2>> mTree;
+   std::vector<T> mSymbols;
+   int32_t mEscapeIndex; // index of the escape in mSymbols, -1 without escape code
+   std::vector<lookupEntry> mLookup;
+   size_t mLookupBits;
+};
+
+extern template class HuffmanTransducerT<uint8_t>;
+extern template class HuffmanTransducerT<uint16_t>;
+extern template class HuffmanTransducerT<uint32_t>;
+
+#endif // HUFFMANTRANSDUCERT_HH
\ No newline at end of file
@@ -3,6 +3,7 @@
 
 #include <boost/dynamic_bitset.hpp>
 #include <map>
+#include <utility>
 
 typedef boost::dynamic_bitset<> bitSet;
 
@@ -20,6 +21,24 @@ class IEncoder
    // Encoder functions
    virtual bitSet encode(const bitSet&) = 0;
    virtual bitSet decode(const bitSet&) = 0;
+
+   // In-place variants, the data is replaced by the result. The defaults go
+   // through a copy, encoders that can reuse the buffer override them.
+   virtual void encodeInPlace(bitSet& data) { data = encode(data); }
+   virtual void decodeInPlace(bitSet& data) { data = decode(data); }
+
+   // Rvalue variants, the buffer of the data is reused for the result
+   bitSet encode(bitSet&& data)
+   {
+      encodeInPlace(data);
+      return std::move(data);
+   }
+   bitSet decode(bitSet&& data)
+   {
+      decodeInPlace(data);
+      return std::move(data);
+   }
+
    virtual std::map<bitSet, bitSet> getEncodingMap() const = 0;
    virtual bitSet serialize() const = 0;
 };
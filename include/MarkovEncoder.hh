@@ -1,16 +1,45 @@
 #ifndef MARKOVENCODER_HH
 #define MARKOVENCODER_HH
 
+#include "BinaryUtils.hh"
 #include "IEncoder.hh"
+#include "SymbolStatistics.hh"
 
 #include <boost/unordered_map.hpp>
+#include <cstdint>
 #include <map>
+#include <vector>
 
 class MarkovEncoder : public IEncoder
 {
    static const uint16_t mEncoderId = 0x0002;
+   static constexpr size_t mMinChunkSymbols = 1 << 16; // Smallest chunk of a parallel encode
+   static constexpr size_t mMaxUnusedCandidates = 8;   // Scans of the data after sampling
 
  public:
+   // Outcome of the predictions for one context (previous symbol)
+   struct ContextStats
+   {
+      uint64_t context;   // previous symbol
+      uint64_t predicted; // its predicted successor
+      uint64_t hits;
+      uint64_t misses;
+   };
+
+   // Outcome of the predictions of every symbol encoded while the counting
+   // was enabled. A hit is written as the unused symbol (the escape), misses
+   // and unpredicted symbols are written as literals.
+   struct PredictionStats
+   {
+      uint64_t hits = 0;        // symbol == prediction of its context
+      uint64_t misses = 0;      // literal although the context has a prediction
+      uint64_t unpredicted = 0; // literal of a context without prediction or a restart point
+      std::vector<ContextStats> topMisses; // contexts with the most misses, descending
+
+      uint64_t getNumSymbols() const { return hits + misses + unpredicted; };
+      double getHitRate() const { return getNumSymbols() ? double(hits) / getNumSymbols() : 0; };
+   };
+
    MarkovEncoder(const bitSet& data, size_t symbolSize, double threshold);
    MarkovEncoder(size_t symbolSize, double threshold);
    static MarkovEncoder* deserializerFactory(const bitSet&);
@@ -25,11 +54,60 @@ class MarkovEncoder : public IEncoder
    uint16_t getEncoderId() const override { return mEncoderId; };
    void setup(const bitSet&) override;
    void reset() override;
+   size_t getSymbolSize() const { return mSymbolSize; };
 
- private:
+   // Every interval-th symbol is encoded without a prediction, the segments
+   // between them are decoded in parallel. Rounded up to a multiple of 64
+   // symbols, 0 disables restart points.
+   void setRestartInterval(size_t interval);
+   size_t getRestartInterval() const { return mRestartInterval; };
+
+   // setup() learns the predictions from a sample of about sampleSize bytes
+   // of larger inputs, 0 uses the whole input. The unused symbol is still
+   // checked against the whole input.
+   void setTrainingSampleSize(size_t sampleSize) { mTrainingSampleSize = sampleSize; };
+   size_t getTrainingSampleSize() const { return mTrainingSampleSize; };
+
+   // setup() keeps the transition counts within about budget bytes: every
+   // context tracks only its most frequent successors (see TransitionSketch)
+   // and the predictions come from their guaranteed counts. 0 counts every
+   // transition exactly. Inputs that are not a whole number of symbols are
+   // always counted exactly.
+   void setTrainingMemoryBudget(size_t budget) { mTrainingMemoryBudget = budget; };
+   size_t getTrainingMemoryBudget() const { return mTrainingMemoryBudget; };
+
+   // Counting of the prediction outcomes, off by default. Enabling clears the
+   // counts, every following encode adds to them with a separate pass over its
+   // input; the encode kernels themselves are not touched.
+   void setCollectPredictionStats(bool collect);
+   bool isCollectingPredictionStats() const { return mCollectPredictionStats; };
+   PredictionStats getPredictionStats(size_t maxContexts = 8) const;
+
+   // Counts the predictions of data as encode() applies them
+   void countPredictions(const bitSet& data);
+
+   // Symbol probabilities of the encoded training data, derived from the
+   // statistics of setup(). Empty if they are not known.
+   const BinaryUtils::CodeProbabilityMap& getEncodedStatistics() const
+   {
+      return mEncodedStatistics;
+   };
+
+ protected:
    MarkovEncoder(const std::map<bitSet, bitSet>&, bitSet, size_t);
 
-   typedef boost::unordered_map<bitSet, boost::unordered_map<bitSet, float>> MarkovChain;
+   static size_t getChunkSize(size_t numSymbols, size_t alignment);
+   bool isRestartPoint(size_t symbolIdx) const;
+   void encodeChunk(const bitSet& data, bitSet& result, size_t begin, size_t end) const;
+   void decodeSegment(const bitSet& data, bitSet& result, size_t begin, size_t end) const;
+   bool findUnusedOutsideSample(const bitSet& data,
+                                const SymbolStatistics& sampleStatistics,
+                                uint64_t& symbol) const;
+   void setupEncodedStatistics(const bitSet& data,
+                               const SymbolStatistics& statistics,
+                               const boost::unordered_map<uint64_t, SymbolStatistics::Prediction>&);
+
+   typedef boost::unordered_map<bitSet, boost::unordered_map<bitSet, uint64_t>> MarkovChain;
    MarkovChain computeMarkovChain(const bitSet& data, size_t symbolSize = 8);
 
    boost::unordered_map<bitSet, bitSet> createEncodingMap(const MarkovChain& markovChain,
@@ -39,6 +117,18 @@ class MarkovEncoder : public IEncoder
    bitSet mUnusedSymbol;
    size_t mSymbolSize;
    float mThreshold;
+   size_t mRestartInterval;
+   size_t mTrainingSampleSize;
+   size_t mTrainingMemoryBudget;
+   BinaryUtils::CodeProbabilityMap mEncodedStatistics;
+
+   bool mCollectPredictionStats;
+   PredictionStats mPredictionStats;                         // totals, topMisses is empty
+   boost::unordered_map<uint64_t, ContextStats> mContextStats; // contexts with a prediction
+
+ private:
+   template<typename F>
+   void countPredictions(size_t numSymbols, const F& symbolAt);
 };
 
 #endif // MARKOVENCODER_HH
\ No newline at end of file
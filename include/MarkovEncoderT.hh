@@ -0,0 +1,61 @@
+#ifndef MARKOVENCODERT_HH
+#define MARKOVENCODERT_HH
+
+#include "MarkovEncoder.hh"
+
+#include <cstdint>
+#include <vector>
+
+///////////////////////////////////////////////////////////////////////////////
+// MarkovEncoder specialized for symbols of sizeof(T) * 8 bits.
+// The model and the serialized format are shared with MarkovEncoder, only
+// encode/decode run on native integers. Inputs that are not a whole number of
+// symbols are handled by MarkovEncoder.
+///////////////////////////////////////////////////////////////////////////////
+
+template<typename T>
+class HuffmanTransducerT;
+
+template<typename T>
+class MarkovEncoderT : public MarkovEncoder
+{
+ public:
+   MarkovEncoderT(const bitSet& data, double threshold);
+   MarkovEncoderT(double threshold);
+   MarkovEncoderT(const MarkovEncoder&);
+
+   bitSet encode(const bitSet&) override;
+   bitSet decode(const bitSet&) override;
+   void decodeInPlace(bitSet&) override;
+   void setup(const bitSet&) override;
+   void reset() override;
+
+ private:
+   friend class HuffmanTransducerT<T>;
+
+   static constexpr uint64_t mNoPrediction = UINT64_MAX;
+
+   void buildPredictionTable();
+   uint64_t predict(T symbol) const;
+   void encodeChunk(const bitSet::block_type* input,
+                    bitSet::block_type* result,
+                    size_t begin,
+                    size_t end) const;
+   void encodeRange(const bitSet::block_type* input,
+                    bitSet::block_type* result,
+                    size_t begin,
+                    size_t end) const;
+   void decodeRange(bitSet::block_type* result, size_t begin, size_t end) const;
+
+   // Dense table for 8 and 16 bit symbols (UINT32_MAX if there is no prediction),
+   // hash map for wider ones
+   std::vector<uint32_t> mPredictionTable;
+   boost::unordered_map<T, uint64_t> mPredictionMap;
+   T mNativeUnusedSymbol;
+};
+
+extern template class MarkovEncoderT<uint8_t>;
+extern template class MarkovEncoderT<uint16_t>;
+extern template class MarkovEncoderT<uint32_t>;
+
+#endif // MARKOVENCODERT_HH
\ No newline at end of file
@@ -0,0 +1,48 @@
+#ifndef MARKOVKERNELS_HH
+#define MARKOVKERNELS_HH
+
+#include "BinaryUtils.hh"
+
+#include <cstdint>
+
+///////////////////////////////////////////////////////////////////////////////
+// Markov prediction kernels for 8 and 16 bit symbols stored in the blocks of
+// a bitSet. Predictions come from a dense table indexed by the previous
+// symbol, UINT32_MAX marks symbols without a prediction.
+// Encoding only depends on the original input, so it runs on whole vectors
+// (AVX2 if the CPU supports it, scalar otherwise). Decoding is serial and
+// uses a branch-light scalar loop.
+///////////////////////////////////////////////////////////////////////////////
+
+namespace MarkovKernels {
+
+enum class Mode
+{
+   UnusedSymbol, // predicted symbols are replaced by the unused symbol
+   Xor           // symbols are XORed with their prediction
+};
+
+// Encodes the symbols [begin, end) of input into output, begin > 0
+template<typename T>
+void
+encode(const BinaryUtils::bitSet::block_type* input,
+       BinaryUtils::bitSet::block_type* output,
+       size_t begin,
+       size_t end,
+       const uint32_t* predictionTable,
+       T unusedSymbol,
+       Mode mode);
+
+// Decodes the symbols [begin, end) in place, symbol begin - 1 must be decoded
+template<typename T>
+void
+decode(BinaryUtils::bitSet::block_type* data,
+       size_t begin,
+       size_t end,
+       const uint32_t* predictionTable,
+       T unusedSymbol,
+       Mode mode);
+
+} // namespace MarkovKernels
+
+#endif // MARKOVKERNELS_HH
@@ -28,6 +28,8 @@ class Padder : public IEncoder
    // Inherited functions from IEncoder
    bitSet encode(const bitSet&) override;
    bitSet decode(const bitSet&) override;
+   void encodeInPlace(bitSet&) override;
+   void decodeInPlace(bitSet&) override;
    bitSet serialize() const override;
    size_t getTableSize() const override;
    bool isValid() const override;
@@ -36,6 +38,8 @@ class Padder : public IEncoder
    void reset() override;
 
  private:
+   size_t getPaddingSize(size_t numBits) const;
+
    PaddingType mPaddingMode;
    uint32_t mAddedBits;
 };
@@ -0,0 +1,37 @@
+#ifndef PCAPSPLITTER_HH
+#define PCAPSPLITTER_HH
+
+#include "IEncoder.hh"
+
+#include <cstdint>
+#include <vector>
+
+class PcapSplitter
+{
+ public:
+   enum Substream
+   {
+      GlobalHeader = 0,
+      RecordHeaders = 1,
+      ProtocolHeaders = 2,
+      Payloads = 3,
+      NumSubstreams = 4
+   };
+
+   static bool isPcap(const bitSet&);
+   static std::vector<bitSet> split(const bitSet&);
+   static bitSet merge(const std::vector<bitSet>&);
+
+ private:
+   static const size_t mGlobalHeaderSize = 24;
+   static const size_t mRecordHeaderSize = 16;
+
+   static bool readMagic(const uint8_t*, bool& bigEndian);
+   static uint32_t readUint32(const uint8_t*, bool bigEndian);
+   static size_t protocolHeaderLength(const uint8_t* packet,
+                                      size_t inclLen,
+                                      uint32_t linkType,
+                                      size_t available);
+};
+
+#endif // PCAPSPLITTER_HH
\ No newline at end of file
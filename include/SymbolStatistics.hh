@@ -0,0 +1,106 @@
+#ifndef SYMBOLSTATISTICS_HH
+#define SYMBOLSTATISTICS_HH
+
+#include "BinaryUtils.hh"
+#include "TransitionSketch.hh"
+
+#include <boost/unordered_map.hpp>
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
+
+///////////////////////////////////////////////////////////////////////////////
+// Alphabet analysis of a bitSet in a single pass: symbol presence bitmap,
+// unigram histogram and the transitions between consecutive symbols.
+// Shared by the training of MarkovEncoder and HuffmanTransducer. Symbols are
+// native integers of up to 32 bits (value as in slice(...).to_ulong()),
+// tables are dense for small alphabets and hashed for large ones. Large inputs
+// are counted by chunks in parallel, the exact integer counts of the chunks
+// are merged, so the result does not depend on the threads. With a
+// transition memory budget the transitions go into a TransitionSketch instead
+// of exact tables.
+///////////////////////////////////////////////////////////////////////////////
+
+class SymbolStatistics
+{
+ public:
+   struct Prediction
+   {
+      uint64_t next;  // most frequent successor
+      uint64_t count; // number of transitions to it
+   };
+
+   // maxTransitionBytes: memory of the transition counts, 0 counts exactly
+   SymbolStatistics(const BinaryUtils::bitSet& data,
+                    size_t symbolSize,
+                    bool withTransitions = true,
+                    size_t maxTransitionBytes = 0);
+
+   // Whole number of symbols of at most 32 bits
+   static bool isSupported(const BinaryUtils::bitSet& data, size_t symbolSize);
+
+   size_t getSymbolSize() const { return mSymbolSize; };
+   size_t getNumSymbols() const { return mNumSymbols; };
+   uint64_t getCount(uint64_t symbol) const;
+   bool isPresent(uint64_t symbol) const;
+
+   // The largest symbol that does not occur in the data
+   bool findUnusedSymbol(uint64_t& symbol) const;
+
+   // Order-0 entropy and the entropy conditioned on the previous symbol, in
+   // bits per symbol. The latter needs the exact transitions.
+   double getEntropy() const;
+   double getConditionalEntropy() const;
+
+   // (symbol, count) pairs of the present symbols in ascending order
+   std::vector<std::pair<uint64_t, uint64_t>> getCounts() const;
+
+   // Probabilities of the present symbols for HuffmanTransducer::setupByStatistics,
+   // only the maxSymbols most frequent ones (ties towards the smaller symbol) if
+   // maxSymbols is not 0
+   BinaryUtils::CodeProbabilityMap getProbabilities(size_t maxSymbols = 0) const;
+
+   // Most frequent successor of every symbol whose share of the transitions
+   // from that symbol exceeds the threshold. With a sketch the share is the
+   // guaranteed count of the successor over the counted transitions.
+   boost::unordered_map<uint64_t, Prediction> getPredictions(double threshold) const;
+
+ private:
+   static constexpr size_t mMaxDenseCounts = 16;      // symbol size of the dense histogram
+   static constexpr size_t mMaxDenseTransitions = 8;  // symbol size of the dense transitions
+   static constexpr size_t mMaxPresenceBitmap = 24;   // symbol size of the presence bitmap
+   static constexpr size_t mMinChunkSymbols = 1 << 18; // smallest chunk of a parallel count
+
+   typedef boost::unordered_map<uint64_t, uint64_t> CountMap;
+
+   // Counts of the whole data or of one chunk. The hashed tables are split
+   // into shards by symbol (counts) or by previous symbol (transitions), so
+   // that the shards are merged and searched for predictions in parallel.
+   struct Tables
+   {
+      std::vector<uint64_t> present;
+      std::vector<uint64_t> counts;
+      std::vector<CountMap> countMaps;
+      // Indexed by (previous << mSymbolSize) | current
+      std::vector<uint64_t> transitions;
+      std::vector<CountMap> transitionMaps;
+   };
+
+   template<typename F>
+   void count(const F& symbolAt, bool withTransitions);
+   template<typename F>
+   void countChunk(const F& symbolAt, size_t begin, size_t end, bool withTransitions, Tables&);
+   void merge(std::vector<Tables>& partial);
+   size_t getShard(uint64_t key) const;
+
+   size_t mSymbolSize;
+   size_t mNumSymbols;
+   uint64_t mLastSymbol;
+   size_t mNumShards;
+
+   Tables mTables;
+   std::shared_ptr<TransitionSketch> mTransitionSketch;
+};
+
+#endif // SYMBOLSTATISTICS_HH
@@ -0,0 +1,55 @@
+#ifndef THREADPOOL_HH
+#define THREADPOOL_HH
+
+#include <cstddef>
+#include <functional>
+#include <vector>
+
+///////////////////////////////////////////////////////////////////////////////
+// The workers every parallel stage runs on: encoding, decoding, training and
+// the block I/O of the container. A parallel loop is split into ranges that
+// the calling thread and the workers take from a shared counter, so uneven
+// iterations balance themselves. Loops inside a loop run serially on the
+// thread that reached them, the number of busy threads never exceeds the
+// configured one. The workers start with the first parallel loop.
+// An embedding application can hand the ranges to its own executor instead,
+// then the library starts no threads at all.
+///////////////////////////////////////////////////////////////////////////////
+
+namespace ThreadPool {
+
+// Runs a task exactly once, on any thread
+typedef std::function<void(std::function<void()> task)> Executor;
+
+// Threads of a parallel loop, the calling one included; 0 for the number of
+// hardware threads. Worker i is pinned to cpus[i % cpus.size()] if cpus are
+// given. Must not be called while a parallel loop is running.
+void
+configure(size_t numThreads, const std::vector<int>& cpus = {});
+
+// Submits the parallel work to the executor (numThreads - 1 tasks per loop at
+// most) and stops the workers. An empty executor restores the workers.
+void
+setExecutor(Executor executor, size_t numThreads);
+
+size_t
+getNumThreads();
+
+// Calls body(begin, end) for ranges covering [0, n). Throws the first
+// exception of the body once all ranges are done.
+void
+forRanges(size_t n, const std::function<void(size_t begin, size_t end)>& body);
+
+template<typename F>
+void
+parallelFor(size_t n, const F& body)
+{
+   forRanges(n, [&](size_t begin, size_t end) {
+      for (size_t i = begin; i < end; ++i)
+         body(i);
+   });
+}
+
+} // namespace ThreadPool
+
+#endif // THREADPOOL_HH
@@ -0,0 +1,86 @@
+#ifndef TRACER_HH
+#define TRACER_HH
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+///////////////////////////////////////////////////////////////////////////////
+// Opt-in span tracer. While enabled, every Span records its name, start,
+// duration and thread; write() saves them as Chrome trace-event JSON, which
+// chrome://tracing or ui.perfetto.dev open offline. Disabled, a Span costs a
+// relaxed atomic load and a predicted branch. Compiled with -DDISABLE_TRACING
+// spans are empty and the recording is removed altogether.
+///////////////////////////////////////////////////////////////////////////////
+
+namespace Tracer {
+
+extern std::atomic<bool> sEnabled;
+
+// Enabling starts a new trace, the recorded spans are dropped
+void
+setEnabled(bool);
+
+inline bool
+isEnabled()
+{
+#ifdef DISABLE_TRACING
+   return false;
+#else
+   return __builtin_expect(sEnabled.load(std::memory_order_relaxed), 0);
+#endif
+}
+
+// Microseconds since the trace was enabled
+uint64_t
+now();
+
+void
+record(std::string name, uint64_t start, uint64_t duration);
+
+// Number of spans recorded since the trace was enabled
+size_t
+getNumSpans();
+
+// Throws std::runtime_error if the file cannot be written
+void
+write(const std::string& path);
+
+// Records the time between its construction and its destruction
+class Span
+{
+ public:
+   explicit Span(const char* name)
+   {
+      if (isEnabled()) {
+         mName = name;
+         mStart = now();
+         mActive = true;
+      }
+   }
+
+   ~Span()
+   {
+      if (mActive)
+         record(std::move(mName), mStart, now() - mStart);
+   }
+
+   Span(const Span&) = delete;
+   Span& operator=(const Span&) = delete;
+
+   // Names known only at the end of the span (e.g. fused stages)
+   void setName(const std::string& name)
+   {
+      if (mActive)
+         mName = name;
+   }
+
+ private:
+   std::string mName;
+   uint64_t mStart = 0;
+   bool mActive = false;
+};
+
+} // namespace Tracer
+
+#endif // TRACER_HH
@@ -0,0 +1,74 @@
+#ifndef TRANSITIONSKETCH_HH
+#define TRANSITIONSKETCH_HH
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+///////////////////////////////////////////////////////////////////////////////
+// Transition counts between consecutive symbols in a fixed memory budget.
+// Every context (previous symbol) keeps a Space-Saving summary of its k most
+// frequent successors and the number of its transitions. Contexts are indexed
+// densely if all of them fit into the budget, otherwise they share a hashed
+// table of small buckets and a count-min sketch of the context totals decides which context
+// keeps a contested slot. The memory does not grow after construction.
+// Counts are 32 bit, a context must have less than 2^32 transitions.
+///////////////////////////////////////////////////////////////////////////////
+
+class TransitionSketch
+{
+ public:
+   // Most frequent successor of a tracked context
+   struct Candidate
+   {
+      uint64_t context;
+      uint64_t next;
+      uint64_t count; // guaranteed lower bound of the transitions to next
+      uint64_t total; // transitions from the context (upper bound if hashed)
+   };
+
+   // Throws std::runtime_error if the budget does not hold a single context
+   TransitionSketch(size_t symbolSize, size_t memoryBudget);
+
+   void add(uint64_t previous, uint64_t next);
+
+   // One candidate per tracked context with a non-zero lower bound
+   std::vector<Candidate> getCandidates() const;
+
+   size_t getMemoryUsage() const;
+   bool isDense() const { return mDense; };
+   size_t getCountersPerContext() const { return mCountersPerContext; };
+
+ private:
+   static constexpr size_t mMaxCounters = 64;     // per context of the dense table
+   static constexpr size_t mHashedCounters = 4;   // per context of the hashed table
+   static constexpr size_t mWays = 4;             // slots per bucket of the hashed table
+   static constexpr size_t mCountMinDepth = 4;
+   static constexpr size_t mCountMinShare = 8;    // 1/8 of a hashed budget
+   static constexpr uint64_t mNoContext = UINT64_MAX;
+   static constexpr size_t mNoSlot = SIZE_MAX;
+
+   struct Counter
+   {
+      uint32_t symbol;
+      uint32_t count; // 0 if the counter is free
+      uint32_t error; // overestimation of count
+   };
+
+   size_t findSlot(uint64_t context);
+   uint64_t addCountMin(uint64_t context);
+   uint64_t estimateCountMin(uint64_t context) const;
+   size_t getCountMinIndex(size_t row, uint64_t context) const;
+
+   bool mDense;
+   size_t mCountersPerContext;
+   size_t mNumBuckets;
+   uint64_t mCountMinMask;
+
+   std::vector<uint64_t> mContexts; // hashed only, mNoContext if the slot is free
+   std::vector<uint64_t> mTotals;
+   std::vector<Counter> mCounters;  // mCountersPerContext per slot
+   std::vector<uint32_t> mCountMin; // hashed only, mCountMinDepth rows
+};
+
+#endif // TRANSITIONSKETCH_HH
@@ -0,0 +1,124 @@
+#include "AllocationStats.hh"
+
+#include <atomic>
+#include <cstdlib>
+#include <malloc.h>
+#include <new>
+
+namespace AllocationStats {
+
+static std::atomic<bool> sEnabled{ false };
+static std::atomic<uint64_t> sAllocations{ 0 };
+static std::atomic<uint64_t> sBytes{ 0 };
+static std::atomic<int64_t> sLiveBytes{ 0 };
+static std::atomic<int64_t> sPeakBytes{ 0 };
+
+static void
+updatePeak(int64_t live)
+{
+   int64_t peak = sPeakBytes.load(std::memory_order_relaxed);
+   while (live > peak &&
+          !sPeakBytes.compare_exchange_weak(peak, live, std::memory_order_relaxed))
+      ;
+}
+
+#ifndef DISABLE_ALLOCATION_HOOKS
+static void
+recordAllocation(size_t size)
+{
+   sAllocations.fetch_add(1, std::memory_order_relaxed);
+   sBytes.fetch_add(size, std::memory_order_relaxed);
+   updatePeak(sLiveBytes.fetch_add(size, std::memory_order_relaxed) + size);
+}
+
+static void
+recordFree(size_t size)
+{
+   sLiveBytes.fetch_sub(size, std::memory_order_relaxed);
+}
+#endif // DISABLE_ALLOCATION_HOOKS
+
+///////////////////////////////////////////////////////////////////////////////
+// setEnabled
+///////////////////////////////////////////////////////////////////////////////
+
+void
+setEnabled(bool enabled)
+{
+   sEnabled.store(enabled, std::memory_order_relaxed);
+}
+
+bool
+isEnabled()
+{
+   return sEnabled.load(std::memory_order_relaxed);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Scope
+// The peak is restarted at the current live bytes, the enclosing scope gets
+// the maximum of both peaks back at the end
+///////////////////////////////////////////////////////////////////////////////
+
+Scope::Scope()
+  : mAllocations(sAllocations.load(std::memory_order_relaxed))
+  , mBytes(sBytes.load(std::memory_order_relaxed))
+  , mLiveBytes(sLiveBytes.load(std::memory_order_relaxed))
+  , mOuterPeak(sPeakBytes.exchange(mLiveBytes, std::memory_order_relaxed))
+{}
+
+Scope::~Scope()
+{
+   updatePeak(mOuterPeak);
+}
+
+Counters
+Scope::get() const
+{
+   Counters result;
+   result.allocations = sAllocations.load(std::memory_order_relaxed) - mAllocations;
+   result.bytes = sBytes.load(std::memory_order_relaxed) - mBytes;
+   result.peakBytes = sPeakBytes.load(std::memory_order_relaxed) - mLiveBytes;
+   return result;
+}
+
+} // namespace AllocationStats
+
+///////////////////////////////////////////////////////////////////////////////
+// Global operator new/delete
+// The other forms of libstdc++ (arrays, nothrow) forward to these. The sized
+// delete the compiler emits for C++14 and later is replaced as well, so it
+// does not depend on the library forwarding it. Blocks allocated before the counting was enabled are still
+// subtracted when they are freed, only the differences within a Scope count.
+// Left out with -DDISABLE_ALLOCATION_HOOKS (the library must not replace the
+// allocator of its host), the counters then stay at 0.
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef DISABLE_ALLOCATION_HOOKS
+
+void*
+operator new(std::size_t size)
+{
+   void* p = std::malloc(size ? size : 1);
+   if (!p) {
+      throw std::bad_alloc();
+   }
+   if (AllocationStats::sEnabled.load(std::memory_order_relaxed))
+      AllocationStats::recordAllocation(malloc_usable_size(p));
+   return p;
+}
+
+void
+operator delete(void* p) noexcept
+{
+   if (p && AllocationStats::sEnabled.load(std::memory_order_relaxed))
+      AllocationStats::recordFree(malloc_usable_size(p));
+   std::free(p);
+}
+
+void
+operator delete(void* p, std::size_t) noexcept
+{
+   operator delete(p);
+}
+#endif // DISABLE_ALLOCATION_HOOKS
@@ -2,6 +2,8 @@
 
 #include "BinaryUtils.hh"
 #include "HuffmanTransducer.hh"
+#include "SymbolStatistics.hh"
+#include "Tracer.hh"
 
 #include <algorithm>
 #include <boost/unordered_set.hpp>
@@ -10,6 +12,7 @@
 #include <fstream>
 #include <iostream>
 #include <map>
+#include <numeric>
 #include <random>
 #include <string>
 #include <vector>
@@ -23,28 +26,110 @@ using namespace BinaryUtils;
 bitSet
 BinaryUtils::readBinary(const std::string& inputPath, size_t maxSize)
 {
+   Tracer::Span span("read");
+
    // https://www.cplusplus.com/reference/fstream/ifstream/rdbuf/
    std::ifstream ifs{ inputPath, std::ifstream::binary };
    std::filebuf* pbuf = ifs.rdbuf();
    std::size_t size = pbuf->pubseekoff(0, ifs.end, ifs.in);
    size = size > maxSize && maxSize != 0 ? maxSize : size;
    pbuf->pubseekpos(0, ifs.in);
-   char* buffer = new char[size];
-   pbuf->sgetn(buffer, size);
+   std::vector<uint8_t> buffer(size);
+   pbuf->sgetn(reinterpret_cast<char*>(buffer.data()), size);
    ifs.close();
-   //----------------------------------------------------------
 
-   bitSet output(size * 8);
+   return fromBytes(buffer);
+}
 
-#pragma omp parallel for
-   for (size_t i = 0; i < size; i++) {
-      for (size_t j = 0; j < 8; j++) {
-         buffer[i] & (1 << (7 - j)) ? output[i * 8 + j] = true : output[i * 8 + j] = false;
-      }
+///////////////////////////////////////////////////////////////////////////////
+// Get file size in bytes
+///////////////////////////////////////////////////////////////////////////////
+size_t
+BinaryUtils::getFileSize(const std::string& inputPath)
+{
+   std::ifstream ifs{ inputPath, std::ifstream::binary | std::ifstream::ate };
+   if (!ifs) {
+      throw std::runtime_error("Cannot open " + inputPath);
    }
+   return ifs.tellg();
+}
 
-   delete buffer;
-   return output;
+///////////////////////////////////////////////////////////////////////////////
+// Read sample from file
+// Blocks of blockSize bytes spread evenly over the file at multiples of
+// blockSize, the whole file if it is not larger than sampleSize bytes
+///////////////////////////////////////////////////////////////////////////////
+bitSet
+BinaryUtils::readSample(const std::string& inputPath, size_t sampleSize, size_t blockSize)
+{
+   const size_t size = getFileSize(inputPath);
+   if (size <= sampleSize || blockSize == 0 || sampleSize < blockSize) {
+      return readBinary(inputPath, sampleSize);
+   }
+
+   const size_t numBlocks = sampleSize / blockSize;
+   const size_t fileBlocks = size / blockSize;
+   std::vector<uint8_t> buffer(numBlocks * blockSize);
+
+   std::ifstream ifs{ inputPath, std::ifstream::binary };
+   for (size_t i = 0; i < numBlocks; ++i) {
+      ifs.seekg(i * fileBlocks / numBlocks * blockSize);
+      ifs.read(reinterpret_cast<char*>(&buffer[i * blockSize]), blockSize);
+   }
+   if (!ifs) {
+      throw std::runtime_error("An error occured during reading!");
+   }
+   return fromBytes(buffer);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Sample blocks of data
+// In-memory version of readSample: blocks of about blockSize bytes spread
+// evenly over the data. The blocks are a whole number of 64 bit words and of
+// symbols and start at multiples of their size, so the symbols stay aligned.
+///////////////////////////////////////////////////////////////////////////////
+bitSet
+BinaryUtils::sampleBlocks(const bitSet& data,
+                          size_t sampleSize,
+                          size_t blockSize,
+                          size_t symbolSize)
+{
+   const size_t alignment = std::lcm<size_t>(bitSet::bits_per_block, symbolSize ? symbolSize : 1);
+   const size_t blockBits =
+     std::max(alignment, std::min(blockSize, sampleSize) * 8 / alignment * alignment);
+   const size_t numBlocks = std::max<size_t>(sampleSize * 8 / blockBits, 1);
+   const size_t dataBlocks = data.size() / blockBits;
+   if (dataBlocks <= numBlocks) {
+      return data;
+   }
+
+   const size_t wordsPerBlock = blockBits / bitSet::bits_per_block;
+   const auto& words = getBlocks(data);
+   std::vector<bitSet::block_type> result(numBlocks * wordsPerBlock);
+   for (size_t i = 0; i < numBlocks; ++i) {
+      const size_t first = i * dataBlocks / numBlocks * wordsPerBlock;
+      std::copy(words.begin() + first,
+                words.begin() + first + wordsPerBlock,
+                result.begin() + i * wordsPerBlock);
+   }
+   return fromBlocks(std::move(result), numBlocks * blockBits);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Select the training data of a model
+// The data itself if sampleSize is 0 or the data is not larger, otherwise a
+// sampleBlocks() sample of it, which is kept in sample
+///////////////////////////////////////////////////////////////////////////////
+const bitSet&
+BinaryUtils::selectSample(const bitSet& data, size_t sampleSize, size_t symbolSize, bitSet& sample)
+{
+   const size_t blockSize = 1 << 16; // bytes per sampled block
+   if (!sampleSize || data.size() <= sampleSize * 8) {
+      return data;
+   }
+
+   sample = sampleBlocks(data, sampleSize, blockSize, symbolSize);
+   return sample;
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -54,16 +139,10 @@ BinaryUtils::readBinary(const std::string& inputPath, size_t maxSize)
 void
 BinaryUtils::writeBinary(const std::string& outputPath, const bitSet& data)
 {
+   Tracer::Span span("write");
    std::ofstream out{ outputPath, std::ofstream::binary };
-   size_t length = data.size() % 8 ? data.size() + 8 - data.size() % 8 : data.size();
-   std::vector<char> buffer(length / 8);
-
-#pragma omp parallel for
-   for (size_t i = 0; i < length; i += 8)
-      for (int j = 0; j < 8 && i + j < data.size(); ++j)
-         buffer[size_t(i / 8)] += data[i + j] * pow(2, 7 - j);
-
-   out.write(&buffer[0], buffer.size());
+   auto buffer = toBytes(data);
+   out.write(reinterpret_cast<const char*>(buffer.data()), buffer.size());
 
    if (!out.good()) {
       throw std::runtime_error("An error occured during writing!");
@@ -157,11 +236,19 @@ BinaryUtils::findUnusedSymbol(const std::map<bitSet, bitSet>& encodingMap,
 
 ///////////////////////////////////////////////////////////////////////////////
 // Find unused symbol
+// The largest symbol that does not occur in the data
 ///////////////////////////////////////////////////////////////////////////////
 
 void
 BinaryUtils::findUnusedSymbol(const bitSet& data, bitSet& result, size_t symbolSize)
 {
+   if (SymbolStatistics::isSupported(data, symbolSize)) {
+      uint64_t symbol;
+      if (SymbolStatistics(data, symbolSize, false).findUnusedSymbol(symbol))
+         result = convertToBitSet(symbol, symbolSize);
+      return;
+   }
+
    boost::unordered_set<bitSet> symbols;
    int idx = 0;
    while (idx + symbolSize <= data.size()) {
@@ -171,11 +258,11 @@ BinaryUtils::findUnusedSymbol(const bitSet& data, bitSet& result, size_t symbolS
 
    idx = pow(2, symbolSize) - 1;
    bitSet current = BinaryUtils::convertToBitSet(idx, symbolSize);
-   while (idx >= 0 && std::find(symbols.begin(), symbols.end(), current) != symbols.end()) {
+   while (idx >= 0 && symbols.count(current)) {
       current = BinaryUtils::convertToBitSet(idx, symbolSize);
       --idx;
    }
-   if (std::find(symbols.begin(), symbols.end(), current) == symbols.end()) {
+   if (!symbols.count(current)) {
       result = bitSet(current);
    }
 }
@@ -190,6 +277,94 @@ BinaryUtils::hashValue(const bitSet& b)
    return boost::hash_value(b);
 }
 
+///////////////////////////////////////////////////////////////////////////////
+// getBlocks
+// Direct access to the underlying blocks (bit i is bit i % 64 of block i / 64)
+///////////////////////////////////////////////////////////////////////////////
+
+const std::vector<bitSet::block_type>&
+BinaryUtils::getBlocks(const bitSet& b)
+{
+   return b.m_bits;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// fromBlocks
+// Takes over the blocks without copying them
+///////////////////////////////////////////////////////////////////////////////
+
+bitSet
+BinaryUtils::fromBlocks(std::vector<bitSet::block_type>&& blocks, size_t numBits)
+{
+   blocks.resize((numBits + bitSet::bits_per_block - 1) / bitSet::bits_per_block);
+   if (numBits % bitSet::bits_per_block)
+      blocks.back() &= (bitSet::block_type(1) << (numBits % bitSet::bits_per_block)) - 1;
+
+   bitSet result;
+   result.m_bits = std::move(blocks);
+   result.m_num_bits = numBits;
+   return result;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// takeBlocks
+// Moves the blocks out of the bitSet, which is left empty
+///////////////////////////////////////////////////////////////////////////////
+
+std::vector<bitSet::block_type>
+BinaryUtils::takeBlocks(bitSet&& b)
+{
+   std::vector<bitSet::block_type> result = std::move(b.m_bits);
+   b.m_bits.clear();
+   b.m_num_bits = 0;
+   return result;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// reverseByte
+// Bit j of a byte in the blocks is bit 7 - j of the byte in file order
+///////////////////////////////////////////////////////////////////////////////
+
+static inline uint8_t
+reverseByte(uint8_t b)
+{
+   b = (b & 0xf0) >> 4 | (b & 0x0f) << 4;
+   b = (b & 0xcc) >> 2 | (b & 0x33) << 2;
+   return (b & 0xaa) >> 1 | (b & 0x55) << 1;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// toBytes
+// Convert to bytes in file order (the first bit is the MSB of the first byte)
+///////////////////////////////////////////////////////////////////////////////
+
+std::vector<uint8_t>
+BinaryUtils::toBytes(const bitSet& b)
+{
+   const auto& blocks = getBlocks(b);
+   const size_t bytesPerBlock = bitSet::bits_per_block / 8;
+   std::vector<uint8_t> result((b.size() + 7) / 8);
+   for (size_t i = 0; i < result.size(); ++i)
+      result[i] = reverseByte(uint8_t(blocks[i / bytesPerBlock] >> (i % bytesPerBlock * 8)));
+   return result;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// fromBytes
+// Inverse of toBytes, uses the same bit order as readBinary
+///////////////////////////////////////////////////////////////////////////////
+
+bitSet
+BinaryUtils::fromBytes(const std::vector<uint8_t>& bytes)
+{
+   const size_t bytesPerBlock = bitSet::bits_per_block / 8;
+   std::vector<bitSet::block_type> blocks((bytes.size() + bytesPerBlock - 1) / bytesPerBlock);
+   for (size_t i = 0; i < bytes.size(); ++i)
+      blocks[i / bytesPerBlock] |= bitSet::block_type(reverseByte(bytes[i]))
+                                   << (i % bytesPerBlock * 8);
+   return fromBlocks(std::move(blocks), bytes.size() * 8);
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 // Reverse bits
 ///////////////////////////////////////////////////////////////////////////////
@@ -215,12 +390,24 @@ BinaryUtils::copyReverseBits(const bitSet& b)
 
 ///////////////////////////////////////////////////////////////////////////////
 // append
+// Whole blocks shifted to the end of to, the unused bits of the blocks are 0
 ///////////////////////////////////////////////////////////////////////////////
 void
 BinaryUtils::append(bitSet& to, const bitSet& from)
 {
-   for (size_t i = 0; i < from.size(); ++i)
-      to.push_back(from[i]);
+   const size_t bitsPerBlock = bitSet::bits_per_block;
+   const size_t shift = to.m_num_bits % bitsPerBlock;
+   const size_t numBits = to.m_num_bits + from.m_num_bits;
+
+   size_t i = to.m_bits.size() - (shift ? 1 : 0);
+   to.m_bits.resize((numBits + bitsPerBlock - 1) / bitsPerBlock);
+   for (auto block : from.m_bits) {
+      to.m_bits[i] |= block << shift;
+      if (shift && i + 1 < to.m_bits.size())
+         to.m_bits[i + 1] |= block >> (bitsPerBlock - shift);
+      ++i;
+   }
+   to.m_num_bits = numBits;
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -246,12 +433,18 @@ BinaryUtils::assign(bitSet& to,
 bitSet
 BinaryUtils::slice(const bitSet& b, size_t startIdx, size_t numBits)
 {
-   bitSet result(numBits);
-
-   for (size_t i = startIdx; i < b.size() && i < startIdx + numBits; ++i) {
-      result[i - startIdx] = b[i];
+   // Bits past the end of b are 0
+   const size_t bitsPerBlock = bitSet::bits_per_block;
+   const size_t first = startIdx / bitsPerBlock;
+   const size_t shift = startIdx % bitsPerBlock;
+   std::vector<bitSet::block_type> blocks((numBits + bitsPerBlock - 1) / bitsPerBlock);
+
+   for (size_t i = 0; i < blocks.size() && first + i < b.m_bits.size(); ++i) {
+      blocks[i] = b.m_bits[first + i] >> shift;
+      if (shift && first + i + 1 < b.m_bits.size())
+         blocks[i] |= b.m_bits[first + i + 1] << (bitsPerBlock - shift);
    }
-   return result;
+   return fromBlocks(std::move(blocks), numBits);
 }
 
 ///////////////////////////////////////////////////////////////////////////////ű
@@ -0,0 +1,483 @@
+#define BOOST_DYNAMIC_BITSET_DONT_USE_FRIENDS
+
+#include "BlockContainer.hh"
+#include "BinaryUtils.hh"
+#include "EncoderChain.hh"
+#include "HuffmanTransducer.hh"
+#include "ThreadPool.hh"
+#include "Tracer.hh"
+
+#include <algorithm>
+#include <atomic>
+#include <fcntl.h>
+#include <fstream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace BinaryUtils;
+
+///////////////////////////////////////////////////////////////////////////////
+// Little endian fields of the index
+///////////////////////////////////////////////////////////////////////////////
+
+static void
+writeUint64(std::vector<uint8_t>& to, uint64_t value)
+{
+   for (size_t i = 0; i < 8; ++i)
+      to.push_back(uint8_t(value >> (8 * i)));
+}
+
+static uint64_t
+readUint64(const uint8_t* from)
+{
+   uint64_t value = 0;
+   for (size_t i = 0; i < 8; ++i)
+      value |= uint64_t(from[i]) << (8 * i);
+   return value;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// packBlock
+///////////////////////////////////////////////////////////////////////////////
+
+bitSet
+BlockContainer::packBlock(const bitSet& serializedChain, const bitSet& encoded)
+{
+   return serialize(std::vector<bitSet>{ serializedChain, encoded }, 4);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Symbol size flags
+///////////////////////////////////////////////////////////////////////////////
+
+uint64_t
+BlockContainer::getSymbolSizeFlag(size_t symbolSize)
+{
+   switch (symbolSize) {
+      case 8:
+         return SymbolSize8;
+      case 16:
+         return SymbolSize16;
+      default:
+         return 0;
+   }
+}
+
+size_t
+BlockContainer::getSymbolSize(uint64_t flags)
+{
+   switch (flags & SymbolSizeMask) {
+      case SymbolSize8:
+         return 8;
+      case SymbolSize16:
+         return 16;
+      default:
+         return 0;
+   }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Bytes of the blocks, converted in parallel
+///////////////////////////////////////////////////////////////////////////////
+
+static std::vector<std::vector<uint8_t>>
+getBlockBytes(const std::vector<BlockContainer::Block>& blocks)
+{
+   Tracer::Span span("merge");
+   std::vector<std::vector<uint8_t>> bytes(blocks.size());
+   ThreadPool::parallelFor(blocks.size(), [&](size_t i) { bytes[i] = toBytes(blocks[i].data); });
+   return bytes;
+}
+
+static std::vector<BlockContainer::IndexEntry>
+getIndexEntries(const std::vector<BlockContainer::Block>& blocks,
+                const std::vector<std::vector<uint8_t>>& bytes)
+{
+   std::vector<BlockContainer::IndexEntry> index;
+   uint64_t rawOffset = 0;
+   uint64_t compressedOffset = 0;
+   for (size_t i = 0; i < blocks.size(); ++i) {
+      index.push_back({ rawOffset, compressedOffset, bytes[i].size(), blocks[i].flags });
+      rawOffset += blocks[i].rawSize;
+      compressedOffset += bytes[i].size();
+   }
+   return index;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// write
+///////////////////////////////////////////////////////////////////////////////
+
+void
+BlockContainer::write(const std::string& path, const std::vector<Block>& blocks)
+{
+   auto bytes = getBlockBytes(blocks);
+   auto index = getIndexEntries(blocks, bytes);
+
+   Tracer::Span span("write");
+   std::ofstream out{ path, std::ofstream::binary };
+   uint64_t rawSize = 0;
+   for (size_t i = 0; i < blocks.size(); ++i) {
+      out.write(reinterpret_cast<const char*>(bytes[i].data()), bytes[i].size());
+      rawSize += blocks[i].rawSize;
+   }
+
+   auto tail = packIndex(index, rawSize);
+   out.write(reinterpret_cast<const char*>(tail.data()), tail.size());
+
+   if (!out.good()) {
+      throw std::runtime_error("An error occured during writing!");
+   }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// append
+// The new blocks start where the old index started, the file only grows: the
+// new index has more entries than the old one
+///////////////////////////////////////////////////////////////////////////////
+
+void
+BlockContainer::append(const std::string& path, const std::vector<Block>& blocks)
+{
+   if (access(path.c_str(), F_OK) != 0) {
+      write(path, blocks);
+      return;
+   }
+
+   std::vector<IndexEntry> index;
+   uint64_t rawSize = 0;
+   uint64_t dataSize = 0;
+   {
+      BlockContainer c(path);
+      index = c.getIndex();
+      rawSize = c.getRawSize();
+      dataSize = c.getDataSize();
+   }
+
+   auto bytes = getBlockBytes(blocks);
+   Tracer::Span span("write");
+   std::fstream out{ path, std::fstream::in | std::fstream::out | std::fstream::binary };
+   out.seekp(dataSize);
+   for (size_t i = 0; i < blocks.size(); ++i) {
+      out.write(reinterpret_cast<const char*>(bytes[i].data()), bytes[i].size());
+      index.push_back({ rawSize, dataSize, bytes[i].size(), blocks[i].flags });
+      rawSize += blocks[i].rawSize;
+      dataSize += bytes[i].size();
+   }
+
+   auto tail = packIndex(index, rawSize);
+   out.write(reinterpret_cast<const char*>(tail.data()), tail.size());
+
+   if (!out.good()) {
+      throw std::runtime_error("An error occured during writing!");
+   }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// pack
+///////////////////////////////////////////////////////////////////////////////
+
+std::vector<uint8_t>
+BlockContainer::pack(const std::vector<Block>& blocks)
+{
+   auto bytes = getBlockBytes(blocks);
+   auto index = getIndexEntries(blocks, bytes);
+
+   std::vector<uint8_t> result;
+   uint64_t rawSize = 0;
+   for (size_t i = 0; i < blocks.size(); ++i) {
+      result.insert(result.end(), bytes[i].begin(), bytes[i].end());
+      rawSize += blocks[i].rawSize;
+   }
+
+   auto tail = packIndex(index, rawSize);
+   result.insert(result.end(), tail.begin(), tail.end());
+   return result;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// packIndex
+///////////////////////////////////////////////////////////////////////////////
+
+std::vector<uint8_t>
+BlockContainer::packIndex(const std::vector<IndexEntry>& index, uint64_t rawSize)
+{
+   std::vector<uint8_t> result;
+   for (const auto& e : index) {
+      writeUint64(result, e.rawOffset);
+      writeUint64(result, e.compressedOffset);
+      writeUint64(result, e.length);
+      writeUint64(result, e.flags);
+   }
+
+   writeUint64(result, rawSize);
+   writeUint64(result, index.size());
+   writeUint64(result, mVersion);
+   writeUint64(result, mMagic);
+   return result;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// isContainer
+///////////////////////////////////////////////////////////////////////////////
+
+bool
+BlockContainer::isContainer(const std::string& path)
+{
+   int file = open(path.c_str(), O_RDONLY);
+   if (file < 0)
+      return false;
+
+   struct stat info;
+   uint8_t magic[8];
+   bool result = fstat(file, &info) == 0 && info.st_size >= 8 &&
+                 pread(file, magic, 8, info.st_size - 8) == 8 &&
+                 (readUint64(magic) == mMagic || readUint64(magic) == mMagicV1);
+
+   close(file);
+   return result;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// BlockContainer
+// Reads the footer and the index only
+///////////////////////////////////////////////////////////////////////////////
+
+BlockContainer::BlockContainer(const std::string& path)
+  : mFile(open(path.c_str(), O_RDONLY))
+  , mFileSize(0)
+  , mRawSize(0)
+{
+   if (mFile < 0) {
+      throw std::runtime_error("Cannot open " + path);
+   }
+
+   try {
+      struct stat info;
+      if (fstat(mFile, &info) != 0) {
+         throw std::runtime_error("Cannot deserialize!");
+      }
+      mFileSize = info.st_size;
+
+      mReader = [file = mFile](uint8_t* buffer, size_t size, uint64_t offset) {
+         while (size) {
+            ssize_t n = pread(file, buffer, size, offset);
+            if (n <= 0) {
+               throw std::runtime_error("An error occured during reading!");
+            }
+            buffer += n;
+            size -= n;
+            offset += n;
+         }
+      };
+      readIndex();
+   } catch (...) {
+      close(mFile);
+      throw;
+   }
+}
+
+BlockContainer::BlockContainer(const uint8_t* data, size_t size)
+  : mFile(-1)
+  , mFileSize(size)
+  , mRawSize(0)
+{
+   mReader = [data, size](uint8_t* buffer, size_t length, uint64_t offset) {
+      if (offset > size || length > size - offset) {
+         throw std::runtime_error("An error occured during reading!");
+      }
+      std::copy(data + offset, data + offset + length, buffer);
+   };
+   readIndex();
+}
+
+BlockContainer::BlockContainer(Reader reader, uint64_t size)
+  : mFile(-1)
+  , mReader(std::move(reader))
+  , mFileSize(size)
+  , mRawSize(0)
+{
+   readIndex();
+}
+
+BlockContainer::~BlockContainer()
+{
+   if (mFile >= 0)
+      close(mFile);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// readIndex
+///////////////////////////////////////////////////////////////////////////////
+
+void
+BlockContainer::readIndex()
+{
+   uint8_t magic[8];
+   if (mFileSize >= 8) {
+      readAt(magic, 8, mFileSize - 8);
+      if (readUint64(magic) == mMagicV1) {
+         throw std::runtime_error("Unsupported container version 1, encode the data again!");
+      }
+   }
+   if (mFileSize < mFooterSize) {
+      throw std::runtime_error("Cannot deserialize!");
+   }
+
+   uint8_t footer[mFooterSize];
+   readAt(footer, mFooterSize, mFileSize - mFooterSize);
+   mRawSize = readUint64(footer);
+   uint64_t numBlocks = readUint64(footer + 8);
+   uint64_t version = readUint64(footer + 16);
+   if (readUint64(footer + 24) != mMagic) {
+      throw std::runtime_error("Cannot deserialize!");
+   }
+   if (version != mVersion) {
+      throw std::runtime_error("Unsupported container version " + std::to_string(version) + "!");
+   }
+   if (numBlocks > (mFileSize - mFooterSize) / mEntrySize) {
+      throw std::runtime_error("Cannot deserialize!");
+   }
+
+   const uint64_t indexOffset = mFileSize - mFooterSize - numBlocks * mEntrySize;
+   std::vector<uint8_t> index(numBlocks * mEntrySize);
+   readAt(index.data(), index.size(), indexOffset);
+
+   for (size_t i = 0; i < numBlocks; ++i) {
+      const uint8_t* entry = index.data() + i * mEntrySize;
+      mIndex.push_back(IndexEntry{
+        readUint64(entry), readUint64(entry + 8), readUint64(entry + 16), readUint64(entry + 24) });
+
+      const auto& e = mIndex.back();
+      if (e.rawOffset > mRawSize || (i && e.rawOffset < mIndex[i - 1].rawOffset) ||
+          e.compressedOffset > indexOffset || e.length > indexOffset - e.compressedOffset) {
+         throw std::runtime_error("Cannot deserialize!");
+      }
+   }
+
+   // Stored blocks hold exactly their raw bytes, at most one symbol size is recorded
+   for (size_t i = 0; i < numBlocks; ++i) {
+      const uint64_t rawEnd = i + 1 < numBlocks ? mIndex[i + 1].rawOffset : mRawSize;
+      const uint64_t flags = mIndex[i].flags;
+      if (((flags & Stored) && mIndex[i].length != rawEnd - mIndex[i].rawOffset) ||
+          (flags & SymbolSizeMask) == SymbolSizeMask) {
+         throw std::runtime_error("Cannot deserialize!");
+      }
+   }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// readAt
+///////////////////////////////////////////////////////////////////////////////
+
+void
+BlockContainer::readAt(uint8_t* buffer, size_t size, uint64_t offset) const
+{
+   Tracer::Span span("read");
+   mReader(buffer, size, offset);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// decodeBlock
+///////////////////////////////////////////////////////////////////////////////
+
+bitSet
+BlockContainer::decodeBlock(size_t i) const
+{
+   Tracer::Span span("block");
+   const auto& e = mIndex.at(i);
+   const uint64_t rawEnd = i + 1 < mIndex.size() ? mIndex[i + 1].rawOffset : mRawSize;
+
+   std::vector<uint8_t> bytes(e.length);
+   readAt(bytes.data(), bytes.size(), e.compressedOffset);
+   if (e.flags & Stored) {
+      return fromBytes(bytes);
+   }
+
+   auto serialized = deserialize(fromBytes(bytes), 4);
+   if (serialized.size() != 2) {
+      throw std::runtime_error("Cannot deserialize!");
+   }
+
+   auto d = std::unique_ptr<EncoderChain>(EncoderChain::deserializerFactory(serialized[0]));
+   if (!d || !d->isValid()) {
+      throw std::runtime_error("Could not create the deserializer.");
+   }
+
+   // The entropy coder works on the recorded symbol size
+   if (const size_t symbolSize = getSymbolSize(e.flags)) {
+      for (size_t j = 0; j < d->getNumEncoders(); ++j) {
+         auto* h = dynamic_cast<HuffmanTransducer*>(&d->getEncoder(j));
+         if (h && h->getSymbolSize() != symbolSize) {
+            throw std::runtime_error("The chain does not match the symbol size of the block.");
+         }
+      }
+   }
+
+   auto decoded = d->decode(std::move(serialized[1]));
+   if (decoded.size() != (rawEnd - e.rawOffset) * 8) {
+      throw std::runtime_error("Could not decode the block.");
+   }
+   return decoded;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// decodeRange
+// The covering blocks are decoded in parallel and cut to the range, the
+// covered part of stored blocks is read into the range without a copy
+///////////////////////////////////////////////////////////////////////////////
+
+bitSet
+BlockContainer::decodeRange(uint64_t start, uint64_t length) const
+{
+   if (start > mRawSize || length > mRawSize - start) {
+      throw std::out_of_range("The range is outside of the data!");
+   }
+   if (!length) {
+      return bitSet();
+   }
+
+   auto findBlock = [&](uint64_t offset) -> size_t {
+      auto it = std::upper_bound(
+        mIndex.begin(), mIndex.end(), offset, [](uint64_t o, const IndexEntry& e) {
+           return o < e.rawOffset;
+        });
+      return it - mIndex.begin() - 1;
+   };
+   const size_t first = findBlock(start);
+   const size_t last = findBlock(start + length - 1);
+
+   std::vector<uint8_t> result(length);
+   std::atomic<bool> failed{ false };
+
+   ThreadPool::parallelFor(last - first + 1, [&](size_t n) {
+      const size_t i = first + n;
+      try {
+         const auto& e = mIndex[i];
+         const uint64_t rawEnd = i + 1 < mIndex.size() ? mIndex[i + 1].rawOffset : mRawSize;
+         const uint64_t from = std::max(start, e.rawOffset);
+         const uint64_t to = std::min(start + length, rawEnd);
+
+         if (e.flags & Stored) {
+            readAt(&result[from - start], to - from, e.compressedOffset + (from - e.rawOffset));
+         } else {
+            auto bytes = toBytes(decodeBlock(i));
+            std::copy(bytes.begin() + (from - e.rawOffset),
+                      bytes.begin() + (to - e.rawOffset),
+                      result.begin() + (from - start));
+         }
+      } catch (std::exception& E) {
+         failed = true;
+      }
+   });
+
+   if (failed) {
+      throw std::runtime_error("Could not decode the blocks of the range.");
+   }
+
+   Tracer::Span span("merge");
+   return fromBytes(result);
+}
@@ -0,0 +1,275 @@
+#include "CompressionLevel.hh"
+#include "EncoderFactory.hh"
+#include "Padder.hh"
+#include "SymbolStatistics.hh"
+#include "ThreadPool.hh"
+#include "Tracer.hh"
+
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+#include <string>
+
+using namespace BinaryUtils;
+
+///////////////////////////////////////////////////////////////////////////////
+// get
+///////////////////////////////////////////////////////////////////////////////
+
+CompressionLevel
+CompressionLevel::get(int level)
+{
+   //                            symbol markov threshold sample     block
+   static const CompressionLevel levels[] = { { 1, 8, false, 0.4, 64 << 10, 4 << 20 },
+                                              { 2, 8, false, 0.4, 256 << 10, 4 << 20 },
+                                              { 3, 8, false, 0.4, 0, 2 << 20 },
+                                              { 4, 16, true, 0.4, 64 << 10, 2 << 20 },
+                                              { 5, 16, true, 0.4, 256 << 10, 1 << 20 },
+                                              { 6, 16, true, 0.4, 0, 1 << 20 },
+                                              { 7, 16, true, 0.3, 0, 1 << 20 },
+                                              { 8, 16, true, 0.2, 0, 1 << 20 },
+                                              { 9, 16, true, 0.1, 0, 1 << 20 } };
+
+   if (level < Min || level > Max) {
+      throw std::out_of_range("The compression level must be between " + std::to_string(Min) +
+                              " and " + std::to_string(Max) + "!");
+   }
+   return levels[level - Min];
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// createChain
+///////////////////////////////////////////////////////////////////////////////
+
+std::unique_ptr<EncoderChain>
+CompressionLevel::createChain(size_t numHuffmanThreads) const
+{
+   auto c = std::make_unique<EncoderChain>();
+   c->addEncoder(std::make_unique<Padder>(symbolSize == 16 ? Padder::PaddingType::EvenBytes
+                                                           : Padder::PaddingType::WholeBytes));
+   if (markov) {
+      auto m = EncoderFactory::createMarkovEncoder(symbolSize, threshold);
+      m->setTrainingSampleSize(trainingSampleSize);
+      c->addEncoder(std::move(m));
+   }
+
+   auto h = EncoderFactory::createHuffmanTransducer(symbolSize, numHuffmanThreads);
+   h->setTrainingSampleSize(trainingSampleSize);
+   c->addEncoder(std::move(h));
+   return c;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// estimateSize
+// The models are built as by the chain (on the sample of the level), but
+// nothing is encoded: a trained MarkovEncoder knows the histogram of its
+// output and the Huffman codes follow from the histogram. Data whose order-0
+// entropy plus one symbol per table entry does not shrink gets no models.
+// Without Markov the histogram of the whole data gives the exact Huffman
+// payload. The Markov output outside of a sample is unknown, the share of its
+// escaped symbols is the Good-Turing estimate, the share of the symbols seen
+// once in the sample. Infinite if the chain cannot encode the data.
+///////////////////////////////////////////////////////////////////////////////
+
+double
+CompressionLevel::estimateSize(const bitSet& data,
+                               std::unique_ptr<EncoderChain>* chain,
+                               size_t numHuffmanThreads) const
+{
+   const double failed = std::numeric_limits<double>::infinity();
+
+   // The models see the data as padded by the chain
+   auto padder = std::make_unique<Padder>(symbolSize == 16 ? Padder::PaddingType::EvenBytes
+                                                           : Padder::PaddingType::WholeBytes);
+   bitSet padded;
+   const bitSet* input = &data;
+   if (!SymbolStatistics::isSupported(data, symbolSize)) {
+      padded = padder->encode(data);
+      input = &padded;
+   }
+   const size_t numSymbols = input->size() / symbolSize;
+   if (!numSymbols)
+      return failed;
+
+   SymbolStatistics dataStatistics(*input, symbolSize, false);
+   const auto counts = dataStatistics.getCounts();
+   if (dataStatistics.getEntropy() * numSymbols + counts.size() * symbolSize >= data.size())
+      return failed;
+
+   bitSet sample;
+   const bitSet& trainingData = selectSample(*input, trainingSampleSize, symbolSize, sample);
+   const bool sampled = &trainingData != input;
+   std::unique_ptr<SymbolStatistics> sampleStatistics;
+   if (sampled)
+      sampleStatistics = std::make_unique<SymbolStatistics>(trainingData, symbolSize, false);
+   const SymbolStatistics& statistics = sampled ? *sampleStatistics : dataStatistics;
+
+   // The MarkovEncoder needs an unused symbol for its predictions, data that
+   // uses every symbol is estimated without it
+   std::unique_ptr<MarkovEncoder> m;
+   if (markov) {
+      m = EncoderFactory::createMarkovEncoder(symbolSize, threshold);
+      m->setTrainingSampleSize(trainingSampleSize);
+      m->setup(*input);
+      if (!m->isValid())
+         m.reset();
+   }
+
+   double size = 0;
+   auto h = EncoderFactory::createHuffmanTransducer(symbolSize, numHuffmanThreads);
+   h->setTrainingSampleSize(sampled ? trainingSampleSize : 0);
+   if (m) {
+      h->setupByStatistics(m->getEncodedStatistics());
+      size += m->serialize().size();
+   } else {
+      h->setupByStatistics(statistics.getProbabilities());
+   }
+   if (!h->isValid())
+      return failed;
+   size += h->serialize().size();
+
+   // An escaped symbol costs about the longest code plus the symbol
+   boost::unordered_map<uint64_t, size_t> codeSizes;
+   size_t escapeSize = 0;
+   for (const auto& c : h->getEncodingMap()) {
+      codeSizes[c.first.to_ulong()] = c.second.size();
+      escapeSize = std::max(escapeSize, c.second.size() + symbolSize);
+   }
+
+   if (!m) {
+      for (const auto& c : counts) {
+         auto it = codeSizes.find(c.first);
+         size += double(c.second) * (it != codeSizes.end() ? it->second : escapeSize);
+      }
+   } else {
+      double unseen = 0;
+      if (sampled) {
+         size_t singletons = 0;
+         for (const auto& c : statistics.getCounts())
+            singletons += c.second == 1;
+         unseen = double(singletons) / statistics.getNumSymbols();
+      }
+      size += numSymbols * ((1 - unseen) * h->getAvgCodeLength() + unseen * escapeSize);
+   }
+
+   // The trained models encode the data without another training
+   if (chain) {
+      *chain = std::make_unique<EncoderChain>();
+      (*chain)->addEncoder(std::move(padder));
+      if (m)
+         (*chain)->addEncoder(std::move(m));
+      (*chain)->addEncoder(std::move(h));
+   }
+   return size;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// selectSymbolSize
+// Ties keep the symbol size of the level
+///////////////////////////////////////////////////////////////////////////////
+
+CompressionLevel
+CompressionLevel::selectSymbolSize(const bitSet& data,
+                                   double& estimatedSize,
+                                   std::unique_ptr<EncoderChain>* chain,
+                                   size_t numHuffmanThreads) const
+{
+   const size_t symbolSizes[] = { 8, 16 };
+   CompressionLevel candidates[] = { *this, *this };
+   std::unique_ptr<EncoderChain> chains[2];
+   double sizes[] = { 0, 0 };
+
+   ThreadPool::parallelFor(2, [&](size_t i) {
+      candidates[i].symbolSize = symbolSizes[i];
+      try {
+         sizes[i] = candidates[i].estimateSize(data, &chains[i], numHuffmanThreads);
+      } catch (std::exception& E) {
+         sizes[i] = std::numeric_limits<double>::infinity();
+      }
+
+      // Padder, Markov and Huffman, unless the estimate left out Markov
+      if (chains[i])
+         candidates[i].markov = chains[i]->getNumEncoders() == 3;
+   });
+
+   size_t selected = sizes[0] < sizes[1] ? 0 : 1;
+   if (sizes[0] == sizes[1])
+      selected = symbolSize == symbolSizes[0] ? 0 : 1;
+
+   estimatedSize = sizes[selected];
+   if (chain)
+      *chain = std::move(chains[selected]);
+   return candidates[selected];
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// getBlockSize
+// Even, so that 16 bit symbols never straddle two blocks
+///////////////////////////////////////////////////////////////////////////////
+
+size_t
+CompressionLevel::getBlockSize(size_t numBytes) const
+{
+   size_t result = std::max<size_t>(MinBlockSize, (numBytes + MinBlocks - 1) / MinBlocks);
+   result = std::min<size_t>(blockSize, result);
+   return result + result % 2;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// encodeBlock
+// Blocks estimated not to shrink with either symbol size are stored without
+// running the encoder chain, the others are encoded by the chain of the
+// estimate with the models it trained
+///////////////////////////////////////////////////////////////////////////////
+
+BlockContainer::Block
+CompressionLevel::encodeBlock(bitSet raw, size_t numHuffmanThreads) const
+{
+   Tracer::Span span("block");
+   BlockContainer::Block block{ bitSet(), raw.size() / 8, 0 };
+
+   double estimatedSize = 0;
+   std::unique_ptr<EncoderChain> c;
+   auto blockLevel = [&]() {
+      Tracer::Span analyzeSpan("analyze");
+      return selectSymbolSize(raw, estimatedSize, &c, numHuffmanThreads);
+   }();
+
+   if (c && estimatedSize < raw.size()) {
+      try {
+         auto encoded = c->encode(raw);
+         Tracer::Span serializeSpan("serialize");
+         block.data = BlockContainer::packBlock(c->serialize(), encoded);
+         block.flags = BlockContainer::getSymbolSizeFlag(blockLevel.symbolSize);
+      } catch (std::exception& E) {
+         block.data.clear();
+      }
+   }
+
+   // Blocks that were not encoded or did not shrink
+   if (block.data.empty() || block.data.size() >= raw.size()) {
+      block.data = std::move(raw);
+      block.flags = BlockContainer::Stored;
+   }
+   return block;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// encodeBlocks
+///////////////////////////////////////////////////////////////////////////////
+
+std::vector<BlockContainer::Block>
+CompressionLevel::encodeBlocks(const bitSet& data,
+                               size_t blockSize,
+                               size_t numHuffmanThreads) const
+{
+   const size_t numBytes = data.size() / 8;
+   const size_t numBlocks = blockSize ? (numBytes + blockSize - 1) / blockSize : 0;
+   std::vector<BlockContainer::Block> blocks(numBlocks);
+
+   ThreadPool::parallelFor(numBlocks, [&](size_t i) {
+      const size_t rawSize = std::min(blockSize, numBytes - i * blockSize);
+      blocks[i] = encodeBlock(slice(data, i * blockSize * 8, rawSize * 8), numHuffmanThreads);
+   });
+   return blocks;
+}
@@ -0,0 +1,652 @@
+#define BOOST_DYNAMIC_BITSET_DONT_USE_FRIENDS
+
+#include "CompressionMethods.h"
+#include "BinaryUtils.hh"
+#include "BlockContainer.hh"
+#include "CompressionLevel.hh"
+#include "EncoderChain.hh"
+#include "ThreadPool.hh"
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <new>
+#include <stdexcept>
+
+using namespace BinaryUtils;
+
+///////////////////////////////////////////////////////////////////////////////
+// Opaque types of the C API
+///////////////////////////////////////////////////////////////////////////////
+
+struct cm_model
+{
+   CompressionLevel level; // encodes the blocks the chain cannot
+   bitSet chain;           // serialized, every block deserializes its own copy
+};
+
+struct cm_cctx
+{
+   CompressionLevel level;
+   const cm_model* model;
+   cm_write_fn write;
+   void* opaque;
+   std::vector<uint8_t> pending; // less than a batch of blocks
+   std::vector<BlockContainer::IndexEntry> index;
+   uint64_t rawSize;
+   uint64_t compressedSize;
+   bool failed; // a write callback failed, the container is lost
+};
+
+struct cm_dctx
+{
+   std::unique_ptr<BlockContainer> container;
+   std::shared_ptr<std::atomic<bool>> readFailed;
+   uint64_t position;
+   size_t cachedBlock; // SIZE_MAX if none
+   std::vector<uint8_t> cached;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// guarded
+// No exception leaves the API: allocation failures are CM_OUT_OF_MEMORY, the
+// runtime errors of the library onError
+///////////////////////////////////////////////////////////////////////////////
+
+template<typename F>
+static cm_status
+guarded(cm_status onError, F&& f)
+{
+   try {
+      return f();
+   } catch (std::bad_alloc&) {
+      return CM_OUT_OF_MEMORY;
+   } catch (std::runtime_error&) {
+      return onError;
+   } catch (...) {
+      return CM_INTERNAL_ERROR;
+   }
+}
+
+static bool
+getLevel(int level, CompressionLevel& result)
+{
+   if (level == CM_DEFAULT_LEVEL)
+      level = CompressionLevel::Default;
+   if (level < CompressionLevel::Min || level > CompressionLevel::Max)
+      return false;
+   result = CompressionLevel::get(level);
+   return true;
+}
+
+static bitSet
+toBitSet(const void* data, size_t size)
+{
+   const uint8_t* bytes = static_cast<const uint8_t*>(data);
+   return fromBytes(std::vector<uint8_t>(bytes, bytes + size));
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// encodeWithModel
+// The chain is not retrained. Its Huffman codes escape the unseen symbols,
+// but a symbol the Markov predictions reserved may occur in the block: the
+// block is decoded once and encoded with its own chain if it does not match,
+// or if the tables of the model do not fit into the block.
+///////////////////////////////////////////////////////////////////////////////
+
+static BlockContainer::Block
+encodeWithModel(const cm_model& model, bitSet raw)
+{
+   try {
+      auto c = std::unique_ptr<EncoderChain>(EncoderChain::encoderFactory(model.chain));
+      auto encoded = c->encode(raw);
+      auto serializedChain = c->serialize();
+
+      auto packed = BlockContainer::packBlock(serializedChain, encoded);
+      auto d = std::unique_ptr<EncoderChain>(EncoderChain::deserializerFactory(serializedChain));
+      if (packed.size() < raw.size() && d->decode(encoded) == raw) {
+         return BlockContainer::Block{ std::move(packed),
+                                       raw.size() / 8,
+                                       BlockContainer::getSymbolSizeFlag(model.level.symbolSize) };
+      }
+   } catch (std::runtime_error& E) {
+      // Encoded with its own chain below
+   }
+   return model.level.encodeBlock(std::move(raw));
+}
+
+static std::vector<BlockContainer::Block>
+encodeBlocks(const CompressionLevel& level,
+             const cm_model* model,
+             const bitSet& data,
+             size_t blockSize)
+{
+   if (!model)
+      return level.encodeBlocks(data, blockSize);
+
+   const size_t numBytes = data.size() / 8;
+   const size_t numBlocks = blockSize ? (numBytes + blockSize - 1) / blockSize : 0;
+   std::vector<BlockContainer::Block> blocks(numBlocks);
+   std::atomic<bool> failed{ false };
+
+   ThreadPool::parallelFor(numBlocks, [&](size_t i) {
+      try {
+         const size_t rawSize = std::min(blockSize, numBytes - i * blockSize);
+         blocks[i] = encodeWithModel(*model, slice(data, i * blockSize * 8, rawSize * 8));
+      } catch (std::exception& E) {
+         failed = true;
+      }
+   });
+
+   if (failed) {
+      throw std::runtime_error("Could not encode the blocks.");
+   }
+   return blocks;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Copies a container into the buffer of the caller
+///////////////////////////////////////////////////////////////////////////////
+
+static cm_status
+copyOut(const std::vector<uint8_t>& bytes, void* dst, size_t dstCapacity, size_t* dstSize)
+{
+   *dstSize = bytes.size();
+   if (bytes.size() > dstCapacity)
+      return CM_BUFFER_TOO_SMALL;
+   std::copy(bytes.begin(), bytes.end(), static_cast<uint8_t*>(dst));
+   return CM_OK;
+}
+
+static cm_status
+compress(const CompressionLevel& level,
+         const cm_model* model,
+         const void* src,
+         size_t srcSize,
+         void* dst,
+         size_t dstCapacity,
+         size_t* dstSize)
+{
+   if ((!src && srcSize) || (!dst && dstCapacity) || !dstSize)
+      return CM_INVALID_ARGUMENT;
+
+   return guarded(CM_INTERNAL_ERROR, [&]() {
+      auto blocks = encodeBlocks(level, model, toBitSet(src, srcSize), level.getBlockSize(srcSize));
+      return copyOut(BlockContainer::pack(blocks), dst, dstCapacity, dstSize);
+   });
+}
+
+extern "C" {
+
+///////////////////////////////////////////////////////////////////////////////
+// Version and status
+///////////////////////////////////////////////////////////////////////////////
+
+unsigned
+cm_version(void)
+{
+   return (CM_VERSION_MAJOR << 16) | CM_VERSION_MINOR;
+}
+
+const char*
+cm_status_string(cm_status status)
+{
+   switch (status) {
+      case CM_OK:
+         return "ok";
+      case CM_INVALID_ARGUMENT:
+         return "invalid argument";
+      case CM_BUFFER_TOO_SMALL:
+         return "buffer too small";
+      case CM_CORRUPT_DATA:
+         return "corrupt data";
+      case CM_OUT_OF_MEMORY:
+         return "out of memory";
+      case CM_IO_ERROR:
+         return "I/O error";
+      case CM_INTERNAL_ERROR:
+         return "internal error";
+   }
+   return "unknown status";
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Threads
+// A task of the pool becomes a heap allocated std::function the executor
+// gets as argument, taskRunner runs and frees it
+///////////////////////////////////////////////////////////////////////////////
+
+static void
+taskRunner(void* argument)
+{
+   std::unique_ptr<std::function<void()>> task(static_cast<std::function<void()>*>(argument));
+   (*task)();
+}
+
+cm_status
+cm_set_threads(size_t numThreads, const int* cpus, size_t numCpus)
+{
+   if (!cpus && numCpus)
+      return CM_INVALID_ARGUMENT;
+
+   return guarded(CM_INVALID_ARGUMENT, [&]() {
+      ThreadPool::setExecutor(nullptr, numThreads);
+      ThreadPool::configure(numThreads, std::vector<int>(cpus, cpus + numCpus));
+      return CM_OK;
+   });
+}
+
+cm_status
+cm_set_executor(cm_executor_fn executor, void* opaque, size_t numThreads)
+{
+   return guarded(CM_INTERNAL_ERROR, [&]() {
+      if (!executor) {
+         ThreadPool::setExecutor(nullptr, numThreads);
+         return CM_OK;
+      }
+
+      ThreadPool::setExecutor(
+        [executor, opaque](std::function<void()> task) {
+           auto argument = std::make_unique<std::function<void()>>(std::move(task));
+           executor(opaque, taskRunner, argument.get());
+           argument.release();
+        },
+        numThreads);
+      return CM_OK;
+   });
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// cm_compress_bound
+// Blocks that do not shrink are stored, the container adds its index. No
+// level has blocks below 1 MiB, unless the data is split into MinBlocks.
+///////////////////////////////////////////////////////////////////////////////
+
+size_t
+cm_compress_bound(size_t srcSize)
+{
+   const size_t maxBlocks = srcSize / (1 << 20) + CompressionLevel::MinBlocks + 1;
+   return srcSize + maxBlocks * 4 * 8 + 3 * 8;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Buffer to buffer
+///////////////////////////////////////////////////////////////////////////////
+
+cm_status
+cm_compress(const void* src,
+            size_t srcSize,
+            void* dst,
+            size_t dstCapacity,
+            size_t* dstSize,
+            int level)
+{
+   CompressionLevel l;
+   if (!getLevel(level, l))
+      return CM_INVALID_ARGUMENT;
+   return compress(l, nullptr, src, srcSize, dst, dstCapacity, dstSize);
+}
+
+cm_status
+cm_decompressed_size(const void* src, size_t srcSize, uint64_t* size)
+{
+   if (!src || !size)
+      return CM_INVALID_ARGUMENT;
+
+   return guarded(CM_CORRUPT_DATA, [&]() {
+      BlockContainer c(static_cast<const uint8_t*>(src), srcSize);
+      *size = c.getRawSize();
+      return CM_OK;
+   });
+}
+
+cm_status
+cm_decompress(const void* src, size_t srcSize, void* dst, size_t dstCapacity, size_t* dstSize)
+{
+   if (!src || (!dst && dstCapacity) || !dstSize)
+      return CM_INVALID_ARGUMENT;
+
+   return guarded(CM_CORRUPT_DATA, [&]() {
+      BlockContainer c(static_cast<const uint8_t*>(src), srcSize);
+      *dstSize = c.getRawSize();
+      if (c.getRawSize() > dstCapacity)
+         return CM_BUFFER_TOO_SMALL;
+      return copyOut(toBytes(c.decodeRange(0, c.getRawSize())), dst, dstCapacity, dstSize);
+   });
+}
+
+cm_status
+cm_decompress_range(const void* src, size_t srcSize, uint64_t offset, size_t length, void* dst)
+{
+   if (!src || (!dst && length))
+      return CM_INVALID_ARGUMENT;
+
+   return guarded(CM_CORRUPT_DATA, [&]() {
+      BlockContainer c(static_cast<const uint8_t*>(src), srcSize);
+      if (offset > c.getRawSize() || length > c.getRawSize() - offset)
+         return CM_INVALID_ARGUMENT;
+      auto bytes = toBytes(c.decodeRange(offset, length));
+      std::copy(bytes.begin(), bytes.end(), static_cast<uint8_t*>(dst));
+      return CM_OK;
+   });
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Models
+// The chain is trained as a block of the level, but with the escape code of
+// a sample, so that the Huffman codes cover the symbols the sample lacks
+///////////////////////////////////////////////////////////////////////////////
+
+cm_status
+cm_model_train(const void* sample, size_t size, int level, cm_model** model)
+{
+   CompressionLevel l;
+   if (!sample || !size || !model || !getLevel(level, l))
+      return CM_INVALID_ARGUMENT;
+
+   return guarded(CM_INTERNAL_ERROR, [&]() {
+      auto result = std::make_unique<cm_model>();
+      result->level = l;
+      if (!l.trainingSampleSize)
+         l.trainingSampleSize = size;
+
+      auto c = l.createChain();
+      c->encode(toBitSet(sample, size));
+      result->chain = c->serialize();
+      *model = result.release();
+      return CM_OK;
+   });
+}
+
+// serialize({ chain, level }, 4) in whole bytes
+cm_status
+cm_model_load(const void* data, size_t size, cm_model** model)
+{
+   if (!data || !model)
+      return CM_INVALID_ARGUMENT;
+
+   return guarded(CM_CORRUPT_DATA, [&]() {
+      auto serialized = deserialize(toBitSet(data, size), 4);
+      if (serialized.size() != 2 || serialized[1].size() != 8) {
+         throw std::runtime_error("Cannot deserialize!");
+      }
+
+      auto result = std::make_unique<cm_model>();
+      if (!getLevel(serialized[1].to_ulong(), result->level)) {
+         throw std::runtime_error("Cannot deserialize!");
+      }
+
+      auto c = std::unique_ptr<EncoderChain>(EncoderChain::encoderFactory(serialized[0]));
+      if (!c->getNumEncoders() || !c->isValid()) {
+         throw std::runtime_error("Cannot deserialize!");
+      }
+      result->chain = std::move(serialized[0]);
+      *model = result.release();
+      return CM_OK;
+   });
+}
+
+cm_status
+cm_model_save(const cm_model* model, void* dst, size_t dstCapacity, size_t* size)
+{
+   if (!model || !size)
+      return CM_INVALID_ARGUMENT;
+
+   return guarded(CM_INTERNAL_ERROR, [&]() {
+      auto bytes = toBytes(serialize(
+        std::vector<bitSet>{ model->chain, convertToBitSet(model->level.level, 8) }, 4));
+      if (!dst) {
+         *size = bytes.size();
+         return CM_OK;
+      }
+      return copyOut(bytes, dst, dstCapacity, size);
+   });
+}
+
+void
+cm_model_free(cm_model* model)
+{
+   delete model;
+}
+
+cm_status
+cm_compress_with_model(const cm_model* model,
+                       const void* src,
+                       size_t srcSize,
+                       void* dst,
+                       size_t dstCapacity,
+                       size_t* dstSize)
+{
+   if (!model)
+      return CM_INVALID_ARGUMENT;
+   return compress(model->level, model, src, srcSize, dst, dstCapacity, dstSize);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Compression context
+// The data is encoded in batches of one block per thread, the index entries
+// are kept until cm_cctx_end writes them behind the last block
+///////////////////////////////////////////////////////////////////////////////
+
+static void
+resetContext(cm_cctx* cctx)
+{
+   cctx->pending.clear();
+   cctx->index.clear();
+   cctx->rawSize = 0;
+   cctx->compressedSize = 0;
+   cctx->failed = false;
+}
+
+static cm_status
+writeOut(cm_cctx* cctx, const std::vector<uint8_t>& bytes)
+{
+   if (cctx->write(cctx->opaque, bytes.data(), bytes.size()) != 0) {
+      cctx->failed = true;
+      return CM_IO_ERROR;
+   }
+   return CM_OK;
+}
+
+// Encodes and writes the first numBytes pending bytes
+static cm_status
+flush(cm_cctx* cctx, size_t numBytes)
+{
+   const size_t blockSize = cctx->level.blockSize;
+   auto blocks = encodeBlocks(
+     cctx->level,
+     cctx->model,
+     fromBytes(std::vector<uint8_t>(cctx->pending.begin(), cctx->pending.begin() + numBytes)),
+     blockSize);
+   cctx->pending.erase(cctx->pending.begin(), cctx->pending.begin() + numBytes);
+
+   for (const auto& b : blocks) {
+      auto bytes = toBytes(b.data);
+      cctx->index.push_back(
+        BlockContainer::IndexEntry{ cctx->rawSize, cctx->compressedSize, bytes.size(), b.flags });
+      cctx->rawSize += b.rawSize;
+      cctx->compressedSize += bytes.size();
+      if (writeOut(cctx, bytes) != CM_OK)
+         return CM_IO_ERROR;
+   }
+   return CM_OK;
+}
+
+cm_status
+cm_cctx_create(int level, const cm_model* model, cm_write_fn write, void* opaque, cm_cctx** cctx)
+{
+   CompressionLevel l;
+   if (!write || !cctx || (model ? level != CM_DEFAULT_LEVEL : !getLevel(level, l)))
+      return CM_INVALID_ARGUMENT;
+
+   return guarded(CM_INTERNAL_ERROR, [&]() {
+      *cctx = new cm_cctx{ model ? model->level : l, model, write, opaque, {}, {}, 0, 0, false };
+      return CM_OK;
+   });
+}
+
+cm_status
+cm_cctx_write(cm_cctx* cctx, const void* data, size_t size)
+{
+   if (!cctx || (!data && size))
+      return CM_INVALID_ARGUMENT;
+   if (cctx->failed)
+      return CM_IO_ERROR;
+
+   return guarded(CM_INTERNAL_ERROR, [&]() {
+      const uint8_t* bytes = static_cast<const uint8_t*>(data);
+      cctx->pending.insert(cctx->pending.end(), bytes, bytes + size);
+
+      const size_t batchSize = cctx->level.blockSize * ThreadPool::getNumThreads();
+      if (cctx->pending.size() < batchSize)
+         return CM_OK;
+      return flush(cctx, cctx->pending.size() / batchSize * batchSize);
+   });
+}
+
+cm_status
+cm_cctx_end(cm_cctx* cctx)
+{
+   if (!cctx)
+      return CM_INVALID_ARGUMENT;
+
+   cm_status status = CM_IO_ERROR;
+   if (!cctx->failed) {
+      status = guarded(CM_INTERNAL_ERROR, [&]() {
+         if (flush(cctx, cctx->pending.size()) != CM_OK)
+            return CM_IO_ERROR;
+         return writeOut(cctx, BlockContainer::packIndex(cctx->index, cctx->rawSize));
+      });
+   }
+   resetContext(cctx);
+   return status;
+}
+
+cm_status
+cm_cctx_append(cm_cctx* cctx, cm_read_fn read, void* opaque, uint64_t size, uint64_t* offset)
+{
+   if (!cctx || !read || !offset || !cctx->pending.empty() || !cctx->index.empty() ||
+       cctx->failed)
+      return CM_INVALID_ARGUMENT;
+
+   bool readFailed = false;
+   cm_status status = guarded(CM_CORRUPT_DATA, [&]() {
+      auto reader = [&](uint8_t* buffer, size_t length, uint64_t position) {
+         if (read(opaque, buffer, length, position) != 0) {
+            readFailed = true;
+            throw std::runtime_error("An error occured during reading!");
+         }
+      };
+
+      BlockContainer container(reader, size);
+      cctx->index = container.getIndex();
+      cctx->rawSize = container.getRawSize();
+      cctx->compressedSize = container.getDataSize();
+      *offset = container.getDataSize();
+      return CM_OK;
+   });
+   return status == CM_CORRUPT_DATA && readFailed ? CM_IO_ERROR : status;
+}
+
+void
+cm_cctx_free(cm_cctx* cctx)
+{
+   delete cctx;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Decompression context
+// A failed read callback throws like a short read of a file, the flag tells
+// it from corrupt data
+///////////////////////////////////////////////////////////////////////////////
+
+cm_status
+cm_dctx_create(cm_read_fn read, void* opaque, uint64_t size, cm_dctx** dctx)
+{
+   if (!read || !dctx)
+      return CM_INVALID_ARGUMENT;
+
+   auto readFailed = std::make_shared<std::atomic<bool>>(false);
+   cm_status status = guarded(CM_CORRUPT_DATA, [&]() {
+      auto reader = [read, opaque, readFailed](uint8_t* buffer, size_t length, uint64_t offset) {
+         if (read(opaque, buffer, length, offset) != 0) {
+            *readFailed = true;
+            throw std::runtime_error("An error occured during reading!");
+         }
+      };
+
+      auto result = std::make_unique<cm_dctx>();
+      result->container = std::make_unique<BlockContainer>(reader, size);
+      result->readFailed = readFailed;
+      result->position = 0;
+      result->cachedBlock = SIZE_MAX;
+      *dctx = result.release();
+      return CM_OK;
+   });
+   return status == CM_CORRUPT_DATA && *readFailed ? CM_IO_ERROR : status;
+}
+
+uint64_t
+cm_dctx_raw_size(const cm_dctx* dctx)
+{
+   return dctx ? dctx->container->getRawSize() : 0;
+}
+
+cm_status
+cm_dctx_read(cm_dctx* dctx, void* dst, size_t dstCapacity, size_t* readSize)
+{
+   if (!dctx || (!dst && dstCapacity) || !readSize)
+      return CM_INVALID_ARGUMENT;
+
+   *readSize = 0;
+   cm_status status = guarded(CM_CORRUPT_DATA, [&]() {
+      const auto& index = dctx->container->getIndex();
+      const uint64_t rawSize = dctx->container->getRawSize();
+      uint8_t* out = static_cast<uint8_t*>(dst);
+
+      while (*readSize < dstCapacity && dctx->position < rawSize) {
+         // Blocks are sorted by their raw offset, empty blocks are skipped
+         auto it = std::upper_bound(
+           index.begin(), index.end(), dctx->position, [](uint64_t o, const auto& e) {
+              return o < e.rawOffset;
+           });
+         const size_t block = it - index.begin() - 1;
+         if (block != dctx->cachedBlock) {
+            dctx->cached = toBytes(dctx->container->decodeBlock(block));
+            dctx->cachedBlock = block;
+         }
+
+         const uint64_t offset = dctx->position - index[block].rawOffset;
+         const size_t n = std::min<uint64_t>(dctx->cached.size() - offset, dstCapacity - *readSize);
+         std::copy_n(dctx->cached.begin() + offset, n, out + *readSize);
+         *readSize += n;
+         dctx->position += n;
+      }
+      return CM_OK;
+   });
+   return status == CM_CORRUPT_DATA && *dctx->readFailed ? CM_IO_ERROR : status;
+}
+
+cm_status
+cm_dctx_read_at(cm_dctx* dctx, uint64_t offset, size_t length, void* dst)
+{
+   if (!dctx || (!dst && length))
+      return CM_INVALID_ARGUMENT;
+   if (offset > dctx->container->getRawSize() || length > dctx->container->getRawSize() - offset)
+      return CM_INVALID_ARGUMENT;
+
+   cm_status status = guarded(CM_CORRUPT_DATA, [&]() {
+      auto bytes = toBytes(dctx->container->decodeRange(offset, length));
+      std::copy(bytes.begin(), bytes.end(), static_cast<uint8_t*>(dst));
+      return CM_OK;
+   });
+   return status == CM_CORRUPT_DATA && *dctx->readFailed ? CM_IO_ERROR : status;
+}
+
+void
+cm_dctx_free(cm_dctx* dctx)
+{
+   delete dctx;
+}
+
+} // extern "C"
@@ -0,0 +1,425 @@
+#define BOOST_DYNAMIC_BITSET_DONT_USE_FRIENDS
+
+#include "DeltaEncoder.hh"
+#include "BinaryUtils.hh"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using namespace BinaryUtils;
+
+#define MAX_STRIDE 65536  // Bytes, bounds the fields kept from the previous chunk
+#define CHUNK_FIELDS 4096 // Fields converted at once
+
+///////////////////////////////////////////////////////////////////////////////
+// Field conversions
+// Bytes are stored bit reversed in the blocks (see toBytes), so reversing all
+// bits of a field gives its big endian value, reversing the bits of every
+// byte its little endian value. Both are their own inverse.
+///////////////////////////////////////////////////////////////////////////////
+
+template<typename T>
+static inline T
+reverseBitsOfBytes(T x)
+{
+   const T m1 = T(~T(0)) / 3;  // 0x55...
+   const T m2 = T(~T(0)) / 5;  // 0x33...
+   const T m4 = T(~T(0)) / 17; // 0x0f...
+   x = T((x >> 1 & m1) | (x & m1) << 1);
+   x = T((x >> 2 & m2) | (x & m2) << 2);
+   return T((x >> 4 & m4) | (x & m4) << 4);
+}
+
+// Bit i moves to i ^ (8 * sizeof(T) - 1). The nibbles of every 16 bits are
+// reversed in one step: swapping the bytes apart from the bits would turn
+// into a bswap, which does not vectorize.
+template<typename T>
+static inline T
+reverseBits(T x)
+{
+   if constexpr (sizeof(T) == 1) {
+      return reverseBitsOfBytes(x);
+   } else {
+      const T m1 = T(~T(0)) / 3;               // 0x5555...
+      const T m2 = T(~T(0)) / 5;               // 0x3333...
+      const T n0 = T(~T(0)) / 0xffff * 0x000f; // 0x000f000f...
+      const T n1 = T(n0 << 4);                 // 0x00f000f0...
+      x = T((x >> 1 & m1) | (x & m1) << 1);
+      x = T((x >> 2 & m2) | (x & m2) << 2);
+      x = T((x & n0) << 12 | (x & n1) << 4 | (x >> 4 & n1) | (x >> 12 & n0));
+      if constexpr (sizeof(T) >= 4) {
+         const T m16 = T(~T(0)) / 0x10001; // 0x0000ffff...
+         x = T((x >> 16 & m16) | (x & m16) << 16);
+      }
+      if constexpr (sizeof(T) >= 8) {
+         x = T(uint64_t(x) >> 32 | uint64_t(x) << 32);
+      }
+      return x;
+   }
+}
+
+struct BitwiseField
+{
+   template<typename T>
+   static T convert(T x)
+   {
+      return x;
+   }
+};
+
+struct BigEndianField
+{
+   template<typename T>
+   static T convert(T x)
+   {
+      return reverseBits(x);
+   }
+};
+
+struct LittleEndianField
+{
+   template<typename T>
+   static T convert(T x)
+   {
+      return reverseBitsOfBytes(x);
+   }
+};
+
+struct Difference
+{
+   template<typename T>
+   static T apply(T value, T previous)
+   {
+      return T(value - previous);
+   }
+
+   template<typename T>
+   static T undo(T delta, T previous)
+   {
+      return T(delta + previous);
+   }
+};
+
+struct XorDifference
+{
+   template<typename T>
+   static T apply(T value, T previous)
+   {
+      return T(value ^ previous);
+   }
+
+   template<typename T>
+   static T undo(T delta, T previous)
+   {
+      return T(delta ^ previous);
+   }
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// loadFields / storeFields
+// Fields [begin, begin + n) of the blocks, field i is getSymbol<T>(blocks, i).
+// On little endian hosts that is the memory order of the blocks.
+///////////////////////////////////////////////////////////////////////////////
+
+template<typename T>
+static inline void
+loadFields(const bitSet::block_type* blocks, size_t begin, size_t n, T* fields)
+{
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+   std::memcpy(fields, reinterpret_cast<const uint8_t*>(blocks) + begin * sizeof(T), n * sizeof(T));
+#else
+   for (size_t j = 0; j < n; ++j)
+      fields[j] = getSymbol<T>(blocks, begin + j);
+#endif
+}
+
+template<typename T>
+static inline void
+storeFields(bitSet::block_type* blocks, size_t begin, size_t n, const T* fields)
+{
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+   std::memcpy(reinterpret_cast<uint8_t*>(blocks) + begin * sizeof(T), fields, n * sizeof(T));
+#else
+   for (size_t j = 0; j < n; ++j)
+      setSymbol<T>(blocks, begin + j, fields[j]);
+#endif
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// encodeFields / decodeFields
+// The fields are converted chunk by chunk into a buffer behind the distance
+// fields before the chunk. The buffer starts with zeros, so the first fields
+// are their own deltas. The encode loops have no dependencies between the
+// fields and vectorize, the decode is a prefix sum over fields distance apart.
+///////////////////////////////////////////////////////////////////////////////
+
+template<typename T, typename Field, typename Delta>
+static void
+encodeFields(bitSet::block_type* blocks, size_t numFields, size_t distance)
+{
+   const size_t chunk = std::max<size_t>(CHUNK_FIELDS, distance);
+   std::vector<T> values(distance + chunk);
+   std::vector<T> deltas(chunk);
+
+   for (size_t begin = 0; begin < numFields; begin += chunk) {
+      const size_t n = std::min(chunk, numFields - begin);
+      T* current = values.data() + distance;
+      loadFields(blocks, begin, n, current);
+      for (size_t j = 0; j < n; ++j)
+         current[j] = Field::convert(current[j]);
+      for (size_t j = 0; j < n; ++j)
+         deltas[j] = Field::convert(Delta::apply(current[j], values[j]));
+      storeFields(blocks, begin, n, deltas.data());
+
+      std::copy(values.begin() + n, values.begin() + n + distance, values.begin());
+   }
+}
+
+template<typename T, typename Field, typename Delta>
+static void
+decodeFields(bitSet::block_type* blocks, size_t numFields, size_t distance)
+{
+   const size_t chunk = std::max<size_t>(CHUNK_FIELDS, distance);
+   std::vector<T> values(distance + chunk);
+   std::vector<T> fields(chunk);
+
+   for (size_t begin = 0; begin < numFields; begin += chunk) {
+      const size_t n = std::min(chunk, numFields - begin);
+      T* current = values.data() + distance;
+      loadFields(blocks, begin, n, current);
+      for (size_t j = 0; j < n; ++j)
+         current[j] = Field::convert(current[j]);
+      if (distance == 1) {
+         // Keeps the running value in a register instead of reloading it
+         T previous = values[0];
+         for (size_t j = 0; j < n; ++j)
+            previous = current[j] = Delta::undo(current[j], previous);
+      } else {
+         for (size_t j = 0; j < n; ++j)
+            current[j] = Delta::undo(current[j], values[j]);
+      }
+      for (size_t j = 0; j < n; ++j)
+         fields[j] = Field::convert(current[j]);
+      storeFields(blocks, begin, n, fields.data());
+
+      std::copy(values.begin() + n, values.begin() + n + distance, values.begin());
+   }
+}
+
+// Selects the loops of a field width, byte order and delta type
+template<typename T, bool decode>
+static void
+transformFields(bitSet::block_type* blocks,
+                size_t numFields,
+                size_t distance,
+                DeltaEncoder::DeltaType deltaType,
+                DeltaEncoder::ByteOrder byteOrder)
+{
+   if (deltaType == DeltaEncoder::Xor) {
+      decode ? decodeFields<T, BitwiseField, XorDifference>(blocks, numFields, distance)
+             : encodeFields<T, BitwiseField, XorDifference>(blocks, numFields, distance);
+   } else if (byteOrder == DeltaEncoder::LittleEndian) {
+      decode ? decodeFields<T, LittleEndianField, Difference>(blocks, numFields, distance)
+             : encodeFields<T, LittleEndianField, Difference>(blocks, numFields, distance);
+   } else {
+      decode ? decodeFields<T, BigEndianField, Difference>(blocks, numFields, distance)
+             : encodeFields<T, BigEndianField, Difference>(blocks, numFields, distance);
+   }
+}
+
+template<bool decode>
+static void
+transform(bitSet& data,
+          size_t fieldWidth,
+          size_t stride,
+          DeltaEncoder::DeltaType deltaType,
+          DeltaEncoder::ByteOrder byteOrder)
+{
+   const size_t numBits = data.size();
+   const size_t numFields = numBits / (fieldWidth * 8);
+   const size_t distance = stride / fieldWidth;
+   auto blocks = takeBlocks(std::move(data));
+   auto* b = blocks.data();
+
+   switch (fieldWidth) {
+      case 1:
+         transformFields<uint8_t, decode>(b, numFields, distance, deltaType, byteOrder);
+         break;
+      case 2:
+         transformFields<uint16_t, decode>(b, numFields, distance, deltaType, byteOrder);
+         break;
+      case 4:
+         transformFields<uint32_t, decode>(b, numFields, distance, deltaType, byteOrder);
+         break;
+      case 8:
+         transformFields<uint64_t, decode>(b, numFields, distance, deltaType, byteOrder);
+         break;
+      default:
+         break;
+   }
+   data = fromBlocks(std::move(blocks), numBits);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// DeltaEncoder
+///////////////////////////////////////////////////////////////////////////////
+
+DeltaEncoder::DeltaEncoder(size_t fieldWidth,
+                           size_t stride,
+                           DeltaType deltaType,
+                           ByteOrder byteOrder)
+  : mFieldWidth(fieldWidth)
+  , mStride(stride)
+  , mDeltaType(deltaType)
+  , mByteOrder(byteOrder)
+{
+   if (!isSupported(fieldWidth, stride)) {
+      throw std::runtime_error("Unsupported field width " + std::to_string(fieldWidth) +
+                               " or stride " + std::to_string(stride) + " of the delta encoder!");
+   }
+}
+
+bool
+DeltaEncoder::isSupported(size_t fieldWidth, size_t stride)
+{
+   return (fieldWidth == 1 || fieldWidth == 2 || fieldWidth == 4 || fieldWidth == 8) &&
+          stride && stride <= MAX_STRIDE && stride % fieldWidth == 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Setup source data
+// The transform has no model, the parameters are given to the constructor
+///////////////////////////////////////////////////////////////////////////////
+
+void
+DeltaEncoder::setup(const bitSet& sourceData)
+{}
+
+///////////////////////////////////////////////////////////////////////////////
+// Reset encoder
+///////////////////////////////////////////////////////////////////////////////
+
+void
+DeltaEncoder::reset()
+{}
+
+///////////////////////////////////////////////////////////////////////////////
+// getTableSize
+///////////////////////////////////////////////////////////////////////////////
+
+size_t
+DeltaEncoder::getTableSize() const
+{
+   return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// serialize
+///////////////////////////////////////////////////////////////////////////////
+bitSet
+DeltaEncoder::serialize() const
+{
+   bitSet serialized;
+   append(serialized, convertToBitSet(getEncoderId(), sizeof(uint16_t) * 8));
+   append(serialized, convertToBitSet(mFieldWidth, 8));
+   append(serialized, convertToBitSet(mStride, sizeof(uint32_t) * 8));
+   append(serialized, convertToBitSet(mDeltaType, 8));
+   append(serialized, convertToBitSet(mByteOrder, 8));
+   return serialized;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// deserialize
+// Returns an invalid encoder if the data is truncated or not supported
+///////////////////////////////////////////////////////////////////////////////
+DeltaEncoder*
+DeltaEncoder::deserializerFactory(const bitSet& data)
+{
+   DeltaEncoder* result = new DeltaEncoder();
+   const size_t serializedSize = sizeof(uint16_t) * 8 + 8 + sizeof(uint32_t) * 8 + 8 + 8;
+   if (data.size() < serializedSize)
+      return result;
+
+   size_t currentIdx = 0;
+   auto encoderId = slice(data, currentIdx, sizeof(uint16_t) * 8).to_ulong();
+   currentIdx += sizeof(uint16_t) * 8;
+   auto fieldWidth = slice(data, currentIdx, 8).to_ulong();
+   currentIdx += 8;
+   auto stride = slice(data, currentIdx, sizeof(uint32_t) * 8).to_ulong();
+   currentIdx += sizeof(uint32_t) * 8;
+   auto deltaType = slice(data, currentIdx, 8).to_ulong();
+   currentIdx += 8;
+   auto byteOrder = slice(data, currentIdx, 8).to_ulong();
+
+   if (encoderId != mEncoderId || !isSupported(fieldWidth, stride) || deltaType > Xor ||
+       byteOrder > LittleEndian)
+      return result;
+
+   result->mFieldWidth = fieldWidth;
+   result->mStride = stride;
+   result->mDeltaType = static_cast<DeltaType>(deltaType);
+   result->mByteOrder = static_cast<ByteOrder>(byteOrder);
+   return result;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Encode data
+///////////////////////////////////////////////////////////////////////////////
+bitSet
+DeltaEncoder::encode(const bitSet& data)
+{
+   if (!isValid())
+      return bitSet();
+
+   bitSet result = data;
+   encodeInPlace(result);
+   return result;
+}
+
+void
+DeltaEncoder::encodeInPlace(bitSet& data)
+{
+   if (!isValid()) {
+      data.clear();
+      return;
+   }
+
+   transform<false>(data, mFieldWidth, mStride, mDeltaType, mByteOrder);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Decode data
+///////////////////////////////////////////////////////////////////////////////
+bitSet
+DeltaEncoder::decode(const bitSet& data)
+{
+   if (!isValid())
+      return bitSet();
+
+   bitSet result = data;
+   decodeInPlace(result);
+   return result;
+}
+
+void
+DeltaEncoder::decodeInPlace(bitSet& data)
+{
+   if (!isValid()) {
+      data.clear();
+      return;
+   }
+
+   transform<true>(data, mFieldWidth, mStride, mDeltaType, mByteOrder);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// isValid
+///////////////////////////////////////////////////////////////////////////////
+bool
+DeltaEncoder::isValid() const
+{
+   return isSupported(mFieldWidth, mStride);
+}
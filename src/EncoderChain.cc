@@ -2,12 +2,20 @@
 
 #include "EncoderChain.hh"
 #include "BinaryUtils.hh"
+#include "DeltaEncoder.hh"
+#include "EncoderFactory.hh"
 #include "HuffmanTransducer.hh"
+#include "HuffmanTransducerT.hh"
 #include "IEncoder.hh"
 #include "MarkovEncoder.hh"
+#include "MarkovEncoderT.hh"
 #include "Padder.hh"
+#include "Tracer.hh"
 
+#include <algorithm>
+#include <chrono>
 #include <numeric>
+#include <optional>
 
 using namespace BinaryUtils;
 
@@ -116,12 +124,13 @@ EncoderChain::deserializerFactory(const bitSet& data)
 
    for (auto b : deserializable) {
       if (readEncoderId(b) == 0x0001) {
-         auto h = std::unique_ptr<HuffmanTransducer>(HuffmanTransducer::deserializerFactory(b));
+         auto h =
+           std::unique_ptr<HuffmanTransducer>(EncoderFactory::deserializeHuffmanTransducer(b));
          if (h && h->isValid())
             result->mEncoderChain.push_back(std::move(h));
       }
       if (readEncoderId(b) == 0x0002) {
-         auto m = std::unique_ptr<MarkovEncoder>(MarkovEncoder::deserializerFactory(b));
+         auto m = std::unique_ptr<MarkovEncoder>(EncoderFactory::deserializeMarkovEncoder(b));
          if (m && m->isValid())
             result->mEncoderChain.push_back(std::move(m));
       }
@@ -130,34 +139,206 @@ EncoderChain::deserializerFactory(const bitSet& data)
          if (m && m->isValid())
             result->mEncoderChain.push_back(std::move(m));
       }
+      if (readEncoderId(b) == 0x0004) {
+         auto d = std::unique_ptr<DeltaEncoder>(DeltaEncoder::deserializerFactory(b));
+         if (d && d->isValid())
+            result->mEncoderChain.push_back(std::move(d));
+      }
    }
    return result;
 }
+
+///////////////////////////////////////////////////////////////////////////////
+// encoderFactory
+///////////////////////////////////////////////////////////////////////////////
+EncoderChain*
+EncoderChain::encoderFactory(const bitSet& data)
+{
+   EncoderChain* result = deserializerFactory(data);
+   std::reverse(result->mEncoderChain.begin(), result->mEncoderChain.end());
+   return result;
+}
 #include <iostream>
+///////////////////////////////////////////////////////////////////////////////
+// Fused MarkovEncoder + HuffmanTransducer
+// Native encoders of the same symbol size run in a single pass, the others
+// one after the other
+///////////////////////////////////////////////////////////////////////////////
+
+template<typename T>
+static bool
+encodeFused(MarkovEncoder& m, HuffmanTransducer& h, const bitSet& data, bitSet& result)
+{
+   auto* markov = dynamic_cast<MarkovEncoderT<T>*>(&m);
+   auto* huffman = dynamic_cast<HuffmanTransducerT<T>*>(&h);
+   if (!markov || !huffman)
+      return false;
+
+   result = huffman->encodeMarkov(data, *markov);
+   return true;
+}
+
+template<typename T>
+static bool
+decodeFused(HuffmanTransducer& h, MarkovEncoder& m, const bitSet& data, bitSet& result)
+{
+   auto* markov = dynamic_cast<MarkovEncoderT<T>*>(&m);
+   auto* huffman = dynamic_cast<HuffmanTransducerT<T>*>(&h);
+   if (!markov || !huffman)
+      return false;
+
+   result = huffman->decodeMarkov(data, *markov);
+   return true;
+}
+
+static bitSet
+encodeMarkovHuffman(MarkovEncoder& m, HuffmanTransducer& h, const bitSet& data)
+{
+   bitSet result;
+   if (encodeFused<uint8_t>(m, h, data, result) || encodeFused<uint16_t>(m, h, data, result) ||
+       encodeFused<uint32_t>(m, h, data, result))
+      return result;
+   return h.encode(m.encode(data));
+}
+
+static bitSet
+decodeHuffmanMarkov(HuffmanTransducer& h, MarkovEncoder& m, const bitSet& data)
+{
+   bitSet result;
+   if (decodeFused<uint8_t>(h, m, data, result) || decodeFused<uint16_t>(h, m, data, result) ||
+       decodeFused<uint32_t>(h, m, data, result))
+      return result;
+
+   result = h.decode(data);
+   m.decodeInPlace(result);
+   return result;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// StageRecorder
+// Measures one stage of encodeStages/decodeStages if AllocationStats is
+// enabled and traces it if the Tracer is, does nothing otherwise
+///////////////////////////////////////////////////////////////////////////////
+
+static std::string
+getEncoderName(uint16_t encoderId)
+{
+   switch (encoderId) {
+      case 0x0001:
+         return "huffman";
+      case 0x0002:
+         return "markov";
+      case 0x0003:
+         return "padder";
+      case 0x0004:
+         return "delta";
+      default:
+         return "encoder " + std::to_string(encoderId);
+   }
+}
+
+class StageRecorder
+{
+ public:
+   explicit StageRecorder(std::vector<EncoderChain::StageStats>& stats)
+     : mStats(stats)
+     , mStart(std::chrono::high_resolution_clock::now())
+   {
+      if (AllocationStats::isEnabled())
+         mScope.emplace();
+   }
+
+   void finish(const std::string& name)
+   {
+      mSpan.setName(name);
+      if (!mScope)
+         return;
+
+      auto end = std::chrono::high_resolution_clock::now();
+      mStats.push_back(EncoderChain::StageStats{
+        name, std::chrono::duration<double>(end - mStart).count(), mScope->get() });
+   }
+
+ private:
+   std::vector<EncoderChain::StageStats>& mStats;
+   std::chrono::high_resolution_clock::time_point mStart;
+   std::optional<AllocationStats::Scope> mScope;
+   Tracer::Span mSpan{ "stage" };
+};
+
 ///////////////////////////////////////////////////////////////////////////////
 // Encode data using the encoding chain
+// The stages work on a single buffer: in place where the encoder supports it,
+// otherwise its output replaces the buffer. The first stage reads the data
+// directly, so at most one stage input and one stage output are alive.
 ///////////////////////////////////////////////////////////////////////////////
 bitSet
 EncoderChain::encode(const bitSet& data)
 {
-   bitSet result(data);
+   if (mEncoderChain.empty())
+      return data;
 
-   for (const std::unique_ptr<IEncoder>& e : mEncoderChain) {
-      if (e->isValid()) {
-         result = e->encode(result);
-      } else {
+   bitSet result;
+   encodeStages(&data, result);
+   return result;
+}
+
+void
+EncoderChain::encodeInPlace(bitSet& data)
+{
+   encodeStages(nullptr, data);
+}
+
+void
+EncoderChain::encodeStages(const bitSet* data, bitSet& result)
+{
+   mStageStats.clear();
+   for (size_t i = 0; i < mEncoderChain.size(); ++i) {
+      StageRecorder recorder(mStageStats);
+      IEncoder* e = mEncoderChain[i].get();
+      const bitSet& input = i == 0 && data ? *data : result;
+      bool trained = false;
+
+      if (!e->isValid()) {
          // Retry with setup
-         e->setup(result);
-         if (e->isValid()) {
-            result = e->encode(result);
-         } else {
-            throw std::runtime_error("Use of invalid encoder during encoding. (Encoder ID: " +
-                                     std::to_string(e->getEncoderId()) + ")");
+         Tracer::Span span("setup");
+         e->setup(input);
+         trained = true;
+      }
+      if (!e->isValid()) {
+         throw std::runtime_error("Use of invalid encoder during encoding. (Encoder ID: " +
+                                  std::to_string(e->getEncoderId()) + ")");
+      }
+
+      // A MarkovEncoder trained on this data knows the statistics of its output.
+      // A following HuffmanTransducer is set up from them and both encode in one
+      // pass, without the intermediate Markov output.
+      auto* m = dynamic_cast<MarkovEncoder*>(e);
+      auto* h = i + 1 < mEncoderChain.size()
+                  ? dynamic_cast<HuffmanTransducer*>(mEncoderChain[i + 1].get())
+                  : nullptr;
+      if (m && h && m->getSymbolSize() == h->getSymbolSize()) {
+         if (!h->isValid() && trained && !m->getEncodedStatistics().empty()) {
+            // Statistics of a sample need the escape code for the unseen symbols
+            if (m->getTrainingSampleSize() && !h->getTrainingSampleSize())
+               h->setTrainingSampleSize(m->getTrainingSampleSize());
+            Tracer::Span span("setup");
+            h->setupByStatistics(m->getEncodedStatistics());
+         }
+         if (h->isValid()) {
+            result = encodeMarkovHuffman(*m, *h, input);
+            recorder.finish("markov+huffman");
+            ++i;
+            continue;
          }
       }
-   }
 
-   return result;
+      if (&input != &result)
+         result = e->encode(input);
+      else
+         e->encodeInPlace(result);
+      recorder.finish(getEncoderName(e->getEncoderId()));
+   }
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -166,18 +347,51 @@ EncoderChain::encode(const bitSet& data)
 bitSet
 EncoderChain::decode(const bitSet& data)
 {
-   bitSet result(data);
+   if (mEncoderChain.empty())
+      return data;
 
-   for (const std::unique_ptr<IEncoder>& e : mEncoderChain) {
-      if (e->isValid()) {
-         result = e->decode(result);
-      } else {
+   bitSet result;
+   decodeStages(&data, result);
+   return result;
+}
+
+void
+EncoderChain::decodeInPlace(bitSet& data)
+{
+   decodeStages(nullptr, data);
+}
+
+void
+EncoderChain::decodeStages(const bitSet* data, bitSet& result)
+{
+   mStageStats.clear();
+   for (size_t i = 0; i < mEncoderChain.size(); ++i) {
+      StageRecorder recorder(mStageStats);
+      IEncoder* e = mEncoderChain[i].get();
+      const bitSet& input = i == 0 && data ? *data : result;
+      if (!e->isValid()) {
          throw std::runtime_error("Use of invalid encoder during decoding. (Encoder ID: " +
                                   std::to_string(e->getEncoderId()) + ")");
       }
-   }
 
-   return result;
+      // Deserialized chains decode the Huffman codes before the Markov predictions
+      auto* h = dynamic_cast<HuffmanTransducer*>(e);
+      auto* m = i + 1 < mEncoderChain.size()
+                  ? dynamic_cast<MarkovEncoder*>(mEncoderChain[i + 1].get())
+                  : nullptr;
+      if (h && m && m->isValid() && m->getSymbolSize() == h->getSymbolSize()) {
+         result = decodeHuffmanMarkov(*h, *m, input);
+         recorder.finish("huffman+markov");
+         ++i;
+         continue;
+      }
+
+      if (&input != &result)
+         result = e->decode(input);
+      else
+         e->decodeInPlace(result);
+      recorder.finish(getEncoderName(e->getEncoderId()));
+   }
 }
 
 ///////////////////////////////////////////////////////////////////////////////
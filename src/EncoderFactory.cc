@@ -0,0 +1,88 @@
+#define BOOST_DYNAMIC_BITSET_DONT_USE_FRIENDS
+
+#include "EncoderFactory.hh"
+#include "HuffmanTransducerT.hh"
+#include "MarkovEncoderT.hh"
+
+///////////////////////////////////////////////////////////////////////////////
+// createMarkovEncoder
+///////////////////////////////////////////////////////////////////////////////
+
+std::unique_ptr<MarkovEncoder>
+EncoderFactory::createMarkovEncoder(size_t symbolSize, double threshold)
+{
+   switch (symbolSize) {
+      case 8:
+         return std::make_unique<MarkovEncoderT<uint8_t>>(threshold);
+      case 16:
+         return std::make_unique<MarkovEncoderT<uint16_t>>(threshold);
+      case 32:
+         return std::make_unique<MarkovEncoderT<uint32_t>>(threshold);
+      default:
+         return std::make_unique<MarkovEncoder>(symbolSize, threshold);
+   }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// createHuffmanTransducer
+///////////////////////////////////////////////////////////////////////////////
+
+std::unique_ptr<HuffmanTransducer>
+EncoderFactory::createHuffmanTransducer(size_t symbolSize, size_t numThreads)
+{
+   switch (symbolSize) {
+      case 8:
+         return std::make_unique<HuffmanTransducerT<uint8_t>>(numThreads);
+      case 16:
+         return std::make_unique<HuffmanTransducerT<uint16_t>>(numThreads);
+      case 32:
+         return std::make_unique<HuffmanTransducerT<uint32_t>>(numThreads);
+      default:
+         return std::make_unique<HuffmanTransducer>(symbolSize, numThreads);
+   }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// deserializeMarkovEncoder
+///////////////////////////////////////////////////////////////////////////////
+
+MarkovEncoder*
+EncoderFactory::deserializeMarkovEncoder(const bitSet& data)
+{
+   auto m = std::unique_ptr<MarkovEncoder>(MarkovEncoder::deserializerFactory(data));
+   if (!m->isValid())
+      return m.release();
+
+   switch (m->getSymbolSize()) {
+      case 8:
+         return new MarkovEncoderT<uint8_t>(*m);
+      case 16:
+         return new MarkovEncoderT<uint16_t>(*m);
+      case 32:
+         return new MarkovEncoderT<uint32_t>(*m);
+      default:
+         return m.release();
+   }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// deserializeHuffmanTransducer
+///////////////////////////////////////////////////////////////////////////////
+
+HuffmanTransducer*
+EncoderFactory::deserializeHuffmanTransducer(const bitSet& data)
+{
+   std::map<bitSet, bitSet> encodingMap;
+   bitSet escapeSymbol;
+
+   switch (HuffmanTransducer::readEncodingMap(data, encodingMap, escapeSymbol)) {
+      case 8:
+         return new HuffmanTransducerT<uint8_t>(encodingMap, 1, escapeSymbol);
+      case 16:
+         return new HuffmanTransducerT<uint16_t>(encodingMap, 1, escapeSymbol);
+      case 32:
+         return new HuffmanTransducerT<uint32_t>(encodingMap, 1, escapeSymbol);
+      default:
+         return HuffmanTransducer::deserializerFactory(data);
+   }
+}
@@ -2,10 +2,13 @@
 
 #include "HuffmanTransducer.hh"
 #include "BinaryUtils.hh"
+#include "SymbolStatistics.hh"
 
+#include <algorithm>
 #include <iostream>
 #include <math.h>
 #include <numeric>
+#include <string>
 
 using namespace BinaryUtils;
 
@@ -90,6 +93,8 @@ HuffmanTransducer::endState::forward(bool b)
 HuffmanTransducer::HuffmanTransducer(const bitSet& sourceData, size_t symbolSize, size_t numThreads)
   : mSymbolSize(symbolSize)
   , mNumThreads(numThreads)
+  , mMaxCodes(0)
+  , mTrainingSampleSize(0)
   , mRootState(new state())
   , mCurrentState(mRootState)
 {
@@ -103,9 +108,12 @@ HuffmanTransducer::HuffmanTransducer(const bitSet& sourceData, size_t symbolSize
 
 HuffmanTransducer::HuffmanTransducer(const std::map<bitSet, bitSet>& symbolMap,
                                      size_t symbolSize,
-                                     size_t numThreads)
+                                     size_t numThreads,
+                                     const bitSet& escapeSymbol)
   : mSymbolSize(symbolSize)
   , mNumThreads(numThreads)
+  , mMaxCodes(0)
+  , mTrainingSampleSize(0)
   , mRootState(new state())
   , mCurrentState(mRootState)
 {
@@ -133,6 +141,12 @@ HuffmanTransducer::HuffmanTransducer(const std::map<bitSet, bitSet>& symbolMap,
          }
          mCurrentState = mRootState;
       }
+
+      if (escapeSymbol.size()) {
+         if (!mEncodingMap.count(escapeSymbol))
+            throw std::runtime_error("Missing escape code");
+         mEscapeSymbol = escapeSymbol;
+      }
    } catch (...) {
       reset();
    }
@@ -145,6 +159,8 @@ HuffmanTransducer::HuffmanTransducer(const std::map<bitSet, bitSet>& symbolMap,
 HuffmanTransducer::HuffmanTransducer(size_t symbolSize, size_t numThreads)
   : mSymbolSize(symbolSize)
   , mNumThreads(numThreads)
+  , mMaxCodes(0)
+  , mTrainingSampleSize(0)
   , mRootState(new state())
   , mCurrentState(mRootState)
 {}
@@ -165,7 +181,33 @@ void
 HuffmanTransducer::setup(const bitSet& sourceData)
 {
    reset();
-   setupByProbability(getStatistics(sourceData, mSymbolSize));
+   bitSet sample;
+   const bitSet& trainingData = selectSample(sourceData, mTrainingSampleSize, mSymbolSize, sample);
+
+   if (SymbolStatistics::isSupported(trainingData, mSymbolSize)) {
+      SymbolStatistics statistics(trainingData, mSymbolSize, false);
+      setupByProbability(statistics.getProbabilities(mMaxCodes));
+   } else {
+      setupByProbability(getStatistics(trainingData, mSymbolSize));
+   }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Setup from symbol probabilities
+///////////////////////////////////////////////////////////////////////////////
+
+void
+HuffmanTransducer::setupByStatistics(const CodeProbabilityMap& probabilities)
+{
+   reset();
+
+   // Inserted in ascending symbol order like the statistics of setup(), ties
+   // between equal probabilities are resolved in the iteration order
+   std::map<bitSet, double> sorted(probabilities.begin(), probabilities.end());
+   CodeProbabilityMap ordered;
+   for (const auto& p : sorted)
+      ordered[p.first] = p.second;
+   setupByProbability(std::move(ordered));
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -184,15 +226,71 @@ HuffmanTransducer::reset()
    mEncodingMap.clear();
    mDecodingMap.clear();
    mCodeProbability.clear();
+   mEscapeSymbol.clear();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// limitCodes
+// Keeps the mMaxCodes most probable symbols (all if it is 0) and adds the
+// escape symbol with the probability of the others. Ties are resolved towards
+// the smaller symbol, the result is inserted in ascending symbol order.
+///////////////////////////////////////////////////////////////////////////////
+
+HuffmanTransducer::CodeProbabilityMap
+HuffmanTransducer::limitCodes(const CodeProbabilityMap& symbolMap)
+{
+   if (symbolMap.empty())
+      return symbolMap;
+
+   std::vector<std::pair<bitSet, double>> symbols(symbolMap.begin(), symbolMap.end());
+   std::sort(symbols.begin(), symbols.end(), [](const auto& a, const auto& b) {
+      return a.second > b.second || (a.second == b.second && a.first < b.first);
+   });
+
+   // The map may already be limited, the others have the remaining probability
+   if (mMaxCodes)
+      symbols.resize(std::min(symbols.size(), mMaxCodes));
+   double escapeProbability = 1;
+   for (const auto& s : symbols)
+      escapeProbability -= s.second;
+
+   // Symbols that only show up later still need a code for the escape
+   if (escapeProbability < 1e-12)
+      escapeProbability = symbols.back().second;
+
+   std::sort(symbols.begin(), symbols.end());
+   uint64_t escape = 0;
+   for (const auto& s : symbols) {
+      if (s.first.to_ulong() != escape)
+         break;
+      ++escape;
+   }
+
+   CodeProbabilityMap result;
+   for (const auto& s : symbols)
+      result.emplace(s.first, s.second);
+
+   // Every symbol has a code
+   if (mSymbolSize < 64 && escape >> mSymbolSize)
+      return result;
+
+   mEscapeSymbol = convertToBitSet(escape, mSymbolSize);
+   result.emplace(mEscapeSymbol, escapeProbability);
+   return result;
 }
 
 ///////////////////////////////////////////////////////////////////////////////
 // Setup source data
+// The tree needs two leaves, data of a single symbol gets the escape symbol
+// as the second one
 ///////////////////////////////////////////////////////////////////////////////
 
 void
 HuffmanTransducer::setupByProbability(CodeProbabilityMap&& symbolMap)
 {
+   if (mMaxCodes || mTrainingSampleSize || symbolMap.size() == 1)
+      symbolMap = limitCodes(symbolMap);
+
    // Process the symbol map (create end states)
    std::multimap<double, state*> grouppingMap;
 
@@ -294,6 +392,9 @@ HuffmanTransducer::encode(const bitSet& data)
    if (!isValid()) {
       return output;
    }
+   if (hasEscape()) {
+      return encodeEscaped(data);
+   }
 
    for (size_t i = 0; i < data.size(); i += mSymbolSize)
       append(output, mEncodingMap.at(slice(data, i, mSymbolSize))->encoded);
@@ -337,6 +438,66 @@ HuffmanTransducer::encode(const bitSet& data)
    return output;
 }*/
 
+///////////////////////////////////////////////////////////////////////////////
+// encodeEscaped
+// Symbols without a code (and the escape symbol itself) are written as the
+// escape code followed by the symbol
+///////////////////////////////////////////////////////////////////////////////
+
+bitSet
+HuffmanTransducer::encodeEscaped(const bitSet& data) const
+{
+   bitSet output;
+   const bitSet& escape = mEncodingMap.at(mEscapeSymbol)->encoded;
+
+   for (size_t i = 0; i < data.size(); i += mSymbolSize) {
+      bitSet symbol = slice(data, i, mSymbolSize);
+      auto it = mEncodingMap.find(symbol);
+      if (it != mEncodingMap.end() && symbol != mEscapeSymbol) {
+         append(output, it->second->encoded);
+      } else {
+         append(output, escape);
+         append(output, symbol);
+      }
+   }
+   return output;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// decodeEscaped
+// Walks the tree, the escape code is followed by the symbol. Incomplete codes
+// at the end of the input are dropped.
+///////////////////////////////////////////////////////////////////////////////
+
+bitSet
+HuffmanTransducer::decodeEscaped(const bitSet& data) const
+{
+   bitSet output;
+   const state* escape = mEncodingMap.at(mEscapeSymbol);
+   state* current = mRootState;
+
+   for (size_t i = 0; i < data.size();) {
+      current = current->stateTransitions[data[i++]];
+      if (current == nullptr)
+         throw std::runtime_error("Invalid Huffman code!");
+
+      auto it = mDecodingMap.find(current);
+      if (it == mDecodingMap.end())
+         continue;
+
+      if (current != escape) {
+         append(output, it->second);
+      } else if (i + mSymbolSize <= data.size()) {
+         append(output, slice(data, i, mSymbolSize));
+         i += mSymbolSize;
+      } else {
+         break;
+      }
+      current = mRootState;
+   }
+   return output;
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 // decodeChangeState
 ///////////////////////////////////////////////////////////////////////////////
@@ -359,6 +520,9 @@ HuffmanTransducer::decode(const bitSet& data)
    if (!isValid()) {
       return output;
    }
+   if (hasEscape()) {
+      return decodeEscaped(data);
+   }
 
    for (size_t i = 0; i < data.size(); ++i) {
       decodeChangeState(data[i]);
@@ -416,8 +580,9 @@ HuffmanTransducer::getTableSize() const
 // Stores the encoding map in a format so that the encoder/decoder can be reconstructed
 // format:
 // [number of symbols (3 bytes)]
-// [symbol size (non-encoded) (1 byte)]
+// [symbol size (non-encoded) (7 bit)][escape code flag (1 bit)]
 // [start symbol (non-encoded): DEF_SYMBOL_SIZE]
+// [escape symbol (non-encoded): DEF_SYMBOL_SIZE, only with the escape flag]
 // ...
 // [entry size (3 bit) - # of bytes]
 // [encoded symbol size - # of bits in reversed bit order][0 separators][offset to next
@@ -448,26 +613,28 @@ HuffmanTransducer::serialize() const
    // symbol size and start symbol
    auto it = encodingMap.begin();
    auto currentSymbol = it->first;
-   auto bSymbolSize = convertToBitSet(mSymbolSize, 1 * 8);
-   if (bSymbolSize.size() > 8)
-      throw std::runtime_error("Symbol size takes more than one byte!");
+   auto bSymbolSize = convertToBitSet(mSymbolSize, 7);
+   if (bSymbolSize.size() > 7)
+      throw std::runtime_error("Symbol size takes more than 7 bits!");
    append(serialized, bSymbolSize);
+   serialized.push_back(hasEscape());
    append(serialized, currentSymbol);
+   if (hasEscape())
+      append(serialized, mEscapeSymbol);
 
+   // The kept symbols of an escaped map are sparse, their offsets need wider entries
+   const size_t entrySizeBits = hasEscape() ? 4 : 3;
    bitSet nextSymbol;
    bitSet bOffset;
-   int offset;
 
    for (it = encodingMap.begin(); it != encodingMap.end(); ++it) {
 
       if (std::next(it) != encodingMap.end()) {
          nextSymbol = std::next(it)->first;
-         offset = int(nextSymbol.to_ulong()) - int(currentSymbol.to_ulong());
-         if (offset < 0)
+         if (nextSymbol.to_ulong() < currentSymbol.to_ulong())
             throw std::runtime_error("Negative offset! (the encoding may not be ordered)");
-         bOffset = convertToBitSet(offset);
+         bOffset = convertToBitSet(nextSymbol.to_ulong() - currentSymbol.to_ulong());
       } else {
-         offset = 0;
          bOffset = bitSet(1);
          nextSymbol = bitSet();
       }
@@ -483,7 +650,10 @@ HuffmanTransducer::serialize() const
 
       // Entry size computed from the previous values
       size_t entrySize = (bEncodedSize.size() + bOffset.size() + numSeparator) / 8;
-      auto bEntrySize = convertToBitSet(entrySize, 3);
+      auto bEntrySize = convertToBitSet(entrySize, entrySizeBits);
+      if (bEntrySize.size() > entrySizeBits)
+         throw std::runtime_error("Entry size takes more than " + std::to_string(entrySizeBits) +
+                                  " bits!");
 
       // Write to output
       append(serialized, bEntrySize);
@@ -506,28 +676,54 @@ HuffmanTransducer*
 HuffmanTransducer::deserializerFactory(const bitSet& data)
 {
    std::map<bitSet, bitSet> result;
+   bitSet escapeSymbol;
+   size_t symbolSize = readEncodingMap(data, result, escapeSymbol);
+   return new HuffmanTransducer(result, symbolSize, 1, escapeSymbol);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// readEncodingMap
+// Parses the serialized encoding map, returns the symbol size or 0 on failure
+///////////////////////////////////////////////////////////////////////////////
+
+size_t
+HuffmanTransducer::readEncodingMap(const bitSet& data, std::map<bitSet, bitSet>& result)
+{
+   bitSet escapeSymbol;
+   return readEncodingMap(data, result, escapeSymbol);
+}
+
+size_t
+HuffmanTransducer::readEncodingMap(const bitSet& data,
+                                   std::map<bitSet, bitSet>& result,
+                                   bitSet& escapeSymbol)
+{
    size_t currentIdx = 0;
+   result.clear();
+   escapeSymbol.clear();
 
    if (data.size() < sizeof(uint16_t) * 8) {
-      return new HuffmanTransducer(result, 0);
+      return 0;
    }
 
    auto encoderId = slice(data, 0, sizeof(uint16_t) * 8).to_ulong();
    currentIdx += sizeof(uint16_t) * 8;
    if (encoderId != mEncoderId) {
-      return new HuffmanTransducer(result, 0);
+      return 0;
    }
 
    size_t numSymbols = 0;
    size_t symbolsize = 0;
+   bool escape = false;
 
    if (data.size() > currentIdx + 4 * 8) {
       numSymbols = slice(data, currentIdx, 3 * 8).to_ulong();
       currentIdx += 3 * 8;
-      symbolsize = slice(data, currentIdx, 8).to_ulong();
+      symbolsize = slice(data, currentIdx, 7).to_ulong();
+      escape = data[currentIdx + 7];
       currentIdx += 8;
    } else {
-      return new HuffmanTransducer(result, 0);
+      return 0;
    }
 
    bitSet currentSymbol;
@@ -535,14 +731,22 @@ HuffmanTransducer::deserializerFactory(const bitSet& data)
       currentSymbol = slice(data, currentIdx, symbolsize);
       currentIdx += symbolsize;
    } else {
-      return new HuffmanTransducer(result, 0);
+      return 0;
    }
 
+   if (escape && data.size() > currentIdx + symbolsize) {
+      escapeSymbol = slice(data, currentIdx, symbolsize);
+      currentIdx += symbolsize;
+   } else if (escape) {
+      return 0;
+   }
+
+   const size_t entrySizeBits = escape ? 4 : 3;
    size_t symbolCounter = 0;
-   while (symbolCounter < numSymbols && currentIdx + 3 <= data.size()) {
-      auto entrySize = slice(data, currentIdx, 3).to_ulong();
+   while (symbolCounter < numSymbols && currentIdx + entrySizeBits <= data.size()) {
+      auto entrySize = slice(data, currentIdx, entrySizeBits).to_ulong();
 
-      currentIdx += 3;
+      currentIdx += entrySizeBits;
       if (currentIdx + entrySize * 8 >= data.size())
          break;
 
@@ -562,12 +766,13 @@ HuffmanTransducer::deserializerFactory(const bitSet& data)
       symbolCounter += 1;
    }
 
-   if (symbolCounter != numSymbols) {
+   if (symbolCounter != numSymbols || (escape && !result.count(escapeSymbol))) {
       result.clear();
+      escapeSymbol.clear();
       symbolsize = 0;
    }
 
-   return new HuffmanTransducer(result, symbolsize);
+   return symbolsize;
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -583,6 +788,18 @@ HuffmanTransducer::getEncodingMap() const
    return result;
 }
 
+///////////////////////////////////////////////////////////////////////////////
+// forEachCode
+// Visits the (symbol, code) pairs without copying the encoding map
+///////////////////////////////////////////////////////////////////////////////
+void
+HuffmanTransducer::forEachCode(const std::function<void(const bitSet&, const bitSet&)>& f) const
+{
+   for (const auto& p : mEncodingMap) {
+      f(p.first, p.second->encoded);
+   }
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 // isValid
 ///////////////////////////////////////////////////////////////////////////////
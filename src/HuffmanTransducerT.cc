@@ -0,0 +1,465 @@
+#define BOOST_DYNAMIC_BITSET_DONT_USE_FRIENDS
+
+#include "HuffmanTransducerT.hh"
+#include "BinaryUtils.hh"
+#include "MarkovEncoderT.hh"
+#include "SymbolStatistics.hh"
+
+#include <algorithm>
+#include <stdexcept>
+
+using namespace BinaryUtils;
+
+static_assert(bitSet::bits_per_block == 64, "The bit writer assumes 64 bit blocks");
+
+///////////////////////////////////////////////////////////////////////////////
+// HuffmanTransducerT
+///////////////////////////////////////////////////////////////////////////////
+
+template<typename T>
+HuffmanTransducerT<T>::HuffmanTransducerT(const bitSet& sourceData, size_t numThreads)
+  : HuffmanTransducer(sizeof(T) * 8, numThreads)
+  , mNative(false)
+  , mEscapeIndex(-1)
+{
+   setup(sourceData);
+}
+
+template<typename T>
+HuffmanTransducerT<T>::HuffmanTransducerT(size_t numThreads)
+  : HuffmanTransducer(sizeof(T) * 8, numThreads)
+  , mNative(false)
+  , mEscapeIndex(-1)
+{}
+
+///////////////////////////////////////////////////////////////////////////////
+// HuffmanTransducerT - only for deserialization
+///////////////////////////////////////////////////////////////////////////////
+
+template<typename T>
+HuffmanTransducerT<T>::HuffmanTransducerT(const std::map<bitSet, bitSet>& symbolMap,
+                                          size_t numThreads,
+                                          const bitSet& escapeSymbol)
+  : HuffmanTransducer(symbolMap, sizeof(T) * 8, numThreads, escapeSymbol)
+  , mNative(false)
+  , mEscapeIndex(-1)
+{
+   buildTables();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Setup source data
+// The symbol frequencies are counted on native integers
+///////////////////////////////////////////////////////////////////////////////
+
+template<typename T>
+void
+HuffmanTransducerT<T>::setup(const bitSet& sourceData)
+{
+   if (!SymbolStatistics::isSupported(sourceData, mSymbolSize)) {
+      HuffmanTransducer::setup(sourceData);
+      buildTables();
+      return;
+   }
+
+   reset();
+   bitSet sample;
+   const bitSet& trainingData = selectSample(sourceData, mTrainingSampleSize, mSymbolSize, sample);
+   setupByProbability(
+     SymbolStatistics(trainingData, mSymbolSize, false).getProbabilities(mMaxCodes));
+   buildTables();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Setup from symbol probabilities
+///////////////////////////////////////////////////////////////////////////////
+
+template<typename T>
+void
+HuffmanTransducerT<T>::setupByStatistics(const CodeProbabilityMap& probabilities)
+{
+   HuffmanTransducer::setupByStatistics(probabilities);
+   buildTables();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Reset encoder
+///////////////////////////////////////////////////////////////////////////////
+
+template<typename T>
+void
+HuffmanTransducerT<T>::reset()
+{
+   HuffmanTransducer::reset();
+   mNative = false;
+   mCodes.clear();
+   mCodeLengths.clear();
+   mCodeMap.clear();
+   mTree.clear();
+   mSymbols.clear();
+   mEscapeIndex = -1;
+   mLookup.clear();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// buildTables
+// Native encoding table, decoding tree and lookup table from the encoding map
+///////////////////////////////////////////////////////////////////////////////
+
+template<typename T>
+void
+HuffmanTransducerT<T>::buildTables()
+{
+   mNative = false;
+   mCodeMap.clear();
+   mSymbols.clear();
+   mEscapeIndex = -1;
+   mTree.assign(1, { 0, 0 });
+
+   if (sizeof(T) <= 2) {
+      mCodes.assign(size_t(1) << mSymbolSize, 0);
+      mCodeLengths.assign(size_t(1) << mSymbolSize, 0);
+   }
+
+   bool valid = isValid();
+   size_t maxLength = 0;
+   forEachCode([&](const bitSet& symbolBits, const bitSet& encoded) {
+      if (!valid || encoded.empty() || encoded.size() > mMaxCodeLength) {
+         valid = false;
+         return;
+      }
+
+      T symbol = symbolBits.to_ulong();
+      uint64_t code = 0;
+      for (size_t i = 0; i < encoded.size(); ++i)
+         code |= uint64_t(encoded[i]) << i;
+
+      if (hasEscape() && symbolBits == mEscapeSymbol) {
+         mEscapeCode = code;
+         mEscapeLength = encoded.size();
+         mEscapeIndex = mSymbols.size();
+      } else if (sizeof(T) <= 2) {
+         mCodes[symbol] = code;
+         mCodeLengths[symbol] = encoded.size();
+      } else {
+         mCodeMap[symbol] = std::make_pair(code, uint8_t(encoded.size()));
+      }
+
+      // Insert into the decoding tree
+      size_t node = 0;
+      for (size_t i = 0; i + 1 < encoded.size() && valid; ++i) {
+         int32_t child = mTree[node][encoded[i]];
+         if (child < 0)
+            valid = false;
+         if (child == 0) {
+            child = mTree.size();
+            mTree[node][encoded[i]] = child;
+            mTree.push_back({ 0, 0 });
+         }
+         node = child;
+      }
+      if (!valid || mTree[node][encoded[encoded.size() - 1]] != 0) {
+         valid = false;
+         return;
+      }
+      mTree[node][encoded[encoded.size() - 1]] = ~int32_t(mSymbols.size());
+      mSymbols.push_back(symbol);
+
+      maxLength = std::max(maxLength, encoded.size());
+   });
+
+   if (!valid)
+      return;
+
+   // Lookup table indexed by the next mLookupBits bits (first bit is the LSB)
+   mLookupBits = std::min(maxLength, mMaxLookupBits);
+   mLookup.assign(size_t(1) << mLookupBits, { -1, 0 });
+   for (size_t bits = 0; bits < mLookup.size(); ++bits) {
+      int32_t node = 0;
+      for (size_t i = 0; i < mLookupBits && node >= 0; ++i) {
+         int32_t child = mTree[node][(bits >> i) & 1];
+         if (child < 0)
+            mLookup[bits] = { ~child, uint8_t(i + 1) };
+         else if (child == 0)
+            break;
+         else if (i + 1 == mLookupBits)
+            mLookup[bits] = { child, 0 };
+         node = child;
+      }
+   }
+
+   mNative = true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// findCode
+///////////////////////////////////////////////////////////////////////////////
+
+template<typename T>
+bool
+HuffmanTransducerT<T>::findCode(T symbol, uint64_t& code, uint8_t& length) const
+{
+   if (sizeof(T) <= 2) {
+      code = mCodes[symbol];
+      length = mCodeLengths[symbol];
+      return length;
+   }
+
+   auto it = mCodeMap.find(symbol);
+   if (it == mCodeMap.end())
+      return false;
+   code = it->second.first;
+   length = it->second.second;
+   return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// encode
+///////////////////////////////////////////////////////////////////////////////
+
+template<typename T>
+bitSet
+HuffmanTransducerT<T>::encode(const bitSet& data)
+{
+   if (!isValid()) {
+      return bitSet();
+   }
+   if (!mNative || data.size() % mSymbolSize) {
+      return HuffmanTransducer::encode(data);
+   }
+
+   const auto* symbols = getBlocks(data).data();
+   return encodeSymbols(data.size() / mSymbolSize,
+                        [&](size_t i) { return getSymbol<T>(symbols, i); });
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// encodeSymbols
+// Word based bit writer, symbolAt(i) is called for i = 0, 1, ..., numSymbols - 1.
+// Symbols without a code are written as the escape code and the symbol.
+///////////////////////////////////////////////////////////////////////////////
+
+template<typename T>
+template<typename F>
+bitSet
+HuffmanTransducerT<T>::encodeSymbols(size_t numSymbols, F&& symbolAt) const
+{
+   std::vector<bitSet::block_type> output;
+   output.reserve(numSymbols * mSymbolSize / bitSet::bits_per_block + 1);
+
+   uint64_t buffer = 0;
+   size_t numBuffered = 0;
+   size_t numBits = 0;
+
+   auto write = [&](uint64_t code, size_t length) {
+      buffer |= code << numBuffered;
+      numBuffered += length;
+      numBits += length;
+      if (numBuffered >= 64) {
+         output.push_back(buffer);
+         numBuffered -= 64;
+         buffer = numBuffered ? code >> (length - numBuffered) : 0;
+      }
+   };
+
+   for (size_t i = 0; i < numSymbols; ++i) {
+      T symbol = symbolAt(i);
+      uint64_t code;
+      uint8_t length;
+      if (findCode(symbol, code, length)) {
+         write(code, length);
+      } else if (mEscapeIndex >= 0) {
+         write(mEscapeCode, mEscapeLength);
+         write(symbol, mSymbolSize);
+      } else {
+         throw std::runtime_error("Symbol not in the encoding table!");
+      }
+   }
+   if (numBuffered)
+      output.push_back(buffer);
+
+   return fromBlocks(std::move(output), numBits);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// decode
+///////////////////////////////////////////////////////////////////////////////
+
+template<typename T>
+bitSet
+HuffmanTransducerT<T>::decode(const bitSet& data)
+{
+   if (!isValid()) {
+      return bitSet();
+   }
+   if (!mNative) {
+      return HuffmanTransducer::decode(data);
+   }
+
+   return decodeSymbols(data, [](T symbol) { return symbol; });
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// decodeSymbols
+// The output holds map(symbol) for the decoded symbols in order, the escape
+// code is followed by the symbol. Incomplete codes at the end of the input
+// are dropped.
+///////////////////////////////////////////////////////////////////////////////
+
+template<typename T>
+template<typename F>
+bitSet
+HuffmanTransducerT<T>::decodeSymbols(const bitSet& data, F&& map) const
+{
+   const auto& blocks = getBlocks(data);
+   const size_t perBlock = bitSet::bits_per_block / mSymbolSize;
+
+   // Decoded symbols are packed directly into the blocks of the output
+   std::vector<bitSet::block_type> output;
+   output.reserve(data.size() / bitSet::bits_per_block + 1);
+   bitSet::block_type outputBlock = 0;
+   size_t numSymbols = 0;
+
+   auto emit = [&](T symbol) {
+      outputBlock |= bitSet::block_type(map(symbol)) << (numSymbols % perBlock * mSymbolSize);
+      if (++numSymbols % perBlock == 0) {
+         output.push_back(outputBlock);
+         outputBlock = 0;
+      }
+   };
+
+   const size_t n = data.size();
+   const uint64_t mask = (uint64_t(1) << mLookupBits) - 1;
+   size_t pos = 0;
+   int32_t node = 0;
+
+   // The next 64 bits from pos
+   auto read = [&]() {
+      size_t block = pos / 64;
+      size_t offset = pos % 64;
+      uint64_t bits = blocks[block] >> offset;
+      if (offset && block + 1 < blocks.size())
+         bits |= blocks[block + 1] << (64 - offset);
+      return bits;
+   };
+
+   // Returns false for an incomplete escaped symbol at the end
+   auto emitIndex = [&](int32_t index) {
+      if (index != mEscapeIndex) {
+         emit(mSymbols[index]);
+         return true;
+      }
+      if (pos + mSymbolSize > n)
+         return false;
+      emit(T(read()));
+      pos += mSymbolSize;
+      return true;
+   };
+
+   while (pos < n) {
+      if (node == 0 && pos + mLookupBits <= n) {
+         const lookupEntry& e = mLookup[read() & mask];
+         if (e.length) {
+            pos += e.length;
+            if (!emitIndex(e.next))
+               break;
+            continue;
+         }
+         if (e.next < 0)
+            throw std::runtime_error("Invalid Huffman code!");
+         node = e.next;
+         pos += mLookupBits;
+         continue;
+      }
+
+      bool bit = (blocks[pos / 64] >> (pos % 64)) & 1;
+      ++pos;
+      int32_t child = mTree[node][bit];
+      if (child < 0) {
+         if (!emitIndex(~child))
+            break;
+         node = 0;
+      } else if (child == 0) {
+         throw std::runtime_error("Invalid Huffman code!");
+      } else {
+         node = child;
+      }
+   }
+   if (numSymbols % perBlock)
+      output.push_back(outputBlock);
+
+   return fromBlocks(std::move(output), numSymbols * mSymbolSize);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// encodeMarkov
+// Same as encode(markov.encode(data)), the Markov output of a symbol is
+// Huffman coded right away instead of being stored
+///////////////////////////////////////////////////////////////////////////////
+
+template<typename T>
+bitSet
+HuffmanTransducerT<T>::encodeMarkov(const bitSet& data, MarkovEncoderT<T>& markov)
+{
+   if (!isValid() || !markov.isValid() || !mNative || data.size() % mSymbolSize) {
+      return encode(markov.encode(data));
+   }
+   if (markov.isCollectingPredictionStats()) {
+      markov.countPredictions(data);
+   }
+
+   const auto* symbols = getBlocks(data).data();
+   const bool xorMode = !markov.mUnusedSymbol.size();
+   const size_t restartInterval = markov.mRestartInterval;
+   size_t untilRestart = 0;
+
+   return encodeSymbols(data.size() / mSymbolSize, [&](size_t i) {
+      T symbol = getSymbol<T>(symbols, i);
+
+      // The first symbol and the restart points are literals
+      if (untilRestart-- == 0) {
+         untilRestart = restartInterval ? restartInterval - 1 : SIZE_MAX;
+         return symbol;
+      }
+
+      uint64_t mapped = markov.predict(getSymbol<T>(symbols, i - 1));
+      if (xorMode)
+         return T(symbol ^ (mapped == MarkovEncoderT<T>::mNoPrediction ? 0 : T(mapped)));
+      return symbol == mapped ? markov.mNativeUnusedSymbol : symbol;
+   });
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// decodeMarkov
+// Same as markov.decode(decode(data)) without the intermediate Markov data
+///////////////////////////////////////////////////////////////////////////////
+
+template<typename T>
+bitSet
+HuffmanTransducerT<T>::decodeMarkov(const bitSet& data, MarkovEncoderT<T>& markov)
+{
+   if (!isValid() || !markov.isValid() || !mNative) {
+      return markov.decode(decode(data));
+   }
+
+   const bool xorMode = !markov.mUnusedSymbol.size();
+   const size_t restartInterval = markov.mRestartInterval;
+   size_t untilRestart = 0;
+   T previous = 0;
+
+   return decodeSymbols(data, [&](T symbol) {
+      if (untilRestart-- == 0) {
+         untilRestart = restartInterval ? restartInterval - 1 : SIZE_MAX;
+      } else if (xorMode || symbol == markov.mNativeUnusedSymbol) {
+         uint64_t mapped = markov.predict(previous);
+         T predicted = mapped == MarkovEncoderT<T>::mNoPrediction ? 0 : T(mapped);
+         symbol = xorMode ? T(symbol ^ predicted) : predicted;
+      }
+      previous = symbol;
+      return symbol;
+   });
+}
+
+template class HuffmanTransducerT<uint8_t>;
+template class HuffmanTransducerT<uint16_t>;
+template class HuffmanTransducerT<uint32_t>;
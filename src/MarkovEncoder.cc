@@ -2,7 +2,9 @@
 
 #include "MarkovEncoder.hh"
 #include "BinaryUtils.hh"
+#include "ThreadPool.hh"
 
+#include <algorithm>
 #include <map>
 #include <unordered_map>
 
@@ -18,6 +20,10 @@ MarkovEncoder::MarkovEncoder(const bitSet& data, size_t symbolSize, double thres
   : mUnusedSymbol(bitSet())
   , mSymbolSize(symbolSize)
   , mThreshold(threshold)
+  , mRestartInterval(0)
+  , mTrainingSampleSize(0)
+  , mTrainingMemoryBudget(0)
+  , mCollectPredictionStats(false)
 {
    setup(data);
 }
@@ -30,6 +36,10 @@ MarkovEncoder::MarkovEncoder(size_t symbolSize, double threshold)
   : mUnusedSymbol(bitSet())
   , mSymbolSize(symbolSize)
   , mThreshold(threshold)
+  , mRestartInterval(0)
+  , mTrainingSampleSize(0)
+  , mTrainingMemoryBudget(0)
+  , mCollectPredictionStats(false)
 {}
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -43,6 +53,10 @@ MarkovEncoder::MarkovEncoder(const std::map<bitSet, bitSet>& iSymbolMap,
   ,*/
   mUnusedSymbol(iUnusedSymbol)
   , mSymbolSize(iSymbolSize)
+  , mRestartInterval(0)
+  , mTrainingSampleSize(0)
+  , mTrainingMemoryBudget(0)
+  , mCollectPredictionStats(false)
 {
    for (auto e : iSymbolMap)
       mEncodingMap.emplace(e.first, e.second);
@@ -56,8 +70,140 @@ void
 MarkovEncoder::setup(const bitSet& sourceData)
 {
    reset();
-   findUnusedSymbol(sourceData, mUnusedSymbol, mSymbolSize);
-   mEncodingMap = createEncodingMap(computeMarkovChain(sourceData, mSymbolSize), mThreshold);
+   bitSet sample;
+   const bitSet& trainingData = selectSample(sourceData, mTrainingSampleSize, mSymbolSize, sample);
+
+   if (!SymbolStatistics::isSupported(sourceData, mSymbolSize)) {
+      findUnusedSymbol(sourceData, mUnusedSymbol, mSymbolSize);
+      mEncodingMap = createEncodingMap(computeMarkovChain(trainingData, mSymbolSize), mThreshold);
+      return;
+   }
+
+   // Unused symbol, transitions and the encoded histogram from a single pass
+   SymbolStatistics statistics(trainingData, mSymbolSize, true, mTrainingMemoryBudget);
+   uint64_t unusedSymbol;
+   if (&trainingData == &sourceData ? statistics.findUnusedSymbol(unusedSymbol)
+                                    : findUnusedOutsideSample(sourceData, statistics, unusedSymbol))
+      mUnusedSymbol = convertToBitSet(unusedSymbol, mSymbolSize);
+
+   auto predictions = statistics.getPredictions(mThreshold);
+   for (const auto& p : predictions) {
+      mEncodingMap.emplace(convertToBitSet(p.first, mSymbolSize),
+                           convertToBitSet(p.second.next, mSymbolSize));
+   }
+
+   if (isValid())
+      setupEncodedStatistics(trainingData, statistics, predictions);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// containsSymbol
+// Linear scan without early exit inside a stride, so that it vectorizes
+///////////////////////////////////////////////////////////////////////////////
+
+template<typename T>
+static bool
+containsSymbol(const bitSet& data, T symbol)
+{
+   const size_t stride = 4096;
+   const auto* blocks = getBlocks(data).data();
+   const size_t numSymbols = data.size() / (sizeof(T) * 8);
+
+   for (size_t i = 0; i < numSymbols; i += stride) {
+      bool found = false;
+      for (size_t j = i; j < std::min(numSymbols, i + stride); ++j)
+         found |= getSymbol<T>(blocks, j) == symbol;
+      if (found)
+         return true;
+   }
+   return false;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// findUnusedOutsideSample
+// The unused symbol must not occur anywhere in the data, not only in the
+// sample. The largest symbols missing from the sample are checked with a scan
+// of the data, the full statistics are the last resort.
+///////////////////////////////////////////////////////////////////////////////
+
+bool
+MarkovEncoder::findUnusedOutsideSample(const bitSet& data,
+                                       const SymbolStatistics& sampleStatistics,
+                                       uint64_t& symbol) const
+{
+   const uint64_t maxSymbol = (uint64_t(1) << mSymbolSize) - 1;
+   size_t numCandidates = 0;
+
+   for (uint64_t s = maxSymbol; numCandidates < mMaxUnusedCandidates; --s) {
+      if (!sampleStatistics.isPresent(s)) {
+         ++numCandidates;
+         bool found = true;
+         switch (mSymbolSize) {
+            case 8:
+               found = containsSymbol<uint8_t>(data, s);
+               break;
+            case 16:
+               found = containsSymbol<uint16_t>(data, s);
+               break;
+            case 32:
+               found = containsSymbol<uint32_t>(data, s);
+               break;
+            default:
+               numCandidates = mMaxUnusedCandidates;
+         }
+         if (!found) {
+            symbol = s;
+            return true;
+         }
+      }
+      if (s == 0)
+         break;
+   }
+
+   return SymbolStatistics(data, mSymbolSize, false).findUnusedSymbol(symbol);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// setupEncodedStatistics
+// encode() replaces every predicted symbol by the unused symbol, except for
+// the first symbol and the restart points. The histogram of the output is
+// the histogram of the input with these replacements.
+///////////////////////////////////////////////////////////////////////////////
+
+void
+MarkovEncoder::setupEncodedStatistics(
+  const bitSet& data,
+  const SymbolStatistics& statistics,
+  const boost::unordered_map<uint64_t, SymbolStatistics::Prediction>& predictions)
+{
+   std::map<uint64_t, uint64_t> counts;
+   for (const auto& c : statistics.getCounts())
+      counts.emplace(c);
+
+   const uint64_t unusedSymbol = mUnusedSymbol.to_ulong();
+   for (const auto& p : predictions) {
+      counts[p.second.next] -= p.second.count;
+      counts[unusedSymbol] += p.second.count;
+   }
+
+   for (size_t i = mRestartInterval; mRestartInterval && i < statistics.getNumSymbols();
+        i += mRestartInterval) {
+      auto it = predictions.find(slice(data, (i - 1) * mSymbolSize, mSymbolSize).to_ulong());
+      uint64_t symbol = slice(data, i * mSymbolSize, mSymbolSize).to_ulong();
+      // The guaranteed counts of a sketch may be below the restart point hits,
+      // the unused symbol must keep a code
+      if (it != predictions.end() && it->second.next == symbol && counts[unusedSymbol] > 1) {
+         ++counts[symbol];
+         --counts[unusedSymbol];
+      }
+   }
+
+   for (const auto& c : counts) {
+      if (c.second) {
+         mEncodedStatistics[convertToBitSet(c.first, mSymbolSize)] =
+           double(c.second) / statistics.getNumSymbols();
+      }
+   }
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -69,6 +215,7 @@ MarkovEncoder::reset()
 {
    mEncodingMap.clear();
    mUnusedSymbol.clear();
+   mEncodedStatistics.clear();
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -89,10 +236,7 @@ MarkovEncoder::computeMarkovChain(const bitSet& data, size_t symbolSize)
 
    for (size_t i = 0; i < data.size(); i += symbolSize) {
       currentSymbol = slice(data, i, symbolSize);
-      boost::unordered_map<bitSet, float> nextStates;
-      result.emplace(previousSymbol, nextStates);
-      result.at(previousSymbol).emplace(currentSymbol, 0);
-      result.at(previousSymbol).at(currentSymbol) += 1;
+      ++result[previousSymbol][currentSymbol];
       previousSymbol = currentSymbol;
    }
 
@@ -102,6 +246,7 @@ MarkovEncoder::computeMarkovChain(const bitSet& data, size_t symbolSize)
 ///////////////////////////////////////////////////////////////////////////////
 // Create encoding map based on Markov chain
 // Example: key=0001, value=0110 means that the next symbol to 0001 is 0110.
+// The counts are exact integers, only their ratio is a floating point number.
 ///////////////////////////////////////////////////////////////////////////////
 
 boost::unordered_map<bitSet, bitSet>
@@ -110,23 +255,23 @@ MarkovEncoder::createEncodingMap(const MarkovEncoder::MarkovChain& markovChain,
 {
    boost::unordered_map<bitSet, bitSet> result;
    for (auto it = markovChain.begin(); it != markovChain.end(); ++it) {
-      auto currentSymbol = it->first;
+      const auto& currentSymbol = it->first;
 
-      bitSet candidate;
-      float currentFrequency = 0;
-      float sum = 0;
+      const bitSet* candidate = nullptr;
+      uint64_t currentFrequency = 0;
+      uint64_t sum = 0;
 
-      auto nextStates = it->second;
+      const auto& nextStates = it->second;
 
       for (auto it2 = nextStates.begin(); it2 != nextStates.end(); ++it2) {
          if (it2->second > currentFrequency) {
-            candidate = it2->first;
+            candidate = &it2->first;
             currentFrequency = it2->second;
          }
          sum += it2->second;
       }
-      if ((currentFrequency / sum) > probabiltyThreshold) {
-         result.emplace(currentSymbol, candidate);
+      if (candidate && double(currentFrequency) / sum > probabiltyThreshold) {
+         result.emplace(currentSymbol, *candidate);
       }
    }
 
@@ -177,6 +322,10 @@ MarkovEncoder::serialize() const
       append(result, p.first);
       append(result, p.second);
    }
+   // Optional, models without restart points keep the original format
+   if (mRestartInterval) {
+      append(result, convertToBitSet(mRestartInterval, sizeof(uint32_t) * 8));
+   }
    return result;
 }
 
@@ -234,11 +383,19 @@ MarkovEncoder::deserializerFactory(const bitSet& data)
       unusedSymbol = bitSet();
       symbolSize = 0;
    }
-   return new MarkovEncoder(result, unusedSymbol, symbolSize);
+
+   auto m = new MarkovEncoder(result, unusedSymbol, symbolSize);
+   if (symbolSize && currentIdx + sizeof(uint32_t) * 8 <= data.size()) {
+      m->mRestartInterval = slice(data, currentIdx, sizeof(uint32_t) * 8).to_ulong();
+   }
+   return m;
 }
 
 ///////////////////////////////////////////////////////////////////////////////
 // Encode data using the encoding map
+// The prediction of a symbol only depends on the original previous symbol, so
+// the chunks are encoded in parallel. A chunk is a whole number of symbols and
+// blocks, no two threads write into the same block of the result.
 ///////////////////////////////////////////////////////////////////////////////
 bitSet
 MarkovEncoder::encode(const bitSet& data)
@@ -248,13 +405,46 @@ MarkovEncoder::encode(const bitSet& data)
    if (!isValid()) {
       return result;
    }
+   if (mCollectPredictionStats) {
+      countPredictions(data);
+   }
 
+   const size_t numSymbols = (data.size() + mSymbolSize - 1) / mSymbolSize;
+   const size_t chunkSize = getChunkSize(numSymbols, bitSet::bits_per_block) * mSymbolSize;
+   const size_t numChunks = (data.size() + chunkSize - 1) / chunkSize;
+
+   ThreadPool::parallelFor(numChunks, [&](size_t n) {
+      encodeChunk(data, result, n * chunkSize, std::min(data.size(), (n + 1) * chunkSize));
+   });
+
+   return result;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// encodeChunk
+// Encodes the bits [begin, end) of data into result, seeded with the symbol
+// before begin
+///////////////////////////////////////////////////////////////////////////////
+void
+MarkovEncoder::encodeChunk(const bitSet& data, bitSet& result, size_t begin, size_t end) const
+{
    bitSet currentSymbol(mSymbolSize);
    bitSet mapped(mSymbolSize);
 
+   if (!isRestartPoint(begin / mSymbolSize)) {
+      auto it = mEncodingMap.find(slice(data, begin - mSymbolSize, mSymbolSize));
+      if (it != mEncodingMap.end())
+         mapped = it->second;
+      else if (mUnusedSymbol.size())
+         mapped.clear();
+   }
+
    if (!mUnusedSymbol.size())
-      for (size_t i = 0; i < data.size(); i += mSymbolSize) {
-         for (size_t j = 0; j < mSymbolSize && j + i < data.size(); ++j) {
+      for (size_t i = begin; i < end; i += mSymbolSize) {
+         if (isRestartPoint(i / mSymbolSize))
+            mapped = bitSet(mSymbolSize);
+
+         for (size_t j = 0; j < mSymbolSize && j + i < end; ++j) {
             currentSymbol[j] = data[j + i];
             result[i + j] = data[i + j] ^ mapped[j];
          }
@@ -265,12 +455,13 @@ MarkovEncoder::encode(const bitSet& data)
             mapped = bitSet(mSymbolSize);
       }
 
-   else {
-      assign(result, data, 0, mSymbolSize);
-      for (size_t i = mSymbolSize; i < data.size(); i += mSymbolSize) {
+   else
+      for (size_t i = begin; i < end; i += mSymbolSize) {
          currentSymbol = slice(data, i, mSymbolSize);
 
-         if (currentSymbol != mapped)
+         // The first symbol and the restart points are literals, the decoder
+         // predicts the next symbol from them
+         if (isRestartPoint(i / mSymbolSize) || currentSymbol != mapped)
             assign(result, data, i, mSymbolSize, i);
          else
             assign(result, mUnusedSymbol, i, mSymbolSize);
@@ -280,28 +471,193 @@ MarkovEncoder::encode(const bitSet& data)
          else
             mapped.clear();
       }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// setCollectPredictionStats
+///////////////////////////////////////////////////////////////////////////////
+void
+MarkovEncoder::setCollectPredictionStats(bool collect)
+{
+   mCollectPredictionStats = collect;
+   if (collect) {
+      mPredictionStats = PredictionStats();
+      mContextStats.clear();
    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// getPredictionStats
+// The totals and the maxContexts contexts with the most misses
+///////////////////////////////////////////////////////////////////////////////
+MarkovEncoder::PredictionStats
+MarkovEncoder::getPredictionStats(size_t maxContexts) const
+{
+   PredictionStats result = mPredictionStats;
+   for (const auto& c : mContextStats) {
+      if (c.second.misses)
+         result.topMisses.push_back(c.second);
+   }
+
+   auto byMisses = [](const ContextStats& a, const ContextStats& b) {
+      return a.misses != b.misses ? a.misses > b.misses : a.context < b.context;
+   };
+   const size_t numContexts = std::min(maxContexts, result.topMisses.size());
+   std::partial_sort(result.topMisses.begin(),
+                     result.topMisses.begin() + numContexts,
+                     result.topMisses.end(),
+                     byMisses);
+   result.topMisses.resize(numContexts);
    return result;
 }
 
+///////////////////////////////////////////////////////////////////////////////
+// countPredictions
+// Mirrors encodeChunk: the first symbol and the restart points are literals,
+// every other symbol is predicted from the original previous symbol
+///////////////////////////////////////////////////////////////////////////////
+void
+MarkovEncoder::countPredictions(const bitSet& data)
+{
+   if (!isValid()) {
+      return;
+   }
+
+   const size_t numSymbols = data.size() / mSymbolSize;
+   const auto* blocks = getBlocks(data).data();
+   if (data.size() % mSymbolSize == 0 && mSymbolSize == 8)
+      countPredictions(numSymbols, [&](size_t i) { return getSymbol<uint8_t>(blocks, i); });
+   else if (data.size() % mSymbolSize == 0 && mSymbolSize == 16)
+      countPredictions(numSymbols, [&](size_t i) { return getSymbol<uint16_t>(blocks, i); });
+   else if (data.size() % mSymbolSize == 0 && mSymbolSize == 32)
+      countPredictions(numSymbols, [&](size_t i) { return getSymbol<uint32_t>(blocks, i); });
+   else
+      countPredictions(numSymbols, [&](size_t i) {
+         return slice(data, i * mSymbolSize, mSymbolSize).to_ulong();
+      });
+}
+
+template<typename F>
+void
+MarkovEncoder::countPredictions(size_t numSymbols, const F& symbolAt)
+{
+   // Contexts with a prediction, indexed densely up to 16 bit symbols
+   const uint32_t noContext = UINT32_MAX;
+   const bool dense = mSymbolSize <= 16;
+   std::vector<ContextStats> contexts;
+   std::vector<uint32_t> denseIndex(dense ? size_t(1) << mSymbolSize : 0, noContext);
+   boost::unordered_map<uint64_t, uint32_t> hashedIndex;
+
+   for (const auto& e : mEncodingMap) {
+      uint64_t context = e.first.to_ulong();
+      if (dense)
+         denseIndex[context] = contexts.size();
+      else
+         hashedIndex[context] = contexts.size();
+      contexts.push_back(ContextStats{ context, e.second.to_ulong(), 0, 0 });
+   }
+
+   auto findContext = [&](uint64_t context) {
+      if (dense)
+         return denseIndex[context];
+      auto it = hashedIndex.find(context);
+      return it != hashedIndex.end() ? it->second : noContext;
+   };
+
+   uint64_t previous = 0;
+   for (size_t i = 0; i < numSymbols; ++i) {
+      uint64_t symbol = symbolAt(i);
+      uint32_t c = isRestartPoint(i) ? noContext : findContext(previous);
+      if (c == noContext)
+         ++mPredictionStats.unpredicted;
+      else if (contexts[c].predicted == symbol)
+         ++contexts[c].hits;
+      else
+         ++contexts[c].misses;
+      previous = symbol;
+   }
+
+   for (const auto& c : contexts) {
+      if (!c.hits && !c.misses)
+         continue;
+      auto& total = mContextStats.emplace(c.context, ContextStats{ c.context, 0, 0, 0 })
+                      .first->second;
+      total.predicted = c.predicted; // the latest model
+      total.hits += c.hits;
+      total.misses += c.misses;
+      mPredictionStats.hits += c.hits;
+      mPredictionStats.misses += c.misses;
+   }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// isRestartPoint
+///////////////////////////////////////////////////////////////////////////////
+bool
+MarkovEncoder::isRestartPoint(size_t symbolIdx) const
+{
+   return symbolIdx == 0 || (mRestartInterval && symbolIdx % mRestartInterval == 0);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// setRestartInterval
+///////////////////////////////////////////////////////////////////////////////
+void
+MarkovEncoder::setRestartInterval(size_t interval)
+{
+   const size_t alignment = bitSet::bits_per_block;
+   mRestartInterval = (interval + alignment - 1) / alignment * alignment;
+   mEncodedStatistics.clear(); // The restart points are literals
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// getChunkSize
+// Symbols per chunk of a parallel encode, a multiple of alignment
+///////////////////////////////////////////////////////////////////////////////
+size_t
+MarkovEncoder::getChunkSize(size_t numSymbols, size_t alignment)
+{
+   size_t chunkSize = std::max(numSymbols / ThreadPool::getNumThreads() + 1, mMinChunkSymbols);
+   return (chunkSize + alignment - 1) / alignment * alignment;
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 // Decode data using the encoding map
+// The segments between restart points are decoded in parallel
 ///////////////////////////////////////////////////////////////////////////////
 bitSet
 MarkovEncoder::decode(const bitSet& data)
 {
    bitSet result(data.size());
 
-   if (!isValid()) {
+   if (!isValid() || data.empty()) {
       return result;
    }
 
+   const size_t numSymbols = (data.size() + mSymbolSize - 1) / mSymbolSize;
+   const size_t segmentSize = (mRestartInterval ? mRestartInterval : numSymbols) * mSymbolSize;
+   const size_t numSegments = (data.size() + segmentSize - 1) / segmentSize;
+
+   ThreadPool::parallelFor(numSegments, [&](size_t n) {
+      decodeSegment(data, result, n * segmentSize, std::min(data.size(), (n + 1) * segmentSize));
+   });
+
+   return result;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// decodeSegment
+// Decodes the bits [begin, end) of data into result, begin is a restart point
+///////////////////////////////////////////////////////////////////////////////
+void
+MarkovEncoder::decodeSegment(const bitSet& data, bitSet& result, size_t begin, size_t end) const
+{
    bitSet currentSymbol(mSymbolSize);
    bitSet mapped(mSymbolSize);
 
    if (!mUnusedSymbol.size())
-      for (size_t i = 0; i < data.size(); i += mSymbolSize) {
-         for (size_t j = 0; j < mSymbolSize && j + i < data.size(); ++j) {
+      for (size_t i = begin; i < end; i += mSymbolSize) {
+         for (size_t j = 0; j < mSymbolSize && j + i < end; ++j) {
             currentSymbol[j] = data[j + i] ^ mapped[j];
             result[i + j] = currentSymbol[j];
          }
@@ -313,11 +669,11 @@ MarkovEncoder::decode(const bitSet& data)
       }
 
    else
-      for (size_t i = 0; i < data.size(); i += mSymbolSize) {
+      for (size_t i = begin; i < end; i += mSymbolSize) {
 
          currentSymbol = slice(data, i, mSymbolSize);
 
-         if (i != 0 && currentSymbol == mUnusedSymbol)
+         if (i != begin && currentSymbol == mUnusedSymbol)
             currentSymbol = mapped;
 
          assign(result, currentSymbol, i, mSymbolSize);
@@ -327,8 +683,6 @@ MarkovEncoder::decode(const bitSet& data)
          else
             mapped = bitSet(mSymbolSize);
       }
-
-   return result;
 }
 
 ///////////////////////////////////////////////////////////////////////////////
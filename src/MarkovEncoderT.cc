@@ -0,0 +1,280 @@
+#define BOOST_DYNAMIC_BITSET_DONT_USE_FRIENDS
+
+#include "MarkovEncoderT.hh"
+#include "BinaryUtils.hh"
+#include "MarkovKernels.hh"
+#include "ThreadPool.hh"
+
+#include <algorithm>
+
+using namespace BinaryUtils;
+
+///////////////////////////////////////////////////////////////////////////////
+// MarkovEncoderT
+///////////////////////////////////////////////////////////////////////////////
+
+template<typename T>
+MarkovEncoderT<T>::MarkovEncoderT(const bitSet& data, double threshold)
+  : MarkovEncoder(sizeof(T) * 8, threshold)
+{
+   setup(data);
+}
+
+template<typename T>
+MarkovEncoderT<T>::MarkovEncoderT(double threshold)
+  : MarkovEncoder(sizeof(T) * 8, threshold)
+{}
+
+///////////////////////////////////////////////////////////////////////////////
+// MarkovEncoderT - from a deserialized MarkovEncoder
+///////////////////////////////////////////////////////////////////////////////
+
+template<typename T>
+MarkovEncoderT<T>::MarkovEncoderT(const MarkovEncoder& other)
+  : MarkovEncoder(other)
+{
+   buildPredictionTable();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Setup source data
+///////////////////////////////////////////////////////////////////////////////
+
+template<typename T>
+void
+MarkovEncoderT<T>::setup(const bitSet& sourceData)
+{
+   MarkovEncoder::setup(sourceData);
+   buildPredictionTable();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Reset encoder
+///////////////////////////////////////////////////////////////////////////////
+
+template<typename T>
+void
+MarkovEncoderT<T>::reset()
+{
+   MarkovEncoder::reset();
+   mPredictionTable.clear();
+   mPredictionMap.clear();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// buildPredictionTable
+///////////////////////////////////////////////////////////////////////////////
+
+template<typename T>
+void
+MarkovEncoderT<T>::buildPredictionTable()
+{
+   mPredictionTable.clear();
+   mPredictionMap.clear();
+   mNativeUnusedSymbol = mUnusedSymbol.size() ? T(mUnusedSymbol.to_ulong()) : 0;
+
+   if (sizeof(T) <= 2)
+      mPredictionTable.assign(size_t(1) << (sizeof(T) * 8), UINT32_MAX);
+
+   for (const auto& p : mEncodingMap) {
+      T symbol = p.first.to_ulong();
+      if (sizeof(T) <= 2)
+         mPredictionTable[symbol] = p.second.to_ulong();
+      else
+         mPredictionMap[symbol] = p.second.to_ulong();
+   }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// predict
+// Returns mNoPrediction if the symbol has no successor in the encoding map
+///////////////////////////////////////////////////////////////////////////////
+
+template<typename T>
+uint64_t
+MarkovEncoderT<T>::predict(T symbol) const
+{
+   if (sizeof(T) <= 2) {
+      uint32_t mapped = mPredictionTable[symbol];
+      return mapped == UINT32_MAX ? mNoPrediction : mapped;
+   }
+
+   auto it = mPredictionMap.find(symbol);
+   return it != mPredictionMap.end() ? it->second : mNoPrediction;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Encode data using the encoding map
+// Symbol i only depends on the original symbols i - 1 and i, the chunks are
+// encoded in parallel directly into the result
+///////////////////////////////////////////////////////////////////////////////
+
+template<typename T>
+bitSet
+MarkovEncoderT<T>::encode(const bitSet& data)
+{
+   if (!isValid()) {
+      return bitSet(data.size());
+   }
+   if (data.size() % mSymbolSize) {
+      return MarkovEncoder::encode(data);
+   }
+   if (mCollectPredictionStats) {
+      countPredictions(data);
+   }
+
+   const auto* input = getBlocks(data).data();
+   auto blocks = getBlocks(data);
+   auto* result = blocks.data();
+   const size_t numSymbols = data.size() / mSymbolSize;
+
+   // Chunks start at block boundaries, setSymbol never touches a block of another chunk
+   const size_t chunkSize = getChunkSize(numSymbols, bitSet::bits_per_block);
+   const size_t numChunks = (numSymbols + chunkSize - 1) / chunkSize;
+
+   ThreadPool::parallelFor(numChunks, [&](size_t n) {
+      encodeChunk(input,
+                  result,
+                  std::max<size_t>(n * chunkSize, 1),
+                  std::min(numSymbols, (n + 1) * chunkSize));
+   });
+
+   return fromBlocks(std::move(blocks), data.size());
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// encodeChunk
+// Encodes the symbols [begin, end) of input into result, begin > 0.
+// Restart points are left as they are, result starts as a copy of input.
+///////////////////////////////////////////////////////////////////////////////
+
+template<typename T>
+void
+MarkovEncoderT<T>::encodeChunk(const bitSet::block_type* input,
+                               bitSet::block_type* result,
+                               size_t begin,
+                               size_t end) const
+{
+   for (size_t i = begin; i < end;) {
+      size_t segmentEnd = end;
+      if (mRestartInterval)
+         segmentEnd = std::min(end, (i / mRestartInterval + 1) * mRestartInterval);
+      if (isRestartPoint(i))
+         ++i;
+
+      encodeRange(input, result, i, segmentEnd);
+      i = segmentEnd;
+   }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// encodeRange
+// Encodes the symbols [begin, end) of input into result without restart points
+///////////////////////////////////////////////////////////////////////////////
+
+template<typename T>
+void
+MarkovEncoderT<T>::encodeRange(const bitSet::block_type* input,
+                               bitSet::block_type* result,
+                               size_t begin,
+                               size_t end) const
+{
+   const auto mode =
+     mUnusedSymbol.size() ? MarkovKernels::Mode::UnusedSymbol : MarkovKernels::Mode::Xor;
+
+   if constexpr (sizeof(T) <= 2) {
+      MarkovKernels::encode<T>(
+        input, result, begin, end, mPredictionTable.data(), mNativeUnusedSymbol, mode);
+   }
+
+   else if (mode == MarkovKernels::Mode::Xor)
+      for (size_t i = begin; i < end; ++i) {
+         uint64_t mapped = predict(getSymbol<T>(input, i - 1));
+         T mask = mapped == mNoPrediction ? 0 : T(mapped);
+         setSymbol<T>(result, i, getSymbol<T>(input, i) ^ mask);
+      }
+
+   else
+      for (size_t i = begin; i < end; ++i) {
+         if (getSymbol<T>(input, i) == predict(getSymbol<T>(input, i - 1)))
+            setSymbol<T>(result, i, mNativeUnusedSymbol);
+      }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Decode data using the encoding map
+// The segments between restart points are decoded in parallel, in place
+///////////////////////////////////////////////////////////////////////////////
+
+template<typename T>
+bitSet
+MarkovEncoderT<T>::decode(const bitSet& data)
+{
+   bitSet result(data);
+   decodeInPlace(result);
+   return result;
+}
+
+template<typename T>
+void
+MarkovEncoderT<T>::decodeInPlace(bitSet& data)
+{
+   if (!isValid()) {
+      data = bitSet(data.size());
+      return;
+   }
+   if (data.size() % mSymbolSize) {
+      data = MarkovEncoder::decode(data);
+      return;
+   }
+
+   const size_t numBits = data.size();
+   auto blocks = takeBlocks(std::move(data));
+   auto* result = blocks.data();
+   const size_t numSymbols = numBits / mSymbolSize;
+   const size_t segmentSize = mRestartInterval ? mRestartInterval : numSymbols;
+   const size_t numSegments = numSymbols ? (numSymbols + segmentSize - 1) / segmentSize : 0;
+
+   ThreadPool::parallelFor(numSegments, [&](size_t n) {
+      decodeRange(result, n * segmentSize + 1, std::min(numSymbols, (n + 1) * segmentSize));
+   });
+
+   data = fromBlocks(std::move(blocks), numBits);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// decodeRange
+// Decodes the symbols [begin, end) in place, symbol begin - 1 is decoded
+///////////////////////////////////////////////////////////////////////////////
+
+template<typename T>
+void
+MarkovEncoderT<T>::decodeRange(bitSet::block_type* result, size_t begin, size_t end) const
+{
+   const auto mode =
+     mUnusedSymbol.size() ? MarkovKernels::Mode::UnusedSymbol : MarkovKernels::Mode::Xor;
+
+   if constexpr (sizeof(T) <= 2) {
+      MarkovKernels::decode<T>(
+        result, begin, end, mPredictionTable.data(), mNativeUnusedSymbol, mode);
+   }
+
+   else if (mode == MarkovKernels::Mode::Xor)
+      for (size_t i = begin; i < end; ++i) {
+         uint64_t mapped = predict(getSymbol<T>(result, i - 1));
+         T mask = mapped == mNoPrediction ? 0 : T(mapped);
+         setSymbol<T>(result, i, getSymbol<T>(result, i) ^ mask);
+      }
+
+   else
+      for (size_t i = begin; i < end; ++i) {
+         if (getSymbol<T>(result, i) == mNativeUnusedSymbol) {
+            uint64_t mapped = predict(getSymbol<T>(result, i - 1));
+            setSymbol<T>(result, i, mapped == mNoPrediction ? 0 : T(mapped));
+         }
+      }
+}
+
+template class MarkovEncoderT<uint8_t>;
+template class MarkovEncoderT<uint16_t>;
+template class MarkovEncoderT<uint32_t>;
@@ -0,0 +1,230 @@
+#include "MarkovKernels.hh"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define MARKOV_KERNELS_AVX2
+#endif
+
+using namespace BinaryUtils;
+
+namespace MarkovKernels {
+
+static constexpr uint32_t mNoPrediction = UINT32_MAX;
+
+// The blocks of a bitSet are accessed as arrays of symbols
+template<typename T>
+struct Aliased;
+
+template<>
+struct Aliased<uint8_t>
+{
+   typedef uint8_t __attribute__((__may_alias__)) type;
+};
+
+template<>
+struct Aliased<uint16_t>
+{
+   typedef uint16_t __attribute__((__may_alias__)) type;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Scalar kernels
+///////////////////////////////////////////////////////////////////////////////
+
+template<typename T>
+static void
+encodeScalar(const typename Aliased<T>::type* input,
+             typename Aliased<T>::type* output,
+             size_t begin,
+             size_t end,
+             const uint32_t* predictionTable,
+             T unusedSymbol,
+             Mode mode)
+{
+   if (mode == Mode::Xor)
+      for (size_t i = begin; i < end; ++i) {
+         uint32_t predicted = predictionTable[input[i - 1]];
+         output[i] = input[i] ^ (predicted == mNoPrediction ? 0 : predicted);
+      }
+
+   else
+      for (size_t i = begin; i < end; ++i) {
+         uint32_t predicted = predictionTable[input[i - 1]];
+         output[i] = input[i] == predicted ? unusedSymbol : input[i];
+      }
+}
+
+template<typename T>
+static void
+decodeScalar(typename Aliased<T>::type* data,
+             size_t begin,
+             size_t end,
+             const uint32_t* predictionTable,
+             T unusedSymbol,
+             Mode mode)
+{
+   // The selects compile to conditional moves, the only branch is the loop
+   uint32_t previous = data[begin - 1];
+   for (size_t i = begin; i < end; ++i) {
+      uint32_t predicted = predictionTable[previous];
+      predicted = predicted == mNoPrediction ? 0 : predicted;
+
+      uint32_t symbol = data[i];
+      if (mode == Mode::Xor)
+         symbol ^= predicted;
+      else
+         symbol = symbol == unusedSymbol ? predicted : symbol;
+
+      data[i] = T(symbol);
+      previous = T(symbol);
+   }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// AVX2 kernels
+// 8 symbols per step, widened to 32 bit for the gather from the prediction
+// table and narrowed again for the store.
+///////////////////////////////////////////////////////////////////////////////
+
+#ifdef MARKOV_KERNELS_AVX2
+
+template<typename T>
+static __m256i
+load8(const typename Aliased<T>::type* p);
+
+template<typename T>
+static void
+store8(typename Aliased<T>::type* p, __m256i v);
+
+template<>
+__attribute__((target("avx2"))) __m256i
+load8<uint8_t>(const Aliased<uint8_t>::type* p)
+{
+   return _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(p)));
+}
+
+template<>
+__attribute__((target("avx2"))) __m256i
+load8<uint16_t>(const Aliased<uint16_t>::type* p)
+{
+   return _mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p)));
+}
+
+template<>
+__attribute__((target("avx2"))) void
+store8<uint8_t>(Aliased<uint8_t>::type* p, __m256i v)
+{
+   __m128i packed = _mm_packus_epi32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+   _mm_storel_epi64(reinterpret_cast<__m128i*>(p), _mm_packus_epi16(packed, packed));
+}
+
+template<>
+__attribute__((target("avx2"))) void
+store8<uint16_t>(Aliased<uint16_t>::type* p, __m256i v)
+{
+   __m128i packed = _mm_packus_epi32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+   _mm_storeu_si128(reinterpret_cast<__m128i*>(p), packed);
+}
+
+template<typename T>
+__attribute__((target("avx2"))) static void
+encodeAvx2(const typename Aliased<T>::type* input,
+           typename Aliased<T>::type* output,
+           size_t begin,
+           size_t end,
+           const uint32_t* predictionTable,
+           T unusedSymbol,
+           Mode mode)
+{
+   const __m256i noPrediction = _mm256_set1_epi32(-1);
+   const __m256i unused = _mm256_set1_epi32(unusedSymbol);
+   const int* table = reinterpret_cast<const int*>(predictionTable);
+
+   size_t i = begin;
+   for (; i + 8 <= end; i += 8) {
+      __m256i previous = load8<T>(input + i - 1);
+      __m256i current = load8<T>(input + i);
+      __m256i predicted = _mm256_i32gather_epi32(table, previous, 4);
+
+      __m256i result;
+      if (mode == Mode::Xor) {
+         __m256i mask = _mm256_andnot_si256(_mm256_cmpeq_epi32(predicted, noPrediction), predicted);
+         result = _mm256_xor_si256(current, mask);
+      } else {
+         result = _mm256_blendv_epi8(current, unused, _mm256_cmpeq_epi32(current, predicted));
+      }
+      store8<T>(output + i, result);
+   }
+
+   encodeScalar<T>(input, output, i, end, predictionTable, unusedSymbol, mode);
+}
+
+#endif // MARKOV_KERNELS_AVX2
+
+///////////////////////////////////////////////////////////////////////////////
+// encode / decode
+///////////////////////////////////////////////////////////////////////////////
+
+template<typename T>
+void
+encode(const bitSet::block_type* input,
+       bitSet::block_type* output,
+       size_t begin,
+       size_t end,
+       const uint32_t* predictionTable,
+       T unusedSymbol,
+       Mode mode)
+{
+   auto* in = reinterpret_cast<const typename Aliased<T>::type*>(input);
+   auto* out = reinterpret_cast<typename Aliased<T>::type*>(output);
+
+#ifdef MARKOV_KERNELS_AVX2
+   static const bool hasAvx2 = __builtin_cpu_supports("avx2");
+   if (hasAvx2) {
+      encodeAvx2<T>(in, out, begin, end, predictionTable, unusedSymbol, mode);
+      return;
+   }
+#endif
+
+   encodeScalar<T>(in, out, begin, end, predictionTable, unusedSymbol, mode);
+}
+
+template<typename T>
+void
+decode(bitSet::block_type* data,
+       size_t begin,
+       size_t end,
+       const uint32_t* predictionTable,
+       T unusedSymbol,
+       Mode mode)
+{
+   decodeScalar<T>(reinterpret_cast<typename Aliased<T>::type*>(data),
+                   begin,
+                   end,
+                   predictionTable,
+                   unusedSymbol,
+                   mode);
+}
+
+template void
+encode<uint8_t>(const bitSet::block_type*,
+                bitSet::block_type*,
+                size_t,
+                size_t,
+                const uint32_t*,
+                uint8_t,
+                Mode);
+template void
+encode<uint16_t>(const bitSet::block_type*,
+                 bitSet::block_type*,
+                 size_t,
+                 size_t,
+                 const uint32_t*,
+                 uint16_t,
+                 Mode);
+template void
+decode<uint8_t>(bitSet::block_type*, size_t, size_t, const uint32_t*, uint8_t, Mode);
+template void
+decode<uint16_t>(bitSet::block_type*, size_t, size_t, const uint32_t*, uint16_t, Mode);
+
+} // namespace MarkovKernels
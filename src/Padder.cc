@@ -92,39 +92,60 @@ Padder::deserializerFactory(const bitSet& data)
 }
 
 ///////////////////////////////////////////////////////////////////////////////
-// Encode data using the encoding chain
+// getPaddingSize
+// Number of zero bits appended to data of numBits bits
 ///////////////////////////////////////////////////////////////////////////////
-bitSet
-Padder::encode(const bitSet& data)
-{
-   bitSet result(data);
-   if (!isValid()) {
-      result.clear();
-      return result;
-   }
 
-   bitSet padding;
+size_t
+Padder::getPaddingSize(size_t numBits) const
+{
+   size_t padding = 0;
    switch (mPaddingMode) {
       case WholeBytes:
-         padding = result.size() % 8 ? convertToBitSet(0, 8 - result.size() % 8) : bitSet();
+         padding = numBits % 8 ? 8 - numBits % 8 : 0;
          break;
       case EvenBytes:
-         padding = result.size() % 16 ? convertToBitSet(0, 16 - result.size() % 16) : bitSet();
+         padding = numBits % 16 ? 16 - numBits % 16 : 0;
          break;
       case OddBytes:
-         padding = result.size() % 8 ? convertToBitSet(0, 8 - result.size() % 8) : bitSet();
-         padding =
-           (result.size() + padding.size()) % 16 ? padding : convertToBitSet(0, padding.size() + 8);
+         padding = numBits % 8 ? 8 - numBits % 8 : 0;
+         padding = (numBits + padding) % 16 ? padding : padding + 8;
          break;
       default:
          break;
    }
-   append(result, padding);
-   mAddedBits = result.size() - data.size();
+   return padding;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Encode data using the encoding chain
+// The copy reserves the padding, so appending it does not reallocate
+///////////////////////////////////////////////////////////////////////////////
+bitSet
+Padder::encode(const bitSet& data)
+{
+   if (!isValid())
+      return bitSet();
 
+   bitSet result;
+   result.reserve(data.size() + getPaddingSize(data.size()));
+   result = data;
+   encodeInPlace(result);
    return result;
 }
 
+void
+Padder::encodeInPlace(bitSet& data)
+{
+   if (!isValid()) {
+      data.clear();
+      return;
+   }
+
+   mAddedBits = getPaddingSize(data.size());
+   data.resize(data.size() + mAddedBits);
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 // Decode data using the encoding chain
 ///////////////////////////////////////////////////////////////////////////////
@@ -137,6 +158,17 @@ Padder::decode(const bitSet& data)
    return slice(data, 0, data.size() - mAddedBits);
 }
 
+void
+Padder::decodeInPlace(bitSet& data)
+{
+   if (!isValid() || data.size() < mAddedBits) {
+      data.clear();
+      return;
+   }
+
+   data.resize(data.size() - mAddedBits);
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 // Decode data using the encoding map
 //////////////////////////////////////////////////////////////////////////////
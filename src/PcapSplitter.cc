@@ -0,0 +1,211 @@
+#define BOOST_DYNAMIC_BITSET_DONT_USE_FRIENDS
+
+#include "PcapSplitter.hh"
+#include "BinaryUtils.hh"
+
+#include <stdexcept>
+
+using namespace BinaryUtils;
+
+#define LINKTYPE_ETHERNET 1
+#define LINKTYPE_RAW 101
+#define ETHERTYPE_IPV4 0x0800
+#define ETHERTYPE_VLAN 0x8100
+#define IP_PROTOCOL_UDP 17
+
+///////////////////////////////////////////////////////////////////////////////
+// readMagic
+// Accepts microsecond and nanosecond captures in both byte orders
+///////////////////////////////////////////////////////////////////////////////
+
+bool
+PcapSplitter::readMagic(const uint8_t* header, bool& bigEndian)
+{
+   uint32_t magic = readUint32(header, false);
+   if (magic == 0xa1b2c3d4 || magic == 0xa1b23c4d) {
+      bigEndian = false;
+      return true;
+   }
+   if (magic == 0xd4c3b2a1 || magic == 0x4d3cb2a1) {
+      bigEndian = true;
+      return true;
+   }
+   return false;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// readUint32
+///////////////////////////////////////////////////////////////////////////////
+
+uint32_t
+PcapSplitter::readUint32(const uint8_t* p, bool bigEndian)
+{
+   if (bigEndian)
+      return uint32_t(p[0]) << 24 | uint32_t(p[1]) << 16 | uint32_t(p[2]) << 8 | p[3];
+   return uint32_t(p[3]) << 24 | uint32_t(p[2]) << 16 | uint32_t(p[1]) << 8 | p[0];
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// protocolHeaderLength
+// Length of the link/IP/UDP headers of a packet.
+// Every decision only reads bytes that were already accepted as header, so
+// merge() can replay it on the header substream without seeing the payload.
+// available: number of readable bytes (bounds check for corrupted input)
+///////////////////////////////////////////////////////////////////////////////
+
+size_t
+PcapSplitter::protocolHeaderLength(const uint8_t* packet,
+                                   size_t inclLen,
+                                   uint32_t linkType,
+                                   size_t available)
+{
+   size_t length = 0;
+   uint16_t etherType = 0;
+
+   auto accept = [&](size_t newLength) {
+      if (newLength > available)
+         throw std::runtime_error("Truncated protocol header substream!");
+      length = newLength;
+   };
+
+   if (linkType == LINKTYPE_ETHERNET && inclLen >= 14) {
+      accept(14);
+      etherType = packet[12] << 8 | packet[13];
+      if (etherType == ETHERTYPE_VLAN && inclLen >= 18) {
+         accept(18);
+         etherType = packet[16] << 8 | packet[17];
+      }
+   } else if (linkType == LINKTYPE_RAW) {
+      etherType = ETHERTYPE_IPV4;
+   }
+
+   if (etherType != ETHERTYPE_IPV4 || inclLen < length + 20)
+      return length;
+
+   size_t ipStart = length;
+   accept(ipStart + 20);
+   size_t ipHeaderLength = (packet[ipStart] & 0x0F) * 4;
+   if (ipHeaderLength > 20 && inclLen >= ipStart + ipHeaderLength)
+      accept(ipStart + ipHeaderLength);
+   else if (ipHeaderLength != 20)
+      return length;
+
+   if (packet[ipStart + 9] == IP_PROTOCOL_UDP && inclLen >= length + 8)
+      accept(length + 8);
+
+   return length;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// isPcap
+///////////////////////////////////////////////////////////////////////////////
+
+bool
+PcapSplitter::isPcap(const bitSet& data)
+{
+   if (data.size() < mGlobalHeaderSize * 8)
+      return false;
+
+   bool bigEndian;
+   auto header = toBytes(slice(data, 0, mGlobalHeaderSize * 8));
+   return readMagic(header.data(), bigEndian);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// split
+// Separates a capture into the substreams listed in PcapSplitter::Substream.
+// Bytes after the last complete record are appended to the payloads.
+///////////////////////////////////////////////////////////////////////////////
+
+std::vector<bitSet>
+PcapSplitter::split(const bitSet& data)
+{
+   auto bytes = toBytes(data);
+   bool bigEndian;
+
+   if (bytes.size() < mGlobalHeaderSize || !readMagic(bytes.data(), bigEndian)) {
+      throw std::runtime_error("Not a pcap capture!");
+   }
+
+   uint32_t linkType = readUint32(&bytes[20], bigEndian);
+   std::vector<std::vector<uint8_t>> streams(NumSubstreams);
+   streams[GlobalHeader].assign(bytes.begin(), bytes.begin() + mGlobalHeaderSize);
+
+   size_t idx = mGlobalHeaderSize;
+   while (idx + mRecordHeaderSize <= bytes.size()) {
+      size_t inclLen = readUint32(&bytes[idx + 8], bigEndian);
+      if (idx + mRecordHeaderSize + inclLen > bytes.size())
+         break;
+
+      auto record = bytes.begin() + idx;
+      auto packet = record + mRecordHeaderSize;
+      size_t headerLength = protocolHeaderLength(
+        bytes.data() + idx + mRecordHeaderSize, inclLen, linkType, inclLen);
+
+      streams[RecordHeaders].insert(streams[RecordHeaders].end(), record, packet);
+      streams[ProtocolHeaders].insert(
+        streams[ProtocolHeaders].end(), packet, packet + headerLength);
+      streams[Payloads].insert(streams[Payloads].end(), packet + headerLength, packet + inclLen);
+      idx += mRecordHeaderSize + inclLen;
+   }
+   streams[Payloads].insert(streams[Payloads].end(), bytes.begin() + idx, bytes.end());
+
+   std::vector<bitSet> result;
+   for (const auto& s : streams)
+      result.push_back(fromBytes(s));
+   return result;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// merge
+// Reassembles the original capture from the output of split()
+///////////////////////////////////////////////////////////////////////////////
+
+bitSet
+PcapSplitter::merge(const std::vector<bitSet>& substreams)
+{
+   if (substreams.size() != NumSubstreams) {
+      throw std::runtime_error("Incorrect number of pcap substreams!");
+   }
+
+   auto result = toBytes(substreams[GlobalHeader]);
+   auto records = toBytes(substreams[RecordHeaders]);
+   auto headers = toBytes(substreams[ProtocolHeaders]);
+   auto payloads = toBytes(substreams[Payloads]);
+   bool bigEndian;
+
+   if (result.size() != mGlobalHeaderSize || !readMagic(result.data(), bigEndian) ||
+       records.size() % mRecordHeaderSize) {
+      throw std::runtime_error("Invalid pcap substreams!");
+   }
+
+   uint32_t linkType = readUint32(&result[20], bigEndian);
+   result.reserve(result.size() + records.size() + headers.size() + payloads.size());
+
+   size_t headerIdx = 0;
+   size_t payloadIdx = 0;
+   for (size_t i = 0; i < records.size(); i += mRecordHeaderSize) {
+      size_t inclLen = readUint32(&records[i + 8], bigEndian);
+      size_t headerLength = protocolHeaderLength(
+        headers.data() + headerIdx, inclLen, linkType, headers.size() - headerIdx);
+
+      if (payloadIdx + inclLen - headerLength > payloads.size())
+         throw std::runtime_error("Truncated payload substream!");
+
+      result.insert(result.end(), records.begin() + i, records.begin() + i + mRecordHeaderSize);
+      result.insert(result.end(),
+                    headers.begin() + headerIdx,
+                    headers.begin() + headerIdx + headerLength);
+      result.insert(result.end(),
+                    payloads.begin() + payloadIdx,
+                    payloads.begin() + payloadIdx + inclLen - headerLength);
+      headerIdx += headerLength;
+      payloadIdx += inclLen - headerLength;
+   }
+
+   if (headerIdx != headers.size())
+      throw std::runtime_error("Unused protocol headers in the pcap substreams!");
+
+   result.insert(result.end(), payloads.begin() + payloadIdx, payloads.end());
+   return fromBytes(result);
+}
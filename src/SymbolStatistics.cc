@@ -0,0 +1,440 @@
+#define BOOST_DYNAMIC_BITSET_DONT_USE_FRIENDS
+
+#include "SymbolStatistics.hh"
+#include "ThreadPool.hh"
+
+#include <algorithm>
+#include <cmath>
+
+using namespace BinaryUtils;
+
+///////////////////////////////////////////////////////////////////////////////
+// SymbolStatistics
+///////////////////////////////////////////////////////////////////////////////
+
+SymbolStatistics::SymbolStatistics(const bitSet& data,
+                                   size_t symbolSize,
+                                   bool withTransitions,
+                                   size_t maxTransitionBytes)
+  : mSymbolSize(symbolSize)
+  , mNumSymbols(0)
+  , mLastSymbol(0)
+  , mNumShards(1)
+{
+   if (!isSupported(data, symbolSize)) {
+      throw std::runtime_error("Unsupported symbol size for the statistics!");
+   }
+   if (withTransitions && maxTransitionBytes) {
+      mTransitionSketch = std::make_shared<TransitionSketch>(symbolSize, maxTransitionBytes);
+   }
+
+   const auto* blocks = getBlocks(data).data();
+   const size_t numBlocks = getBlocks(data).size();
+   mNumSymbols = data.size() / symbolSize;
+
+   switch (symbolSize) {
+      case 8:
+         count([&](size_t i) { return getSymbol<uint8_t>(blocks, i); }, withTransitions);
+         break;
+      case 16:
+         count([&](size_t i) { return getSymbol<uint16_t>(blocks, i); }, withTransitions);
+         break;
+      case 32:
+         count([&](size_t i) { return getSymbol<uint32_t>(blocks, i); }, withTransitions);
+         break;
+      default:
+         // Symbols may span two blocks
+         count(
+           [&](size_t i) {
+              size_t pos = i * symbolSize;
+              uint64_t symbol = blocks[pos / 64] >> (pos % 64);
+              if (pos % 64 + symbolSize > 64 && pos / 64 + 1 < numBlocks)
+                 symbol |= blocks[pos / 64 + 1] << (64 - pos % 64);
+              return symbol & ((uint64_t(1) << symbolSize) - 1);
+           },
+           withTransitions);
+   }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// isSupported
+///////////////////////////////////////////////////////////////////////////////
+
+bool
+SymbolStatistics::isSupported(const bitSet& data, size_t symbolSize)
+{
+   return symbolSize && symbolSize <= 32 && data.size() % symbolSize == 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// count
+// Large inputs are split into one chunk per thread, every chunk is counted
+// into its own tables and seeded with the symbol before it, so that the
+// transitions across the chunk boundaries are counted once. The sketch
+// depends on the order of the transitions and is filled in a single pass.
+///////////////////////////////////////////////////////////////////////////////
+
+template<typename F>
+void
+SymbolStatistics::count(const F& symbolAt, bool withTransitions)
+{
+   withTransitions = withTransitions && mNumSymbols > 1;
+   mLastSymbol = mNumSymbols ? symbolAt(mNumSymbols - 1) : 0;
+
+   size_t numChunks = 1;
+   if (!mTransitionSketch) {
+      numChunks = std::min<size_t>(ThreadPool::getNumThreads(), mNumSymbols / mMinChunkSymbols);
+      numChunks = std::max<size_t>(numChunks, 1);
+   }
+   mNumShards = numChunks;
+
+   if (numChunks == 1) {
+      countChunk(symbolAt, 0, mNumSymbols, withTransitions, mTables);
+      return;
+   }
+
+   std::vector<Tables> partial(numChunks);
+   const size_t chunkSize = (mNumSymbols + numChunks - 1) / numChunks;
+   ThreadPool::parallelFor(numChunks, [&](size_t n) {
+      countChunk(symbolAt,
+                 n * chunkSize,
+                 std::min(mNumSymbols, (n + 1) * chunkSize),
+                 withTransitions,
+                 partial[n]);
+   });
+   merge(partial);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// countChunk
+// The single pass over the symbols [begin, end)
+///////////////////////////////////////////////////////////////////////////////
+
+template<typename F>
+void
+SymbolStatistics::countChunk(const F& symbolAt,
+                             size_t begin,
+                             size_t end,
+                             bool withTransitions,
+                             Tables& tables)
+{
+   const bool denseCounts = mSymbolSize <= mMaxDenseCounts;
+   const bool denseTransitions = mSymbolSize <= mMaxDenseTransitions;
+   const bool sketch = mTransitionSketch != nullptr;
+
+   if (mSymbolSize <= mMaxPresenceBitmap)
+      tables.present.assign(((size_t(1) << mSymbolSize) + 63) / 64, 0);
+   if (denseCounts)
+      tables.counts.assign(size_t(1) << mSymbolSize, 0);
+   else
+      tables.countMaps.resize(mNumShards);
+   if (withTransitions && !sketch) {
+      if (denseTransitions)
+         tables.transitions.assign(size_t(1) << (2 * mSymbolSize), 0);
+      else
+         tables.transitionMaps.resize(mNumShards);
+   }
+
+   uint64_t previous = begin ? symbolAt(begin - 1) : 0;
+   for (size_t i = begin; i < end; ++i) {
+      uint64_t symbol = symbolAt(i);
+
+      if (!tables.present.empty())
+         tables.present[symbol / 64] |= uint64_t(1) << (symbol % 64);
+
+      if (denseCounts)
+         ++tables.counts[symbol];
+      else
+         ++tables.countMaps[getShard(symbol)][symbol];
+
+      if (withTransitions && i) {
+         uint64_t transition = previous << mSymbolSize | symbol;
+         if (sketch)
+            mTransitionSketch->add(previous, symbol);
+         else if (denseTransitions)
+            ++tables.transitions[transition];
+         else
+            ++tables.transitionMaps[getShard(previous)][transition];
+      }
+      previous = symbol;
+   }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// merge
+// Sums the counts of the chunks into mTables. The dense tables are merged by
+// index ranges, the hashed ones shard by shard, both in parallel.
+///////////////////////////////////////////////////////////////////////////////
+
+void
+SymbolStatistics::merge(std::vector<Tables>& partial)
+{
+   mTables = std::move(partial[0]);
+   auto& present = mTables.present;
+   auto& counts = mTables.counts;
+   auto& transitions = mTables.transitions;
+   const size_t numDense = std::max({ present.size(), counts.size(), transitions.size() });
+
+   ThreadPool::parallelFor(numDense, [&](size_t i) {
+      for (size_t n = 1; n < partial.size(); ++n) {
+         if (i < present.size())
+            present[i] |= partial[n].present[i];
+         if (i < counts.size())
+            counts[i] += partial[n].counts[i];
+         if (i < transitions.size())
+            transitions[i] += partial[n].transitions[i];
+      }
+   });
+
+   ThreadPool::parallelFor(mNumShards, [&](size_t s) {
+      for (size_t n = 1; n < partial.size(); ++n) {
+         if (!mTables.countMaps.empty()) {
+            for (const auto& c : partial[n].countMaps[s])
+               mTables.countMaps[s][c.first] += c.second;
+            CountMap().swap(partial[n].countMaps[s]);
+         }
+         if (!mTables.transitionMaps.empty()) {
+            for (const auto& t : partial[n].transitionMaps[s])
+               mTables.transitionMaps[s][t.first] += t.second;
+            CountMap().swap(partial[n].transitionMaps[s]);
+         }
+      }
+   });
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// getShard
+// Fibonacci hashing, consecutive symbols land in different shards
+///////////////////////////////////////////////////////////////////////////////
+
+size_t
+SymbolStatistics::getShard(uint64_t key) const
+{
+   if (mNumShards == 1)
+      return 0;
+   return ((key * 0x9e3779b97f4a7c15ULL) >> 32) % mNumShards;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// getCount
+///////////////////////////////////////////////////////////////////////////////
+
+uint64_t
+SymbolStatistics::getCount(uint64_t symbol) const
+{
+   if (!mTables.counts.empty())
+      return symbol < mTables.counts.size() ? mTables.counts[symbol] : 0;
+
+   const auto& countMap = mTables.countMaps[getShard(symbol)];
+   auto it = countMap.find(symbol);
+   return it != countMap.end() ? it->second : 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// isPresent
+///////////////////////////////////////////////////////////////////////////////
+
+bool
+SymbolStatistics::isPresent(uint64_t symbol) const
+{
+   const auto& present = mTables.present;
+   if (!present.empty())
+      return symbol / 64 < present.size() && (present[symbol / 64] >> (symbol % 64) & 1);
+   return getCount(symbol);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// findUnusedSymbol
+// Scans the presence bitmap from the top, 64 symbols at a time
+///////////////////////////////////////////////////////////////////////////////
+
+bool
+SymbolStatistics::findUnusedSymbol(uint64_t& symbol) const
+{
+   const uint64_t maxSymbol = (uint64_t(1) << mSymbolSize) - 1;
+   const auto& present = mTables.present;
+
+   if (present.empty()) {
+      // Sparse alphabet, at most as many symbols as are present are skipped
+      for (uint64_t s = maxSymbol;; --s) {
+         if (!getCount(s)) {
+            symbol = s;
+            return true;
+         }
+         if (s == 0)
+            return false;
+      }
+   }
+
+   for (size_t w = present.size(); w-- > 0;) {
+      uint64_t unused = ~present[w];
+      if (w == present.size() - 1 && (maxSymbol + 1) % 64)
+         unused &= (uint64_t(1) << ((maxSymbol + 1) % 64)) - 1;
+      if (unused) {
+         symbol = w * 64 + 63 - __builtin_clzll(unused);
+         return true;
+      }
+   }
+   return false;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// getEntropy
+///////////////////////////////////////////////////////////////////////////////
+
+double
+SymbolStatistics::getEntropy() const
+{
+   double result = 0;
+   for (const auto& c : getCounts()) {
+      double p = double(c.second) / mNumSymbols;
+      result -= p * std::log2(p);
+   }
+   return result;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// getConditionalEntropy
+// H(X_i | X_i-1) over the mNumSymbols - 1 transitions
+///////////////////////////////////////////////////////////////////////////////
+
+double
+SymbolStatistics::getConditionalEntropy() const
+{
+   if (mTransitionSketch) {
+      throw std::runtime_error("The conditional entropy needs the exact transitions!");
+   }
+   if (mNumSymbols < 2)
+      return 0;
+
+   double result = 0;
+   auto add = [&](uint64_t transition, uint64_t count) {
+      uint64_t previous = transition >> mSymbolSize;
+      uint64_t sum = getCount(previous) - (previous == mLastSymbol ? 1 : 0);
+      result -= count * std::log2(double(count) / sum);
+   };
+
+   for (size_t t = 0; t < mTables.transitions.size(); ++t) {
+      if (mTables.transitions[t])
+         add(t, mTables.transitions[t]);
+   }
+   for (const auto& shard : mTables.transitionMaps) {
+      for (const auto& t : shard)
+         add(t.first, t.second);
+   }
+
+   return result / (mNumSymbols - 1);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// getCounts
+///////////////////////////////////////////////////////////////////////////////
+
+std::vector<std::pair<uint64_t, uint64_t>>
+SymbolStatistics::getCounts() const
+{
+   std::vector<std::pair<uint64_t, uint64_t>> result;
+   if (!mTables.counts.empty()) {
+      for (size_t s = 0; s < mTables.counts.size(); ++s) {
+         if (mTables.counts[s])
+            result.emplace_back(s, mTables.counts[s]);
+      }
+   } else {
+      for (const auto& shard : mTables.countMaps)
+         result.insert(result.end(), shard.begin(), shard.end());
+      std::sort(result.begin(), result.end());
+   }
+   return result;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// getProbabilities
+///////////////////////////////////////////////////////////////////////////////
+
+CodeProbabilityMap
+SymbolStatistics::getProbabilities(size_t maxSymbols) const
+{
+   auto counts = getCounts();
+   if (maxSymbols && counts.size() > maxSymbols) {
+      auto moreFrequent = [](const auto& a, const auto& b) {
+         return a.second > b.second || (a.second == b.second && a.first < b.first);
+      };
+      std::partial_sort(counts.begin(), counts.begin() + maxSymbols, counts.end(), moreFrequent);
+      counts.resize(maxSymbols);
+      std::sort(counts.begin(), counts.end());
+   }
+
+   CodeProbabilityMap result;
+   for (const auto& c : counts)
+      result[convertToBitSet(c.first, mSymbolSize)] = double(c.second) / mNumSymbols;
+   return result;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// getPredictions
+// The most frequent successors are searched per context of the dense table
+// or per shard of the hashed one in parallel. Ties are resolved towards the
+// smaller successor.
+///////////////////////////////////////////////////////////////////////////////
+
+boost::unordered_map<uint64_t, SymbolStatistics::Prediction>
+SymbolStatistics::getPredictions(double threshold) const
+{
+   boost::unordered_map<uint64_t, Prediction> result;
+   if (mTransitionSketch) {
+      for (const auto& c : mTransitionSketch->getCandidates()) {
+         if (double(c.count) / c.total > threshold)
+            result.emplace(c.context, Prediction{ c.next, c.count });
+      }
+      return result;
+   }
+
+   // Every occurrence except the last one is followed by a transition
+   auto isPredictable = [&](uint64_t previous, const Prediction& p) {
+      uint64_t sum = getCount(previous) - (previous == mLastSymbol ? 1 : 0);
+      return double(p.count) / sum > threshold;
+   };
+
+   if (!mTables.transitions.empty()) {
+      const size_t numContexts = size_t(1) << mSymbolSize;
+      std::vector<Prediction> best(numContexts, Prediction{ 0, 0 });
+      ThreadPool::parallelFor(numContexts, [&](size_t previous) {
+         const uint64_t* row = &mTables.transitions[previous << mSymbolSize];
+         for (size_t next = 0; next < numContexts; ++next) {
+            if (row[next] > best[previous].count)
+               best[previous] = Prediction{ next, row[next] };
+         }
+      });
+
+      for (size_t previous = 0; previous < numContexts; ++previous) {
+         if (best[previous].count && isPredictable(previous, best[previous]))
+            result.emplace(previous, best[previous]);
+      }
+      return result;
+   }
+
+   const uint64_t mask = (uint64_t(1) << mSymbolSize) - 1;
+   std::vector<std::vector<std::pair<uint64_t, Prediction>>> shards(mTables.transitionMaps.size());
+   ThreadPool::parallelFor(shards.size(), [&](size_t s) {
+      boost::unordered_map<uint64_t, Prediction> best;
+      for (const auto& t : mTables.transitionMaps[s]) {
+         uint64_t previous = t.first >> mSymbolSize;
+         uint64_t next = t.first & mask;
+         auto it = best.find(previous);
+         if (it == best.end())
+            best.emplace(previous, Prediction{ next, t.second });
+         else if (t.second > it->second.count ||
+                  (t.second == it->second.count && next < it->second.next))
+            it->second = Prediction{ next, t.second };
+      }
+
+      for (const auto& b : best) {
+         if (isPredictable(b.first, b.second))
+            shards[s].push_back(b);
+      }
+   });
+
+   for (const auto& shard : shards)
+      result.insert(shard.begin(), shard.end());
+   return result;
+}
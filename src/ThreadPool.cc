@@ -0,0 +1,243 @@
+#include "ThreadPool.hh"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <pthread.h>
+#include <sched.h>
+#include <stdexcept>
+#include <thread>
+
+namespace ThreadPool {
+
+// A parallel loop, shared by the caller and its helpers. Helpers that start
+// after the last range was taken leave without touching the body.
+struct Loop
+{
+   const std::function<void(size_t, size_t)>* body;
+   size_t n;
+   size_t grain;
+   std::atomic<size_t> next{ 0 };
+   std::atomic<size_t> done{ 0 };
+   std::mutex mutex;
+   std::condition_variable finished;
+   std::exception_ptr error;
+};
+
+static thread_local bool sInLoop = false;
+
+static std::mutex sMutex; // configuration, queue and workers
+static std::condition_variable sWork;
+static std::deque<std::shared_ptr<Loop>> sQueue;
+static std::vector<int> sCpus;
+static Executor sExecutor;
+static std::atomic<size_t> sNumThreads{ 0 }; // 0 until the first use
+static bool sStopping = false;
+
+// Joined when the program ends, a running std::thread must not be destroyed
+static struct Workers
+{
+   std::vector<std::thread> threads;
+   ~Workers();
+} sWorkers;
+
+static size_t
+getDefaultNumThreads()
+{
+   return std::max<size_t>(1, std::thread::hardware_concurrency());
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// work
+// Takes ranges until none are left, the first exception is kept for the
+// caller and the other ranges still run
+///////////////////////////////////////////////////////////////////////////////
+
+static void
+work(Loop& loop)
+{
+   const bool inLoop = sInLoop;
+   sInLoop = true;
+
+   for (;;) {
+      const size_t begin = loop.next.fetch_add(loop.grain);
+      if (begin >= loop.n)
+         break;
+      const size_t end = std::min(loop.n, begin + loop.grain);
+
+      try {
+         (*loop.body)(begin, end);
+      } catch (...) {
+         std::lock_guard<std::mutex> lock(loop.mutex);
+         if (!loop.error)
+            loop.error = std::current_exception();
+      }
+
+      if (loop.done.fetch_add(end - begin) + (end - begin) == loop.n) {
+         std::lock_guard<std::mutex> lock(loop.mutex);
+         loop.finished.notify_all();
+      }
+   }
+   sInLoop = inLoop;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Workers
+///////////////////////////////////////////////////////////////////////////////
+
+static void
+runWorker()
+{
+   std::unique_lock<std::mutex> lock(sMutex);
+   for (;;) {
+      sWork.wait(lock, [] { return sStopping || !sQueue.empty(); });
+      if (sStopping)
+         return;
+
+      auto loop = std::move(sQueue.front());
+      sQueue.pop_front();
+      lock.unlock();
+      work(*loop);
+      lock.lock();
+   }
+}
+
+// Called with sMutex held
+static void
+startWorkers()
+{
+   if (!sWorkers.threads.empty() || sStopping)
+      return;
+
+   for (size_t i = 0; i + 1 < sNumThreads; ++i) {
+      sWorkers.threads.emplace_back(runWorker);
+      if (!sCpus.empty()) {
+         cpu_set_t set;
+         CPU_ZERO(&set);
+         CPU_SET(sCpus[i % sCpus.size()], &set);
+         pthread_setaffinity_np(sWorkers.threads.back().native_handle(), sizeof(set), &set);
+      }
+   }
+}
+
+// Queued helpers are dropped, their callers run the ranges themselves
+static void
+stopWorkers()
+{
+   std::vector<std::thread> threads;
+   {
+      std::lock_guard<std::mutex> lock(sMutex);
+      sStopping = true;
+      threads.swap(sWorkers.threads);
+   }
+   sWork.notify_all();
+   for (auto& t : threads)
+      t.join();
+
+   std::lock_guard<std::mutex> lock(sMutex);
+   sQueue.clear();
+   sStopping = false;
+}
+
+Workers::~Workers()
+{
+   stopWorkers();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// configure
+///////////////////////////////////////////////////////////////////////////////
+
+void
+configure(size_t numThreads, const std::vector<int>& cpus)
+{
+   for (int cpu : cpus) {
+      if (cpu < 0 || cpu >= CPU_SETSIZE) {
+         throw std::runtime_error("Invalid CPU " + std::to_string(cpu) + " for the thread pool!");
+      }
+   }
+
+   stopWorkers();
+   std::lock_guard<std::mutex> lock(sMutex);
+   sNumThreads = numThreads ? numThreads : getDefaultNumThreads();
+   sCpus = cpus;
+}
+
+void
+setExecutor(Executor executor, size_t numThreads)
+{
+   stopWorkers();
+   std::lock_guard<std::mutex> lock(sMutex);
+   sExecutor = std::move(executor);
+   sNumThreads = numThreads ? numThreads : getDefaultNumThreads();
+}
+
+size_t
+getNumThreads()
+{
+   size_t numThreads = sNumThreads.load(std::memory_order_relaxed);
+   if (!numThreads) {
+      std::lock_guard<std::mutex> lock(sMutex);
+      if (!sNumThreads)
+         sNumThreads = getDefaultNumThreads();
+      numThreads = sNumThreads;
+   }
+   return numThreads;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// forRanges
+// About 8 ranges per thread, so that a slow range does not hold up the loop.
+// The caller takes ranges as well, so the loop completes even if no helper
+// ever runs.
+///////////////////////////////////////////////////////////////////////////////
+
+void
+forRanges(size_t n, const std::function<void(size_t begin, size_t end)>& body)
+{
+   const size_t numThreads = getNumThreads();
+   if (!n)
+      return;
+   if (sInLoop || numThreads == 1 || n == 1) {
+      body(0, n);
+      return;
+   }
+
+   auto loop = std::make_shared<Loop>();
+   loop->body = &body;
+   loop->n = n;
+   loop->grain = std::max<size_t>(1, n / (numThreads * 8));
+   const size_t numHelpers = std::min(numThreads, (n + loop->grain - 1) / loop->grain) - 1;
+
+   std::unique_lock<std::mutex> lock(sMutex);
+   if (sExecutor) {
+      Executor executor = sExecutor;
+      lock.unlock();
+      try {
+         for (size_t i = 0; i < numHelpers; ++i)
+            executor([loop]() { work(*loop); });
+      } catch (...) {
+         // The caller runs the ranges the executor did not take
+      }
+   } else {
+      startWorkers();
+      for (size_t i = 0; i < numHelpers; ++i)
+         sQueue.push_back(loop);
+      lock.unlock();
+      sWork.notify_all();
+   }
+
+   work(*loop);
+   {
+      std::unique_lock<std::mutex> loopLock(loop->mutex);
+      loop->finished.wait(loopLock, [&] { return loop->done == n; });
+   }
+   if (loop->error)
+      std::rethrow_exception(loop->error);
+}
+
+} // namespace ThreadPool
@@ -0,0 +1,119 @@
+#include "Tracer.hh"
+
+#include <chrono>
+#include <fstream>
+#include <mutex>
+#include <set>
+#include <stdexcept>
+#include <vector>
+
+namespace Tracer {
+
+struct Event
+{
+   std::string name;
+   uint64_t start;
+   uint64_t duration;
+   int thread;
+};
+
+std::atomic<bool> sEnabled{ false };
+static std::atomic<int> sNextThread{ 0 };
+static std::mutex sMutex;
+static std::vector<Event> sEvents;
+static std::chrono::steady_clock::time_point sEpoch = std::chrono::steady_clock::now();
+
+// Small sequential thread IDs in the order the threads record their first span
+static int
+getThreadId()
+{
+   thread_local int id = sNextThread.fetch_add(1, std::memory_order_relaxed);
+   return id;
+}
+
+static std::string
+escape(const std::string& s)
+{
+   std::string result;
+   for (char c : s) {
+      if (c == '"' || c == '\\')
+         result += '\\';
+      result += c;
+   }
+   return result;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// setEnabled
+///////////////////////////////////////////////////////////////////////////////
+
+void
+setEnabled(bool enabled)
+{
+   if (enabled) {
+      std::lock_guard<std::mutex> lock(sMutex);
+      sEvents.clear();
+      sEpoch = std::chrono::steady_clock::now();
+   }
+   sEnabled.store(enabled, std::memory_order_relaxed);
+}
+
+uint64_t
+now()
+{
+   return std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - sEpoch)
+     .count();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// record
+// Spans are coarse (whole stages of a block), a lock per span is cheap enough
+///////////////////////////////////////////////////////////////////////////////
+
+void
+record(std::string name, uint64_t start, uint64_t duration)
+{
+   const int thread = getThreadId();
+   std::lock_guard<std::mutex> lock(sMutex);
+   sEvents.push_back(Event{ std::move(name), start, duration, thread });
+}
+
+size_t
+getNumSpans()
+{
+   std::lock_guard<std::mutex> lock(sMutex);
+   return sEvents.size();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// write
+// Complete events ("ph":"X") plus the names of the threads
+///////////////////////////////////////////////////////////////////////////////
+
+void
+write(const std::string& path)
+{
+   std::ofstream out{ path };
+   if (!out) {
+      throw std::runtime_error("Cannot write the trace to " + path + "!");
+   }
+
+   std::lock_guard<std::mutex> lock(sMutex);
+   std::set<int> threads;
+   out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+   for (size_t i = 0; i < sEvents.size(); ++i) {
+      const auto& e = sEvents[i];
+      threads.insert(e.thread);
+      out << (i ? ",\n" : "\n") << "{\"name\":\"" << escape(e.name)
+          << "\",\"cat\":\"ht\",\"ph\":\"X\",\"ts\":" << e.start << ",\"dur\":" << e.duration
+          << ",\"pid\":1,\"tid\":" << e.thread << "}";
+   }
+   for (int t : threads) {
+      out << ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << t
+          << ",\"args\":{\"name\":\"thread " << t << "\"}}";
+   }
+   out << "\n]}\n";
+}
+
+} // namespace Tracer
@@ -0,0 +1,221 @@
+#include "TransitionSketch.hh"
+
+#include <algorithm>
+#include <stdexcept>
+
+///////////////////////////////////////////////////////////////////////////////
+// mix
+// Finalizer of splitmix64, spreads consecutive contexts over the table
+///////////////////////////////////////////////////////////////////////////////
+
+static uint64_t
+mix(uint64_t x)
+{
+   x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+   x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+   return x ^ (x >> 31);
+}
+
+// Largest power of two <= n, n > 0
+static size_t
+floorPowerOfTwo(size_t n)
+{
+   return size_t(1) << (63 - __builtin_clzll(n));
+}
+
+// Uniform index in [0, n) from the high bits of a hash
+static size_t
+reduce(uint64_t hash, size_t n)
+{
+   return (hash >> 32) * n >> 32;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// TransitionSketch
+// Dense: every context gets as many counters as the budget allows.
+// Hashed: 1/mCountMinShare of the budget for the count-min sketch, the rest
+// for buckets of mWays slots with mHashedCounters counters each.
+///////////////////////////////////////////////////////////////////////////////
+
+TransitionSketch::TransitionSketch(size_t symbolSize, size_t memoryBudget)
+  : mDense(false)
+  , mCountersPerContext(mHashedCounters)
+  , mNumBuckets(0)
+  , mCountMinMask(0)
+{
+   if (!symbolSize || symbolSize > 32) {
+      throw std::runtime_error("Unsupported symbol size for the transition sketch!");
+   }
+
+   if (symbolSize <= 16) {
+      const size_t numContexts = size_t(1) << symbolSize;
+      const size_t contextBytes = memoryBudget / numContexts;
+      if (contextBytes >= sizeof(uint64_t) + sizeof(Counter)) {
+         mDense = true;
+         mCountersPerContext =
+           std::min(mMaxCounters, (contextBytes - sizeof(uint64_t)) / sizeof(Counter));
+         mTotals.assign(numContexts, 0);
+         mCounters.assign(numContexts * mCountersPerContext, Counter{ 0, 0, 0 });
+         return;
+      }
+   }
+
+   const size_t rowSize = memoryBudget / mCountMinShare / mCountMinDepth / sizeof(uint32_t);
+   const size_t slotBytes = 2 * sizeof(uint64_t) + mHashedCounters * sizeof(Counter);
+   if (rowSize < 2 || memoryBudget / slotBytes < 2 * mWays) {
+      throw std::runtime_error("The memory budget of the transition sketch is too small!");
+   }
+
+   const size_t countMinSize = floorPowerOfTwo(rowSize);
+   mNumBuckets =
+     (memoryBudget - countMinSize * mCountMinDepth * sizeof(uint32_t)) / slotBytes / mWays;
+   const size_t numSlots = mNumBuckets * mWays;
+   mCountMinMask = countMinSize - 1;
+   mCountMin.assign(countMinSize * mCountMinDepth, 0);
+   mContexts.assign(numSlots, mNoContext);
+   mTotals.assign(numSlots, 0);
+   mCounters.assign(numSlots * mCountersPerContext, Counter{ 0, 0, 0 });
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// add
+// Space-Saving: an untracked successor takes over the counter with the
+// smallest count and inherits it as its error
+///////////////////////////////////////////////////////////////////////////////
+
+void
+TransitionSketch::add(uint64_t previous, uint64_t next)
+{
+   const size_t slot = mDense ? previous : findSlot(previous);
+   if (slot == mNoSlot)
+      return;
+
+   ++mTotals[slot];
+   Counter* counters = &mCounters[slot * mCountersPerContext];
+   Counter* min = counters;
+   for (size_t j = 0; j < mCountersPerContext; ++j) {
+      if (counters[j].count && counters[j].symbol == next) {
+         ++counters[j].count;
+         return;
+      }
+      if (counters[j].count < min->count)
+         min = &counters[j];
+   }
+
+   min->symbol = next;
+   min->error = min->count;
+   ++min->count;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// findSlot
+// A context is tracked in one of the mWays slots of its bucket. If they are
+// all taken, it replaces the context the count-min sketch has seen least
+// often, provided it has been seen more often itself. The counts of the slot
+// restart then, the totals and counters of a slot cover the same transitions.
+///////////////////////////////////////////////////////////////////////////////
+
+size_t
+TransitionSketch::findSlot(uint64_t context)
+{
+   const uint64_t estimate = addCountMin(context);
+   const size_t first = reduce(mix(context), mNumBuckets) * mWays;
+
+   size_t slot = mNoSlot;
+   uint64_t minEstimate = UINT64_MAX;
+   for (size_t s = first; s < first + mWays; ++s) {
+      if (mContexts[s] == context)
+         return s;
+      uint64_t e = mContexts[s] == mNoContext ? 0 : estimateCountMin(mContexts[s]);
+      if (e < minEstimate) {
+         minEstimate = e;
+         slot = s;
+      }
+   }
+   if (estimate <= minEstimate)
+      return mNoSlot;
+
+   mContexts[slot] = context;
+   mTotals[slot] = 0;
+   std::fill_n(&mCounters[slot * mCountersPerContext], mCountersPerContext, Counter{ 0, 0, 0 });
+   return slot;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Count-min sketch of the context totals
+///////////////////////////////////////////////////////////////////////////////
+
+size_t
+TransitionSketch::getCountMinIndex(size_t row, uint64_t context) const
+{
+   const uint64_t seed = (row + 1) * 0x9e3779b97f4a7c15ULL;
+   return row * (mCountMinMask + 1) + (mix(context + seed) & mCountMinMask);
+}
+
+uint64_t
+TransitionSketch::addCountMin(uint64_t context)
+{
+   uint64_t estimate = UINT64_MAX;
+   for (size_t row = 0; row < mCountMinDepth; ++row) {
+      uint32_t& c = mCountMin[getCountMinIndex(row, context)];
+      c += c != UINT32_MAX;
+      estimate = std::min<uint64_t>(estimate, c);
+   }
+   return estimate;
+}
+
+uint64_t
+TransitionSketch::estimateCountMin(uint64_t context) const
+{
+   uint64_t estimate = UINT64_MAX;
+   for (size_t row = 0; row < mCountMinDepth; ++row)
+      estimate = std::min<uint64_t>(estimate, mCountMin[getCountMinIndex(row, context)]);
+   return estimate;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// getCandidates
+// The successor with the largest guaranteed count, ties towards the smaller
+// successor as in SymbolStatistics::getPredictions. A context that took over
+// its slot late has seen only a few transitions there, its total is the
+// count-min estimate of all of them, so that its share is not overestimated.
+///////////////////////////////////////////////////////////////////////////////
+
+std::vector<TransitionSketch::Candidate>
+TransitionSketch::getCandidates() const
+{
+   std::vector<Candidate> result;
+   for (size_t slot = 0; slot < mTotals.size(); ++slot) {
+      if (!mTotals[slot])
+         continue;
+
+      const Counter* counters = &mCounters[slot * mCountersPerContext];
+      const Counter* best = nullptr;
+      for (size_t j = 0; j < mCountersPerContext; ++j) {
+         uint32_t count = counters[j].count - counters[j].error;
+         if (count && (!best || count > best->count - best->error ||
+                       (count == best->count - best->error && counters[j].symbol < best->symbol)))
+            best = &counters[j];
+      }
+
+      if (best) {
+         const uint64_t context = mDense ? slot : mContexts[slot];
+         const uint64_t total =
+           mDense ? mTotals[slot] : std::max(mTotals[slot], estimateCountMin(context));
+         result.push_back(
+           Candidate{ context, best->symbol, uint64_t(best->count - best->error), total });
+      }
+   }
+   return result;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// getMemoryUsage
+///////////////////////////////////////////////////////////////////////////////
+
+size_t
+TransitionSketch::getMemoryUsage() const
+{
+   return mContexts.size() * sizeof(uint64_t) + mTotals.size() * sizeof(uint64_t) +
+          mCounters.size() * sizeof(Counter) + mCountMin.size() * sizeof(uint32_t);
+}
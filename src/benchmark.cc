@@ -0,0 +1,613 @@
+#include "AllocationStats.hh"
+#include "BinaryUtils.hh"
+#include "CompressionLevel.hh"
+#include "EncoderChain.hh"
+#include "EncoderFactory.hh"
+#include "HuffmanTransducer.hh"
+#include "MarkovEncoder.hh"
+#include "Padder.hh"
+#include "ThreadPool.hh"
+
+#include <algorithm>
+#include <chrono>
+#include <ctime>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+using namespace BinaryUtils;
+
+#define BENCHMARK_CHAIN(function) addChain(function, #function)
+
+#define DEF_SYMBOLSIZE 16             // Note: does not work for odd byte sizes
+#define DEF_PROBABILITY_THRESHOLD 0.4 // State transitions with >40% probability
+#define DEF_MAX_INPUT_SIZE 1000000    // Bytes read from each sample
+#define DEF_REPETITIONS 3             // The best throughput of the repetitions is kept
+#define DEF_MIN_SECONDS 1.0           // Fast cases repeat until they ran this long
+#define DEF_TOLERANCE 0.3             // Allowed relative regression
+#define DEF_RATIO_TOLERANCE 0.005     // Allowed relative loss of compression ratio
+#define DEF_RERUNS 2                  // Reruns of a slow case, or of every case for the baseline
+#define DEF_BASELINE "benchmark_baseline.txt"
+#define DEF_REFERENCE_SIZE 4000000    // Bytes hashed by the reference loop
+#define DEF_REFERENCE_TABLE (1 << 19) // Entries of the table of the reference lookups
+
+// Chains #####################################################################
+
+std::unique_ptr<EncoderChain>
+huffman()
+{
+   auto c = std::make_unique<EncoderChain>();
+   c->addEncoder(std::make_unique<Padder>(Padder::PaddingType::EvenBytes));
+   c->addEncoder(EncoderFactory::createHuffmanTransducer(DEF_SYMBOLSIZE));
+   return c;
+}
+
+std::unique_ptr<EncoderChain>
+markov_huffman()
+{
+   auto c = std::make_unique<EncoderChain>();
+   c->addEncoder(std::make_unique<Padder>(Padder::PaddingType::EvenBytes));
+   c->addEncoder(EncoderFactory::createMarkovEncoder(DEF_SYMBOLSIZE, DEF_PROBABILITY_THRESHOLD));
+   c->addEncoder(EncoderFactory::createHuffmanTransducer(DEF_SYMBOLSIZE));
+   return c;
+}
+
+// Restart points every interval symbols, the ratio shows their cost
+template<size_t interval>
+std::unique_ptr<EncoderChain>
+markov_restart_huffman()
+{
+   auto m = EncoderFactory::createMarkovEncoder(DEF_SYMBOLSIZE, DEF_PROBABILITY_THRESHOLD);
+   m->setRestartInterval(interval);
+
+   auto c = std::make_unique<EncoderChain>();
+   c->addEncoder(std::make_unique<Padder>(Padder::PaddingType::EvenBytes));
+   c->addEncoder(std::move(m));
+   c->addEncoder(EncoderFactory::createHuffmanTransducer(DEF_SYMBOLSIZE));
+   return c;
+}
+
+// Models trained on a sample of sampleSize bytes, the ratio shows the loss
+template<size_t sampleSize>
+std::unique_ptr<EncoderChain>
+sampled_markov_huffman()
+{
+   auto m = EncoderFactory::createMarkovEncoder(DEF_SYMBOLSIZE, DEF_PROBABILITY_THRESHOLD);
+   m->setTrainingSampleSize(sampleSize);
+   auto h = EncoderFactory::createHuffmanTransducer(DEF_SYMBOLSIZE);
+   h->setTrainingSampleSize(sampleSize);
+
+   auto c = std::make_unique<EncoderChain>();
+   c->addEncoder(std::make_unique<Padder>(Padder::PaddingType::EvenBytes));
+   c->addEncoder(std::move(m));
+   c->addEncoder(std::move(h));
+   return c;
+}
+
+// Markov transitions counted in budget bytes, the ratio shows the loss
+template<size_t budget>
+std::unique_ptr<EncoderChain>
+bounded_markov_huffman()
+{
+   auto m = EncoderFactory::createMarkovEncoder(DEF_SYMBOLSIZE, DEF_PROBABILITY_THRESHOLD);
+   m->setTrainingMemoryBudget(budget);
+
+   auto c = std::make_unique<EncoderChain>();
+   c->addEncoder(std::make_unique<Padder>(Padder::PaddingType::EvenBytes));
+   c->addEncoder(std::move(m));
+   c->addEncoder(EncoderFactory::createHuffmanTransducer(DEF_SYMBOLSIZE));
+   return c;
+}
+
+// The presets of --encode -1 ... -9
+// The chain the level selects for the data, as for a block of a container
+template<int level>
+std::unique_ptr<EncoderChain>
+level_chain(const bitSet& data)
+{
+   double estimatedSize = 0;
+   std::unique_ptr<EncoderChain> chain;
+   CompressionLevel::get(level).selectSymbolSize(data, estimatedSize, &chain);
+   if (!chain)
+      throw std::runtime_error("The level cannot encode the data!");
+   return chain;
+}
+
+// Measurement ################################################################
+
+struct BenchmarkResult
+{
+   double encodeMBs = 0;
+   double decodeMBs = 0;
+   double peakMemoryMB = 0;
+   double ratio = 0;
+
+   // The reference loop, measured before every repetition, and the
+   // throughputs as multiples of it (the best of each)
+   double referenceMBs = 0;
+   double encodeRelative = 0;
+   double decodeRelative = 0;
+
+   // Heap use of one round trip, only measured with --allocations
+   AllocationStats::Counters encodeAllocations;
+   AllocationStats::Counters decodeAllocations;
+
+   // Markov prediction outcomes of one encode, only counted with --predictions
+   uint64_t predictionHits = 0;
+   uint64_t predictionMisses = 0;
+   uint64_t unpredicted = 0;
+};
+
+// CPU time of the process, the time a case waits for the CPU on a busy
+// machine does not count. The cases run on one thread.
+struct CpuClock
+{
+   typedef std::chrono::nanoseconds duration;
+   typedef duration::rep rep;
+   typedef duration::period period;
+   typedef std::chrono::time_point<CpuClock> time_point;
+   static const bool is_steady = true;
+
+   static time_point now()
+   {
+      timespec t;
+      clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &t);
+      return time_point(duration(t.tv_sec * 1000000000ll + t.tv_nsec));
+   }
+};
+
+double
+getMBs(size_t numBits, CpuClock::time_point t1, CpuClock::time_point t2)
+{
+   double seconds = std::chrono::duration<double>(t2 - t1).count();
+   return numBits / 8e6 / seconds;
+}
+
+// Reference ##################################################################
+
+///////////////////////////////////////////////////////////////////////////////
+// getReferenceMBs
+// Throughput of a fixed loop on this machine, measured before every round
+// trip: a byte hash (FNV-1a) for the arithmetic and dependent lookups in a
+// 2 MB table for the memory latency, which the table driven encoders depend
+// on. The baseline holds the throughputs as multiples of it, so a faster,
+// slower or busier machine does not show up as a change.
+///////////////////////////////////////////////////////////////////////////////
+
+static volatile uint64_t sReferenceHash; // keeps the loops from being optimized away
+
+double
+getReferenceMBs()
+{
+   std::vector<uint32_t> table(DEF_REFERENCE_TABLE);
+   const size_t numLookups = DEF_REFERENCE_SIZE / 16;
+
+   auto t1 = CpuClock::now();
+   uint64_t hash = 14695981039346656037ull;
+   for (size_t i = 0; i < DEF_REFERENCE_SIZE; ++i)
+      hash = (hash ^ uint8_t(i * 2654435761u >> 13)) * 1099511628211ull;
+   uint32_t x = 1;
+   for (size_t i = 0; i < numLookups; ++i)
+      x = table[(x * 2654435761u + i) & (table.size() - 1)] += x + uint32_t(i);
+   auto t2 = CpuClock::now();
+
+   sReferenceHash = hash + x;
+   return getMBs((DEF_REFERENCE_SIZE + numLookups) * 8, t1, t2);
+}
+
+// Baseline ###################################################################
+
+std::map<std::string, BenchmarkResult>
+readBaseline(const std::string& path)
+{
+   std::map<std::string, BenchmarkResult> result;
+   std::ifstream ifs(path);
+   std::string line;
+   while (std::getline(ifs, line)) {
+      if (line.empty() || line[0] == '#')
+         continue;
+
+      std::istringstream iss(line);
+      std::string name;
+      BenchmarkResult r;
+      if (iss >> name >> r.encodeRelative >> r.decodeRelative >> r.peakMemoryMB >> r.ratio)
+         result[name] = r;
+   }
+   return result;
+}
+
+double
+getMedian(std::vector<BenchmarkResult> runs, double BenchmarkResult::*field)
+{
+   std::sort(runs.begin(), runs.end(), [field](const BenchmarkResult& a, const BenchmarkResult& b) {
+      return a.*field < b.*field;
+   });
+   return runs[runs.size() / 2].*field;
+}
+
+// Throughputs are written relative to the reference
+void
+writeBaseline(const std::string& path, const std::map<std::string, BenchmarkResult>& results)
+{
+   std::ofstream ofs(path);
+   ofs << "# name encode decode peakMemoryMB ratio (throughputs per reference MB/s)" << std::endl;
+   for (const auto& r : results) {
+      ofs << r.first << " " << r.second.encodeRelative << " " << r.second.decodeRelative << " "
+          << r.second.peakMemoryMB << " " << r.second.ratio << std::endl;
+   }
+   if (!ofs.good()) {
+      throw std::runtime_error("Could not write the baseline!");
+   }
+}
+
+// Executor ###################################################################
+
+class BenchmarkExecutor
+{
+ public:
+   BenchmarkExecutor()
+   {
+      BENCHMARK_CHAIN(huffman);
+      BENCHMARK_CHAIN(markov_huffman);
+      BENCHMARK_CHAIN(markov_restart_huffman<1024>);
+      BENCHMARK_CHAIN(markov_restart_huffman<65536>);
+      BENCHMARK_CHAIN(sampled_markov_huffman<65536>);
+      BENCHMARK_CHAIN(bounded_markov_huffman<4194304>);
+      BENCHMARK_CHAIN(bounded_markov_huffman<262144>);
+      BENCHMARK_CHAIN(level_chain<1>);
+      BENCHMARK_CHAIN(level_chain<2>);
+      BENCHMARK_CHAIN(level_chain<3>);
+      BENCHMARK_CHAIN(level_chain<4>);
+      BENCHMARK_CHAIN(level_chain<5>);
+      BENCHMARK_CHAIN(level_chain<6>);
+      BENCHMARK_CHAIN(level_chain<7>);
+      BENCHMARK_CHAIN(level_chain<8>);
+      BENCHMARK_CHAIN(level_chain<9>);
+
+      inputs = { "../samples/sip_flow.pcap",
+                 "../samples/text_data.txt",
+                 "../samples/binary_data",
+                 "../samples/war_and_peace.txt" };
+   }
+
+   void setCollectPredictionStats(bool collect) { collectPredictions = collect; }
+
+   void addChain(std::function<std::unique_ptr<EncoderChain>()> factory, std::string name)
+   {
+      addChain([factory](const bitSet&) { return factory(); }, name);
+   }
+
+   // The chain depends on the data, its creation is timed as part of the encode
+   void addChain(std::function<std::unique_ptr<EncoderChain>(const bitSet&)> factory,
+                 std::string name)
+   {
+      // The baseline separates its columns by whitespace
+      if (name.find_first_of(" \t") != std::string::npos)
+         throw std::runtime_error("Benchmark names must not contain whitespace!");
+      chainFactories.push_back(factory);
+      chainNames.push_back(name);
+   }
+
+   // Timed round trip, encoding includes training and decoding includes
+   // deserialization of the chain. Round trips of a few milliseconds are
+   // repeated more often, a single one is too easily disturbed.
+   BenchmarkResult run(size_t chainIdx, const bitSet& inputData)
+   {
+      BenchmarkResult result;
+      const auto start = CpuClock::now();
+
+      for (size_t n = 0; n < DEF_REPETITIONS ||
+                         std::chrono::duration<double>(CpuClock::now() - start).count() <
+                           DEF_MIN_SECONDS;
+           ++n) {
+         result.referenceMBs = std::max(result.referenceMBs, getReferenceMBs());
+
+         auto encodeScope = std::make_unique<AllocationStats::Scope>();
+         auto t1 = CpuClock::now();
+         auto c = chainFactories[chainIdx](inputData);
+         auto markov = collectPredictions ? findMarkovEncoder(*c) : nullptr;
+         if (markov)
+            markov->setCollectPredictionStats(true);
+         auto encoded = c->encode(inputData);
+         auto serialized = c->serialize();
+         auto t2 = CpuClock::now();
+         result.encodeMBs = std::max(result.encodeMBs, getMBs(inputData.size(), t1, t2));
+         result.encodeAllocations = encodeScope->get();
+         encodeScope.reset();
+
+         if (markov) {
+            auto stats = markov->getPredictionStats(0);
+            result.predictionHits = stats.hits;
+            result.predictionMisses = stats.misses;
+            result.unpredicted = stats.unpredicted;
+         }
+
+         AllocationStats::Scope decodeScope;
+         t1 = CpuClock::now();
+         auto d = std::unique_ptr<EncoderChain>(EncoderChain::deserializerFactory(serialized));
+         auto decoded = d->decode(encoded);
+         t2 = CpuClock::now();
+         result.decodeMBs = std::max(result.decodeMBs, getMBs(inputData.size(), t1, t2));
+         result.decodeAllocations = decodeScope.get();
+
+         result.ratio = double(inputData.size()) / (encoded.size() + serialized.size());
+         if (decoded != inputData) {
+            throw std::runtime_error("Round trip failed for " + chainNames[chainIdx]);
+         }
+      }
+
+      result.encodeRelative = result.encodeMBs / result.referenceMBs;
+      result.decodeRelative = result.decodeMBs / result.referenceMBs;
+      return result;
+   }
+
+   // Every case runs in a child process, so the peak memory (max. RSS of the
+   // child) is not affected by the heap retained from the previous cases.
+   BenchmarkResult runIsolated(size_t chainIdx, const std::string& input)
+   {
+      int fd[2];
+      if (pipe(fd) != 0) {
+         throw std::runtime_error("Could not create a pipe!");
+      }
+
+      pid_t pid = fork();
+      if (pid == 0) {
+         close(fd[0]);
+         try {
+            auto result = run(chainIdx, readBinary(input, DEF_MAX_INPUT_SIZE));
+            if (write(fd[1], &result, sizeof(result)) == sizeof(result))
+               _exit(0);
+         } catch (std::exception& E) {
+            std::cout << E.what() << std::endl;
+         }
+         _exit(1);
+      }
+
+      close(fd[1]);
+      BenchmarkResult result;
+      bool received = pid > 0 && read(fd[0], &result, sizeof(result)) == sizeof(result);
+      close(fd[0]);
+
+      int status = 0;
+      rusage usage;
+      if (!received || wait4(pid, &status, 0, &usage) != pid || status != 0) {
+         throw std::runtime_error("Benchmark failed: " + chainNames[chainIdx] + " " + input);
+      }
+
+      result.peakMemoryMB = usage.ru_maxrss / 1000.0;
+      return result;
+   }
+
+   std::map<std::string, BenchmarkResult> execute()
+   {
+      std::map<std::string, BenchmarkResult> results;
+      for (const auto& input : inputs) {
+         auto inputName = input.substr(input.find_last_of('/') + 1);
+         for (size_t i = 0; i < chainFactories.size(); ++i) {
+            results[chainNames[i] + "/" + inputName] = runIsolated(i, input);
+         }
+      }
+      return results;
+   }
+
+   // Runs the case again, named as in the results of execute
+   BenchmarkResult execute(const std::string& caseName)
+   {
+      for (const auto& input : inputs) {
+         auto inputName = input.substr(input.find_last_of('/') + 1);
+         for (size_t i = 0; i < chainFactories.size(); ++i) {
+            if (chainNames[i] + "/" + inputName == caseName)
+               return runIsolated(i, input);
+         }
+      }
+      throw std::runtime_error("Unknown benchmark: " + caseName);
+   }
+
+ private:
+   static MarkovEncoder* findMarkovEncoder(const EncoderChain& c)
+   {
+      for (size_t i = 0; i < c.getNumEncoders(); ++i) {
+         if (auto* m = dynamic_cast<MarkovEncoder*>(&c.getEncoder(i)))
+            return m;
+      }
+      return nullptr;
+   }
+
+   bool collectPredictions = false;
+   std::vector<std::function<std::unique_ptr<EncoderChain>(const bitSet&)>> chainFactories;
+   std::vector<std::string> chainNames;
+   std::vector<std::string> inputs;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// printAllocations
+// Heap use of the encode and the decode of one round trip
+///////////////////////////////////////////////////////////////////////////////
+
+void
+printAllocations(const std::map<std::string, BenchmarkResult>& results)
+{
+   std::cout << std::endl
+             << std::left << std::setw(48) << "allocations" << std::right << std::setw(12)
+             << "enc allocs" << std::setw(12) << "enc MB" << std::setw(12) << "enc live MB"
+             << std::setw(12) << "dec allocs" << std::setw(12) << "dec MB" << std::setw(12)
+             << "dec live MB" << std::endl;
+
+   for (const auto& r : results) {
+      const auto& e = r.second.encodeAllocations;
+      const auto& d = r.second.decodeAllocations;
+      std::cout << std::left << std::setw(48) << r.first << std::right << std::fixed
+                << std::setprecision(3) << std::setw(12) << e.allocations << std::setw(12)
+                << e.bytes / 1e6 << std::setw(12) << e.peakBytes / 1e6 << std::setw(12)
+                << d.allocations << std::setw(12) << d.bytes / 1e6 << std::setw(12)
+                << d.peakBytes / 1e6 << std::endl;
+   }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// printPredictions
+// Outcome of the Markov predictions of the chains with a MarkovEncoder
+///////////////////////////////////////////////////////////////////////////////
+
+void
+printPredictions(const std::map<std::string, BenchmarkResult>& results)
+{
+   std::cout << std::endl
+             << std::left << std::setw(48) << "markov predictions" << std::right
+             << std::setw(12) << "hit %" << std::setw(12) << "miss %" << std::setw(12)
+             << "none %" << std::endl;
+
+   for (const auto& r : results) {
+      const auto& p = r.second;
+      const double numSymbols = p.predictionHits + p.predictionMisses + p.unpredicted;
+      if (!numSymbols)
+         continue;
+
+      std::cout << std::left << std::setw(48) << r.first << std::right << std::fixed
+                << std::setprecision(3) << std::setw(12) << 100 * p.predictionHits / numSymbols
+                << std::setw(12) << 100 * p.predictionMisses / numSymbols << std::setw(12)
+                << 100 * p.unpredicted / numSymbols << std::endl;
+   }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// main
+// Benchmark [--update-baseline] [--baseline <path>] [--tolerance <ratio>] [--allocations]
+//           [--predictions]
+// Returns 1 if any throughput drops or the peak memory grows beyond the tolerance,
+// or the compression ratio drops by more than 0.5%.
+// The cases run on one thread and their throughputs are compared as multiples
+// of the reference loop, so the baseline holds on machines of other speed and
+// core count.
+// --allocations also counts the heap allocations, which slows down the round
+// trips a little. --predictions counts the Markov prediction outcomes in an
+// extra pass of the encode.
+///////////////////////////////////////////////////////////////////////////////
+
+int
+main(int argc, char** argv)
+{
+   std::string baselinePath = DEF_BASELINE;
+   double tolerance = DEF_TOLERANCE;
+   bool updateBaseline = false;
+   bool predictions = false;
+
+   for (int i = 1; i < argc; ++i) {
+      std::string arg(argv[i]);
+      if (arg == "--update-baseline") {
+         updateBaseline = true;
+      } else if (arg == "--baseline" && i + 1 < argc) {
+         baselinePath = argv[++i];
+      } else if (arg == "--tolerance" && i + 1 < argc) {
+         tolerance = std::stod(argv[++i]);
+      } else if (arg == "--allocations") {
+         AllocationStats::setEnabled(true);
+      } else if (arg == "--predictions") {
+         predictions = true;
+      } else {
+         std::cout << "Unrecognized option: " << arg << std::endl;
+         return 1;
+      }
+   }
+
+   auto baseline = readBaseline(baselinePath);
+   auto isSlower = [&](const std::string& name, const BenchmarkResult& r) {
+      auto it = baseline.find(name);
+      return it != baseline.end() &&
+             (r.encodeRelative < it->second.encodeRelative * (1 - tolerance) ||
+              r.decodeRelative < it->second.decodeRelative * (1 - tolerance));
+   };
+
+   std::map<std::string, BenchmarkResult> results;
+   try {
+      ThreadPool::configure(1);
+      BenchmarkExecutor b;
+      b.setCollectPredictionStats(predictions);
+      results = b.execute();
+
+      if (updateBaseline) {
+         // A lucky run would fail later checks, the baseline keeps the median
+         for (auto& r : results) {
+            std::vector<BenchmarkResult> runs{ r.second };
+            for (int n = 0; n < DEF_RERUNS; ++n)
+               runs.push_back(b.execute(r.first));
+            r.second.encodeRelative = getMedian(runs, &BenchmarkResult::encodeRelative);
+            r.second.decodeRelative = getMedian(runs, &BenchmarkResult::decodeRelative);
+         }
+      } else {
+         // A slow case may have been interrupted, it only fails if the reruns
+         // are slow as well
+         for (auto& r : results) {
+            for (int n = 0; n < DEF_RERUNS && isSlower(r.first, r.second); ++n) {
+               auto rerun = b.execute(r.first);
+               rerun.encodeRelative = std::max(rerun.encodeRelative, r.second.encodeRelative);
+               rerun.decodeRelative = std::max(rerun.decodeRelative, r.second.decodeRelative);
+               r.second = rerun;
+            }
+         }
+      }
+   } catch (std::exception& E) {
+      std::cout << E.what() << std::endl;
+      return 1;
+   }
+
+   bool regression = false;
+
+   std::cout << std::left << std::setw(48) << "benchmark" << std::right << std::setw(12)
+             << "enc MB/s" << std::setw(12) << "dec MB/s" << std::setw(12) << "ref MB/s"
+             << std::setw(12) << "peak MB" << std::setw(10) << "ratio" << std::endl;
+
+   for (const auto& r : results) {
+      std::cout << std::left << std::setw(48) << r.first << std::right << std::fixed
+                << std::setprecision(3) << std::setw(12) << r.second.encodeMBs << std::setw(12)
+                << r.second.decodeMBs << std::setw(12) << r.second.referenceMBs << std::setw(12)
+                << r.second.peakMemoryMB << std::setw(10) << r.second.ratio;
+
+      auto it = baseline.find(r.first);
+      if (it == baseline.end()) {
+         std::cout << "  (no baseline)" << std::endl;
+         continue;
+      }
+
+      std::string failed;
+      if (r.second.encodeRelative < it->second.encodeRelative * (1 - tolerance))
+         failed += " encode";
+      if (r.second.decodeRelative < it->second.decodeRelative * (1 - tolerance))
+         failed += " decode";
+      if (r.second.peakMemoryMB > it->second.peakMemoryMB * (1 + tolerance))
+         failed += " memory";
+      if (r.second.ratio < it->second.ratio * (1 - DEF_RATIO_TOLERANCE))
+         failed += " ratio";
+
+      if (failed.empty()) {
+         std::cout << "  passed." << std::endl;
+      } else {
+         std::cout << "  regression:" << failed << std::endl;
+         regression = true;
+      }
+   }
+
+   if (AllocationStats::isEnabled()) {
+      printAllocations(results);
+   }
+   if (predictions) {
+      printPredictions(results);
+   }
+
+   if (updateBaseline) {
+      writeBaseline(baselinePath, results);
+      std::cout << "Baseline updated: " << baselinePath << std::endl;
+      return 0;
+   }
+
+   return regression ? 1 : 0;
+}
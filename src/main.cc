@@ -1,14 +1,31 @@
+#include "AllocationStats.hh"
 #include "BinaryUtils.hh"
+#include "BlockContainer.hh"
+#include "CompressionLevel.hh"
 #include "EncoderChain.hh"
+#include "EncoderFactory.hh"
 #include "HuffmanTransducer.hh"
 #include "MarkovEncoder.hh"
 #include "Padder.hh"
-
+#include "PcapSplitter.hh"
+#include "SymbolStatistics.hh"
+#include "ThreadPool.hh"
+#include "Tracer.hh"
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
 #include <chrono>
+#include <cstdlib>
 #include <exception>
+#include <fstream>
+#include <functional>
+#include <iomanip>
 #include <iostream>
 #include <memory>
+#include <sstream>
 #include <string>
+#include <vector>
 
 using namespace BinaryUtils;
 
@@ -16,6 +33,10 @@ using namespace BinaryUtils;
 #define DEF_PROBABILITY_THRESHOLD 0.4 // State transitions with >40% probability
 #define DEF_NUM_SLICES 8
 #define DEF_HUFF_THREADS 8
+#define DEF_SAMPLE_SIZE (4 << 20)          // Bytes analyzed by --analyze
+#define DEF_SAMPLE_BLOCK_SIZE (1 << 16)    // Bytes per sampled block
+#define DEF_TIMING_SIZE (1 << 20)          // Bytes encoded by --analyze to measure the throughput
+#define DEF_TRAINING_SAMPLE_SIZE (4 << 20) // Bytes of a substream the models are trained on
 
 ///////////////////////////////////////////////////////////////////////////////
 // utility functions
@@ -44,6 +65,73 @@ printConsoleLine(const std::string header = "")
    std::cout << std::endl;
 }
 
+///////////////////////////////////////////////////////////////////////////////
+// printStageAllocations
+// Time and heap use of every stage of the chain used by --encode
+///////////////////////////////////////////////////////////////////////////////
+
+void
+printStageAllocations(const bitSet& inputData)
+{
+   EncoderChain c;
+   c.addEncoder(std::make_unique<Padder>(Padder::PaddingType::EvenBytes));
+   c.addEncoder(EncoderFactory::createMarkovEncoder(DEF_SYMBOLSIZE, DEF_PROBABILITY_THRESHOLD));
+   c.addEncoder(EncoderFactory::createHuffmanTransducer(DEF_SYMBOLSIZE, DEF_HUFF_THREADS));
+   auto encoded = c.encode(inputData);
+   auto d = std::unique_ptr<EncoderChain>(EncoderChain::deserializerFactory(c.serialize()));
+   d->decode(encoded);
+
+   printConsoleLine("Allocations per stage");
+   std::cout << std::left << std::setw(24) << "stage" << std::right << std::setw(12) << "ms"
+             << std::setw(12) << "allocs" << std::setw(12) << "MB" << std::setw(12) << "live MB"
+             << std::endl;
+
+   auto print = [](const std::string& direction, const EncoderChain& chain) {
+      for (const auto& stage : chain.getStageStats()) {
+         std::cout << std::left << std::setw(24) << direction + " " + stage.name << std::right
+                   << std::fixed << std::setprecision(3) << std::setw(12)
+                   << stage.seconds * 1000 << std::setw(12) << stage.allocations.allocations
+                   << std::setw(12) << stage.allocations.bytes / 1e6 << std::setw(12)
+                   << stage.allocations.peakBytes / 1e6 << std::defaultfloat << std::endl;
+      }
+   };
+   print("encode", c);
+   print("decode", *d);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// printPredictionStats
+// Hit rate of the Markov predictions and the contexts that miss most often
+///////////////////////////////////////////////////////////////////////////////
+
+void
+printPredictionStats(const MarkovEncoder& m)
+{
+   auto stats = m.getPredictionStats();
+   auto percent = [&](uint64_t n) {
+      return stats.getNumSymbols() ? 100.0 * n / stats.getNumSymbols() : 0;
+   };
+
+   std::cout << std::fixed << std::setprecision(2) << "Predicted (escaped): " << stats.hits
+             << " (" << percent(stats.hits) << "%)" << std::endl
+             << "Mispredicted (literal): " << stats.misses << " (" << percent(stats.misses)
+             << "%)" << std::endl
+             << "Without prediction (literal): " << stats.unpredicted << " ("
+             << percent(stats.unpredicted) << "%)" << std::endl;
+
+   if (!stats.topMisses.empty()) {
+      std::cout << std::left << std::setw(12) << "context" << std::setw(12) << "predicted"
+                << std::right << std::setw(12) << "hits" << std::setw(12) << "misses"
+                << std::endl;
+      for (const auto& c : stats.topMisses) {
+         std::cout << std::left << std::hex << "0x" << std::setw(10) << c.context << "0x"
+                   << std::setw(10) << c.predicted << std::dec << std::right << std::setw(12)
+                   << c.hits << std::setw(12) << c.misses << std::endl;
+      }
+   }
+   std::cout << std::defaultfloat;
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 // demo
 ///////////////////////////////////////////////////////////////////////////////
@@ -60,13 +148,14 @@ demo(const std::string& inputName, const std::string& outputName)
 
    // Statistics & tree ##########################################
    t1 = std::chrono::high_resolution_clock::now();
-   HuffmanTransducer h(inputData, DEF_SYMBOLSIZE);
+   auto h = EncoderFactory::createHuffmanTransducer(DEF_SYMBOLSIZE);
+   h->setup(inputData);
    t2 = std::chrono::high_resolution_clock::now();
 
    printConsoleLine("Original data");
-   std::cout << "The entropy is: " << h.getEntropy() << std::endl
-             << "The average code length is: " << h.getAvgCodeLength() << std::endl
-             << "The size of the encoding table is: " << h.getTableSize() / 8000.0 << " KB"
+   std::cout << "The entropy is: " << h->getEntropy() << std::endl
+             << "The average code length is: " << h->getAvgCodeLength() << std::endl
+             << "The size of the encoding table is: " << h->getTableSize() / 8000.0 << " KB"
              << std::endl
              << "Symbolsize (bits): " << DEF_SYMBOLSIZE << std::endl;
 
@@ -76,15 +165,19 @@ demo(const std::string& inputName, const std::string& outputName)
 
    printConsoleLine("Precompression");
 
-   MarkovEncoder m(inputData, DEF_SYMBOLSIZE, DEF_PROBABILITY_THRESHOLD);
+   auto m = EncoderFactory::createMarkovEncoder(DEF_SYMBOLSIZE, DEF_PROBABILITY_THRESHOLD);
+   m->setup(inputData);
 
    t1 = std::chrono::high_resolution_clock::now();
-   auto markovEncoded = m.encode(inputData);
+   auto markovEncoded = m->encode(inputData);
    t2 = std::chrono::high_resolution_clock::now();
    printDurationMessage("Precompression using Markov chains", t1, t2);
 
+   m->countPredictions(inputData);
+   printPredictionStats(*m);
+
    t1 = std::chrono::high_resolution_clock::now();
-   auto markovDecoded = m.decode(markovEncoded);
+   auto markovDecoded = m->decode(markovEncoded);
    t2 = std::chrono::high_resolution_clock::now();
    printDurationMessage("Decompression using Markov chains", t1, t2);
 
@@ -93,13 +186,14 @@ demo(const std::string& inputName, const std::string& outputName)
    }
 
    t1 = std::chrono::high_resolution_clock::now();
-   HuffmanTransducer h2(markovEncoded, DEF_SYMBOLSIZE);
+   auto h2 = EncoderFactory::createHuffmanTransducer(DEF_SYMBOLSIZE);
+   h2->setup(markovEncoded);
    t2 = std::chrono::high_resolution_clock::now();
 
    printConsoleLine("Precompressed data");
-   std::cout << "The entropy is: " << h2.getEntropy() << std::endl
-             << "The average code length is: " << h2.getAvgCodeLength() << std::endl
-             << "The size of the encoding table is: " << h2.getTableSize() / 8000.0 << " KB"
+   std::cout << "The entropy is: " << h2->getEntropy() << std::endl
+             << "The average code length is: " << h2->getAvgCodeLength() << std::endl
+             << "The size of the encoding table is: " << h2->getTableSize() / 8000.0 << " KB"
              << std::endl
              << "Symbolsize (bits): " << DEF_SYMBOLSIZE << std::endl;
 
@@ -108,30 +202,30 @@ demo(const std::string& inputName, const std::string& outputName)
    // Encoding ###################################################
    printConsoleLine("Encoding & Decoding");
    t1 = std::chrono::high_resolution_clock::now();
-   bitSet encoded = h.encode(inputData);
+   bitSet encoded = h->encode(inputData);
    t2 = std::chrono::high_resolution_clock::now();
    printDurationMessage("Huffman encoding (original)", t1, t2);
 
    t1 = std::chrono::high_resolution_clock::now();
-   bitSet encoded2 = h2.encode(markovEncoded);
+   bitSet encoded2 = h2->encode(markovEncoded);
    t2 = std::chrono::high_resolution_clock::now();
    printDurationMessage("Huffman encoding (precompressed)", t1, t2);
 
    // Decoding ###################################################
    t1 = std::chrono::high_resolution_clock::now();
-   bitSet decoded = h.decode(encoded);
+   bitSet decoded = h->decode(encoded);
    t2 = std::chrono::high_resolution_clock::now();
    printDurationMessage("Huffman decoding (original)", t1, t2);
 
    t1 = std::chrono::high_resolution_clock::now();
-   bitSet decoded2 = h2.decode(encoded2);
+   bitSet decoded2 = h2->decode(encoded2);
    t2 = std::chrono::high_resolution_clock::now();
    printDurationMessage("Huffman decoding (precompressed)", t1, t2);
 
    // ############################################################
 
-   float normalSize = h.getTableSize() + encoded.size();
-   float precompressedSize = h2.getTableSize() + encoded2.size() + m.getTableSize();
+   float normalSize = h->getTableSize() + encoded.size();
+   float precompressedSize = h2->getTableSize() + encoded2.size() + m->getTableSize();
 
    printConsoleLine("File size (without serialization)");
    std::cout << "File size: " << inputData.size() / 8000.0 << " KB" << std::endl
@@ -156,7 +250,7 @@ demo(const std::string& inputName, const std::string& outputName)
 
    // Compare encoded and decoded data ###########################
    printConsoleLine();
-   auto markovDecoded_ = m.decode(decoded2);
+   auto markovDecoded_ = m->decode(decoded2);
    if (inputData != decoded || inputData != markovDecoded_) {
       std::cout << "Decoding is not successful!" << std::endl;
    } else {
@@ -165,6 +259,126 @@ demo(const std::string& inputName, const std::string& outputName)
    std::cout << "Hash (original data): " << hashValue(inputData) << std::endl
              << "Hash (decoded data): " << hashValue(decoded) << std::endl
              << "Hash (decoded data, precompressed): " << hashValue(markovDecoded_) << std::endl;
+
+   if (AllocationStats::isEnabled()) {
+      printStageAllocations(inputData);
+   }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// analyze
+// Predicts the result of --encode from a sample of the input: the code
+// lengths come from the statistics of the sample (the Markov output
+// statistics are derived from the model, nothing is encoded). The table size
+// of a block and the throughput come from encoding and decoding one block
+// (at most DEF_TIMING_SIZE bytes) of the sample.
+///////////////////////////////////////////////////////////////////////////////
+
+void
+analyze(const std::string& inputName)
+{
+   auto t1 = std::chrono::high_resolution_clock::now();
+   const size_t fileSize = getFileSize(inputName);
+   bitSet sample = readSample(inputName, DEF_SAMPLE_SIZE, DEF_SAMPLE_BLOCK_SIZE);
+   sample.resize(sample.size() - sample.size() % 16); // Whole symbols for every symbol size
+
+   const size_t blockSize = CompressionLevel::get(CompressionLevel::Default).getBlockSize(fileSize);
+   const size_t numBlocks = blockSize ? (fileSize + blockSize - 1) / blockSize : 0;
+   const size_t timingSize =
+     std::min<size_t>({ sample.size(), blockSize * 8, DEF_TIMING_SIZE * 8 });
+   const bitSet timingData = slice(sample, 0, timingSize);
+
+   printConsoleLine("Input");
+   std::cout << "File size: " << fileSize / 1000.0 << " KB" << std::endl
+             << "Sample size: " << sample.size() / 8000.0 << " KB" << std::endl
+             << "Number of blocks: " << numBlocks << std::endl;
+
+   if (sample.empty()) {
+      return;
+   }
+
+   auto measure = [&](const std::function<void(EncoderChain&)>& addEncoders,
+                      size_t& tableSize,
+                      double& encodeSpeed,
+                      double& decodeSpeed) {
+      EncoderChain c;
+      addEncoders(c);
+      auto t1 = std::chrono::high_resolution_clock::now();
+      auto encoded = c.encode(timingData);
+      auto t2 = std::chrono::high_resolution_clock::now();
+      auto d = std::unique_ptr<EncoderChain>(EncoderChain::deserializerFactory(c.serialize()));
+      d->decode(encoded);
+      auto t3 = std::chrono::high_resolution_clock::now();
+
+      tableSize = c.getTableSize();
+      const double megaBytes = timingData.size() / 8e6;
+      encodeSpeed = megaBytes / std::chrono::duration<double>(t2 - t1).count();
+      decodeSpeed = megaBytes / std::chrono::duration<double>(t3 - t2).count();
+   };
+
+   printConsoleLine("Expected compression");
+   std::cout << std::left << std::setw(24) << "configuration" << std::right << std::setw(12)
+             << "bits/symbol" << std::setw(16) << "block table KB" << std::setw(12) << "size KB"
+             << std::setw(10) << "ratio" << std::setw(12) << "enc MB/s" << std::setw(12)
+             << "dec MB/s" << std::endl;
+
+   auto report = [&](const std::string& name,
+                     size_t symbolSize,
+                     double avgCodeLength,
+                     const std::function<void(EncoderChain&)>& addEncoders) {
+      size_t tableSize = 0;
+      double encodeSpeed = 0;
+      double decodeSpeed = 0;
+      measure(addEncoders, tableSize, encodeSpeed, decodeSpeed);
+
+      // Every block of the container stores its own tables
+      const double size = avgCodeLength * (fileSize * 8.0 / symbolSize) + tableSize * numBlocks;
+      std::cout << std::left << std::setw(24) << name << std::right << std::fixed
+                << std::setprecision(3) << std::setw(12) << avgCodeLength << std::setw(16)
+                << tableSize / 8000.0 << std::setw(12) << size / 8000.0 << std::setw(10)
+                << fileSize * 8.0 / size << std::setw(12) << encodeSpeed << std::setw(12)
+                << decodeSpeed << std::defaultfloat << std::endl;
+   };
+
+   for (size_t symbolSize : { 8, 16 }) {
+      SymbolStatistics s(sample, symbolSize);
+      auto h = EncoderFactory::createHuffmanTransducer(symbolSize);
+      h->setupByStatistics(s.getProbabilities());
+
+      report("huffman/" + std::to_string(symbolSize),
+             symbolSize,
+             h->getAvgCodeLength(),
+             [&](EncoderChain& c) {
+                c.addEncoder(EncoderFactory::createHuffmanTransducer(symbolSize, DEF_HUFF_THREADS));
+             });
+
+      auto m = EncoderFactory::createMarkovEncoder(symbolSize, DEF_PROBABILITY_THRESHOLD);
+      m->setup(sample);
+      if (m->isValid() && !m->getEncodedStatistics().empty()) {
+         auto h2 = EncoderFactory::createHuffmanTransducer(symbolSize);
+         h2->setupByStatistics(m->getEncodedStatistics());
+
+         report("markov_huffman/" + std::to_string(symbolSize),
+                symbolSize,
+                h2->getAvgCodeLength(),
+                [&](EncoderChain& c) {
+                   c.addEncoder(
+                     EncoderFactory::createMarkovEncoder(symbolSize, DEF_PROBABILITY_THRESHOLD));
+                   c.addEncoder(
+                     EncoderFactory::createHuffmanTransducer(symbolSize, DEF_HUFF_THREADS));
+                });
+      } else {
+         std::cout << std::left << std::setw(24) << "markov_huffman/" + std::to_string(symbolSize)
+                   << std::right << "  no unused symbol for the Markov encoder" << std::endl;
+      }
+
+      std::cout << "  entropy (bits/symbol): " << s.getEntropy()
+                << ", conditioned on the previous symbol: " << s.getConditionalEntropy()
+                << std::endl;
+   }
+
+   auto t2 = std::chrono::high_resolution_clock::now();
+   printDurationMessage("Analysis", t1, t2);
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -234,8 +448,8 @@ chainEncode(const std::string& inputName, const std::string& outputName)
 
    bitSet inputData = readBinary(inputName, 0);
 
-   auto m = std::make_unique<MarkovEncoder>(DEF_SYMBOLSIZE, DEF_PROBABILITY_THRESHOLD);
-   auto h = std::make_unique<HuffmanTransducer>(DEF_SYMBOLSIZE, DEF_HUFF_THREADS);
+   auto m = EncoderFactory::createMarkovEncoder(DEF_SYMBOLSIZE, DEF_PROBABILITY_THRESHOLD);
+   auto h = EncoderFactory::createHuffmanTransducer(DEF_SYMBOLSIZE, DEF_HUFF_THREADS);
    auto p = std::make_unique<Padder>(Padder::PaddingType::WholeBytes);
 
    // EnocderChain
@@ -279,40 +493,35 @@ chainDecode(const std::string& inputName, const std::string& outputName)
 ///////////////////////////////////////////////////////////////////////////////
 
 void
-chainSlicedEncode(const std::string& inputName, const std::string& outputName)
+chainSlicedEncode(const std::string& inputName,
+                  const std::string& outputName,
+                  const CompressionLevel& level)
 {
-
    bitSet inputData = readBinary(inputName, 0);
-   std::vector<bitSet> slices;
-   for (size_t i = 0; i < DEF_NUM_SLICES; ++i) {
-      slices.push_back(slice(
-        inputData, (inputData.size() / DEF_NUM_SLICES) * i, inputData.size() / DEF_NUM_SLICES));
-   }
-
-   std::vector<bitSet> serialized(DEF_NUM_SLICES);
-   std::vector<bitSet> encoded(DEF_NUM_SLICES);
-
-#pragma omp parallel for
-   for (size_t i = 0; i < DEF_NUM_SLICES; ++i) {
-      auto n = std::make_unique<Padder>(Padder::PaddingType::EvenBytes);
-      auto m = std::make_unique<MarkovEncoder>(DEF_SYMBOLSIZE, DEF_PROBABILITY_THRESHOLD);
-      auto h = std::make_unique<HuffmanTransducer>(DEF_SYMBOLSIZE, DEF_HUFF_THREADS);
+   auto blocks =
+     level.encodeBlocks(inputData, level.getBlockSize(inputData.size() / 8), DEF_HUFF_THREADS);
+   BlockContainer::write(outputName, blocks);
+}
 
-      // EnocderChain
-      EncoderChain c;
-      c.addEncoder(std::move(n));
-      c.addEncoder(std::move(m));
-      c.addEncoder(std::move(h));
+///////////////////////////////////////////////////////////////////////////////
+// chainSlicedAppend
+// Only the new data is encoded, the blocks of the archive stay as they are
+///////////////////////////////////////////////////////////////////////////////
 
-      encoded[i] = c.encode(slices[i]);
-      serialized[i] = c.serialize();
+void
+chainSlicedAppend(const std::string& inputName,
+                  const std::string& archiveName,
+                  const CompressionLevel& level)
+{
+   std::ifstream archive{ archiveName };
+   if (archive && !BlockContainer::isContainer(archiveName)) {
+      throw std::runtime_error("Only files written by --encode can be appended to!");
    }
 
-   auto mergedSerialized = serialize(serialized, 4);
-   auto mergedSlices = serialize(encoded, 4);
-   auto merged = serialize(std::vector<bitSet>{ mergedSerialized, mergedSlices }, 4);
-
-   writeBinary(outputName, merged);
+   bitSet inputData = readBinary(inputName, 0);
+   auto blocks =
+     level.encodeBlocks(inputData, level.getBlockSize(inputData.size() / 8), DEF_HUFF_THREADS);
+   BlockContainer::append(archiveName, blocks);
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -322,6 +531,13 @@ chainSlicedEncode(const std::string& inputName, const std::string& outputName)
 void
 chainSlicedDecode(const std::string& inputName, const std::string& outputName)
 {
+   if (BlockContainer::isContainer(inputName)) {
+      BlockContainer c(inputName);
+      writeBinary(outputName, c.decodeRange(0, c.getRawSize()));
+      return;
+   }
+
+   // Files written before the block index
    bitSet inputData = readBinary(inputName, 0);
 
    std::vector<bitSet> serialized = deserialize(inputData, 4);
@@ -337,21 +553,182 @@ chainSlicedDecode(const std::string& inputName, const std::string& outputName)
    }
 
    std::vector<bitSet> decodedSlices(DEF_NUM_SLICES);
-#pragma omp parallel for
-   for (size_t i = 0; i < DEF_NUM_SLICES; ++i) {
+   ThreadPool::parallelFor(DEF_NUM_SLICES, [&](size_t i) {
       auto d =
         std::unique_ptr<EncoderChain>(EncoderChain::deserializerFactory(serializedEncoder[i]));
       if (d && d->isValid()) {
-         auto b = d->decode(slices[i]);
-         decodedSlices[i] = b;
+         decodedSlices[i] = d->decode(std::move(slices[i]));
       } else {
          throw std::runtime_error("Could not create the deserializer.");
       }
+   });
+
+   bitSet merged;
+   {
+      Tracer::Span span("merge");
+      for (auto b : decodedSlices) {
+         append(merged, b);
+      }
+   }
+   writeBinary(outputName, merged);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// rangeDecode
+// range: <start>:<length> in bytes of the original data
+///////////////////////////////////////////////////////////////////////////////
+
+void
+rangeDecode(const std::string& inputName, const std::string& outputName, const std::string& range)
+{
+   size_t separator = range.find(':');
+   if (separator == std::string::npos) {
+      throw std::runtime_error("The range must be given as <start>:<length>!");
+   }
+   uint64_t start = std::stoull(range.substr(0, separator));
+   uint64_t length = std::stoull(range.substr(separator + 1));
+
+   BlockContainer c(inputName);
+   writeBinary(outputName, c.decodeRange(start, length));
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// pcapEncode
+// Every pcap substream is encoded with its own chain. Substreams that cannot
+// be modelled (e.g. the 24 byte global header) or do not shrink are stored
+// with a Padder-only chain.
+///////////////////////////////////////////////////////////////////////////////
+
+void
+pcapEncode(const std::string& inputName,
+           const std::string& outputName,
+           const CompressionLevel& level)
+{
+   // Substreams grow with the capture, the models only see a sample
+   CompressionLevel substreamLevel = level;
+   if (!substreamLevel.trainingSampleSize)
+      substreamLevel.trainingSampleSize = DEF_TRAINING_SAMPLE_SIZE;
+
+   bitSet inputData = readBinary(inputName, 0);
+   auto substreams = [&]() {
+      Tracer::Span span("split");
+      return PcapSplitter::split(inputData);
+   }();
+
+   std::vector<bitSet> serialized(PcapSplitter::NumSubstreams);
+   std::vector<bitSet> encoded(PcapSplitter::NumSubstreams);
+
+   ThreadPool::parallelFor(PcapSplitter::NumSubstreams, [&](size_t i) {
+      if (substreams[i].empty())
+         return;
+
+      Tracer::Span span("substream");
+      if (i != PcapSplitter::GlobalHeader) {
+         try {
+            double estimatedSize = 0;
+            std::unique_ptr<EncoderChain> c;
+            substreamLevel.selectSymbolSize(substreams[i], estimatedSize, &c, DEF_HUFF_THREADS);
+            if (c) {
+               encoded[i] = c->encode(substreams[i]);
+               serialized[i] = c->serialize();
+            }
+         } catch (std::exception& E) {
+            encoded[i].clear();
+         }
+      }
+
+      if (encoded[i].empty() ||
+          encoded[i].size() + serialized[i].size() >= substreams[i].size()) {
+         EncoderChain c;
+         c.addEncoder(std::make_unique<Padder>(Padder::PaddingType::WholeBytes));
+         encoded[i] = c.encode(substreams[i]);
+         serialized[i] = c.serialize();
+      }
+   });
+
+   // Empty substreams cannot be deserialized, the size table tells which are present.
+   // Sizes are 64 bit, the substreams of captures above 512 MB overflow 32 bit counts.
+   bitSet sizes;
+   std::vector<bitSet> presentSerialized;
+   std::vector<bitSet> presentEncoded;
+   for (size_t i = 0; i < PcapSplitter::NumSubstreams; ++i) {
+      append(sizes, convertToBitSet(substreams[i].size(), 8 * 8));
+      if (!substreams[i].empty()) {
+         presentSerialized.push_back(serialized[i]);
+         presentEncoded.push_back(encoded[i]);
+      }
    }
 
    bitSet merged;
-   for (auto b : decodedSlices) {
-      append(merged, b);
+   {
+      Tracer::Span span("merge");
+      merged = serialize(
+        std::vector<bitSet>{ sizes, serialize(presentSerialized, 8), serialize(presentEncoded, 8) },
+        8);
+   }
+
+   writeBinary(outputName, merged);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// pcapDecode
+///////////////////////////////////////////////////////////////////////////////
+
+void
+pcapDecode(const std::string& inputName, const std::string& outputName)
+{
+   bitSet inputData = readBinary(inputName, 0);
+
+   // Files written before the 64 bit sizes start with the 32 bit size of a
+   // table of 32 bit sizes
+   const size_t sizeBytes =
+     inputData.size() >= 4 * 8 &&
+         slice(inputData, 0, 4 * 8).to_ulong() == PcapSplitter::NumSubstreams * 4 * 8
+       ? 4
+       : 8;
+
+   std::vector<bitSet> serialized = deserialize(inputData, sizeBytes);
+   if (serialized.size() != 3 ||
+       serialized[0].size() != PcapSplitter::NumSubstreams * sizeBytes * 8) {
+      throw std::runtime_error("Cannot deserialize!");
+   }
+
+   auto serializedEncoder = deserialize(serialized[1], sizeBytes);
+   auto slices = deserialize(serialized[2], sizeBytes);
+
+   std::vector<size_t> sizes;
+   std::vector<size_t> present;
+   for (size_t i = 0; i < PcapSplitter::NumSubstreams; ++i) {
+      sizes.push_back(slice(serialized[0], i * sizeBytes * 8, sizeBytes * 8).to_ulong());
+      if (sizes[i])
+         present.push_back(i);
+   }
+
+   if (serializedEncoder.size() != present.size() || slices.size() != present.size()) {
+      throw std::runtime_error("Cannot deserialize!");
+   }
+
+   std::vector<bitSet> substreams(PcapSplitter::NumSubstreams);
+   std::atomic<bool> failed{ false };
+
+   ThreadPool::parallelFor(present.size(), [&](size_t i) {
+      auto d =
+        std::unique_ptr<EncoderChain>(EncoderChain::deserializerFactory(serializedEncoder[i]));
+      if (d && d->isValid())
+         substreams[present[i]] = d->decode(std::move(slices[i]));
+
+      if (substreams[present[i]].size() != sizes[present[i]])
+         failed = true;
+   });
+
+   if (failed) {
+      throw std::runtime_error("Could not decode the pcap substreams.");
+   }
+
+   bitSet merged;
+   {
+      Tracer::Span span("merge");
+      merged = PcapSplitter::merge(substreams);
    }
    writeBinary(outputName, merged);
 }
@@ -366,6 +743,11 @@ main(int argc, char** argv)
    std::string inputName = "../samples/text_data.txt";
    std::string outputName = "encoded_output";
    std::string mode = "--demo";
+   std::string range;
+   std::string tracePath;
+   int level = CompressionLevel::Default;
+   size_t numThreads = 0;
+   std::vector<int> cpus;
 
    if (argc < 2) {
       std::cout << "Missing parameters!" << std::endl;
@@ -379,23 +761,71 @@ main(int argc, char** argv)
    if (argc > 3) {
       outputName = std::string(argv[3]);
    }
+   for (int i = 4; i < argc; ++i) {
+      std::string option(argv[i]);
+      if (option == "--range" && i + 1 < argc) {
+         range = std::string(argv[++i]);
+      } else if (option == "--trace" && i + 1 < argc) {
+         tracePath = std::string(argv[++i]);
+         Tracer::setEnabled(true);
+      } else if (option == "--threads" && i + 1 < argc) {
+         numThreads = std::strtoul(argv[++i], nullptr, 10);
+      } else if (option == "--cpus" && i + 1 < argc) {
+         std::stringstream list(argv[++i]);
+         for (std::string cpu; std::getline(list, cpu, ',');)
+            cpus.push_back(std::atoi(cpu.c_str()));
+      } else if (option == "--allocations") {
+         AllocationStats::setEnabled(true);
+      } else if (option.size() == 2 && option[0] == '-' && std::isdigit(option[1])) {
+         level = option[1] - '0';
+      } else {
+         std::cout << "Unrecognized option: " << option << std::endl;
+         return 0;
+      }
+   }
 
    try {
+      ThreadPool::configure(numThreads, cpus);
+
       if (mode == "--demo") {
          demo(inputName, "demo_decoded");
+      } else if (mode == "--analyze") {
+         analyze(inputName);
       } else if (mode == "--encode") {
          auto t1 = std::chrono::high_resolution_clock::now();
-         chainSlicedEncode(inputName, outputName);
+         chainSlicedEncode(inputName, outputName, CompressionLevel::get(level));
          auto t2 = std::chrono::high_resolution_clock::now();
          printDurationMessage("Encoding", t1, t2);
+      } else if (mode == "--append") {
+         auto t1 = std::chrono::high_resolution_clock::now();
+         chainSlicedAppend(inputName, outputName, CompressionLevel::get(level));
+         auto t2 = std::chrono::high_resolution_clock::now();
+         printDurationMessage("Appending", t1, t2);
       } else if (mode == "--decode") {
          auto t1 = std::chrono::high_resolution_clock::now();
-         chainSlicedDecode(inputName, outputName);
+         if (range.empty())
+            chainSlicedDecode(inputName, outputName);
+         else
+            rangeDecode(inputName, outputName, range);
+         auto t2 = std::chrono::high_resolution_clock::now();
+         printDurationMessage("Decoding", t1, t2);
+      } else if (mode == "--pcap-encode") {
+         auto t1 = std::chrono::high_resolution_clock::now();
+         pcapEncode(inputName, outputName, CompressionLevel::get(level));
+         auto t2 = std::chrono::high_resolution_clock::now();
+         printDurationMessage("Encoding", t1, t2);
+      } else if (mode == "--pcap-decode") {
+         auto t1 = std::chrono::high_resolution_clock::now();
+         pcapDecode(inputName, outputName);
          auto t2 = std::chrono::high_resolution_clock::now();
          printDurationMessage("Decoding", t1, t2);
       } else {
          std::cout << "Unrecognized option: " << mode << std::endl;
       }
+
+      if (!tracePath.empty()) {
+         Tracer::write(tracePath);
+      }
    } catch (std::exception& E) {
       std::cout << E.what();
    }
@@ -1,10 +1,33 @@
+#include "AllocationStats.hh"
 #include "BinaryUtils.hh"
+#include "BlockContainer.hh"
+#include "CompressionLevel.hh"
+#include "CompressionMethods.h"
+#include "DeltaEncoder.hh"
+#include "EncoderChain.hh"
+#include "EncoderFactory.hh"
 #include "HuffmanTransducer.hh"
+#include "HuffmanTransducerT.hh"
 #include "MarkovEncoder.hh"
+#include "MarkovEncoderT.hh"
+#include "MarkovKernels.hh"
+#include "Padder.hh"
+#include "PcapSplitter.hh"
+#include "SymbolStatistics.hh"
+#include "ThreadPool.hh"
+#include "Tracer.hh"
+#include "TransitionSketch.hh"
 
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
 #include <iostream>
+#include <map>
 #include <memory>
 #include <string>
+#include <thread>
 #include <vector>
 
 using namespace BinaryUtils;
@@ -66,6 +89,17 @@ appendBits_default_match()
    append(b, bitSet());
    result = result && b == bitSet();
 
+   // Across the blocks, at every offset within a block
+   auto data = getExpRandomData(304);
+   for (size_t size : { 0, 1, 63, 64, 65, 130 }) {
+      bitSet expected = slice(data, 0, size);
+      b = expected;
+      append(b, slice(data, size, 304 - size));
+      for (size_t i = size; i < 304; ++i)
+         expected.push_back(data[i]);
+      result = result && b == expected && b == data;
+   }
+
    return result;
 }
 
@@ -116,6 +150,19 @@ countZeros_default_match()
    return result;
 }
 
+bool
+convertBytes_default_match()
+{
+   bool result = true;
+   auto b = readBinary("../samples/text_data.txt", 1000);
+   auto bytes = toBytes(b);
+   result = result && bytes.size() == 1000;
+   result = result && fromBytes(bytes) == b;
+
+   result = result && toBytes(bitSet(std::string("00000001"))) == std::vector<uint8_t>{ 0x80 };
+   return result;
+}
+
 bool
 sliceBitSet_default_match()
 {
@@ -124,6 +171,17 @@ sliceBitSet_default_match()
    result = result && slice(b, 0, 2) == bitSet(std::string("10"));
    result = result && slice(b, 3, 4) == bitSet(std::string("0101"));
    result = result && slice(b, 0, 7) == bitSet(std::string("0101110"));
+
+   // Across the blocks and past the end
+   auto data = getExpRandomData(304);
+   for (size_t start : { 0, 1, 63, 64, 65, 250 }) {
+      for (size_t size : { 1, 64, 100 }) {
+         bitSet expected(size);
+         for (size_t i = 0; i < size && start + i < data.size(); ++i)
+            expected[i] = data[start + i];
+         result = result && slice(data, start, size) == expected;
+      }
+   }
    return result;
 }
 
@@ -207,6 +265,1235 @@ deserialize_markov_encoding_match()
    return true;
 }
 
+bool
+deltaEncoder_roundTrip_match()
+{
+   bool result = true;
+
+   // A big endian counter and the same counter little endian
+   std::vector<uint8_t> counter;
+   for (uint32_t i = 0; i < 1000; ++i) {
+      const uint32_t value = 0x00fffff0 + i;
+      for (int shift : { 24, 16, 8, 0 })
+         counter.push_back(uint8_t(value >> shift));
+   }
+   for (auto order : { DeltaEncoder::BigEndian, DeltaEncoder::LittleEndian }) {
+      auto bytes = counter;
+      if (order == DeltaEncoder::LittleEndian)
+         for (size_t i = 0; i < bytes.size(); i += 4)
+            std::reverse(bytes.begin() + i, bytes.begin() + i + 4);
+
+      DeltaEncoder d(4, 4, DeltaEncoder::Arithmetic, order);
+      auto encoded = toBytes(d.encode(fromBytes(bytes)));
+      result = result && std::equal(encoded.begin(), encoded.begin() + 4, bytes.begin());
+      for (size_t i = 4; i < encoded.size(); i += 4) {
+         const size_t low = order == DeltaEncoder::BigEndian ? i + 3 : i;
+         result = result && encoded[low] == 1 && encoded[i + 1] == 0 && encoded[i + 2] == 0;
+      }
+   }
+
+   // Every width, stride and type, the bytes after the last field are kept
+   auto inputData = readBinary("../samples/war_and_peace.txt", 100003);
+   for (size_t width : { 1, 2, 4, 8 }) {
+      for (size_t stride : { width, width * 3, size_t(64) }) {
+         for (auto type : { DeltaEncoder::Arithmetic, DeltaEncoder::Xor }) {
+            DeltaEncoder d(width, stride, type, DeltaEncoder::LittleEndian);
+            auto encoded = d.encode(inputData);
+            const size_t tail = inputData.size() / 8 / width * width * 8;
+            auto d_ =
+              std::unique_ptr<DeltaEncoder>(DeltaEncoder::deserializerFactory(d.serialize()));
+            result = result && encoded != inputData && d_->isValid() &&
+                     d_->decode(encoded) == inputData &&
+                     slice(encoded, 0, stride * 8) == slice(inputData, 0, stride * 8) &&
+                     slice(encoded, tail, inputData.size() - tail) ==
+                       slice(inputData, tail, inputData.size() - tail);
+         }
+      }
+   }
+
+   for (auto parameters : std::vector<std::pair<size_t, size_t>>{ { 3, 3 }, { 4, 6 }, { 2, 0 } }) {
+      try {
+         DeltaEncoder d(parameters.first, parameters.second);
+         result = false;
+      } catch (std::runtime_error& E) {
+      }
+   }
+   return result;
+}
+
+bool
+deltaEncoder_chain_match()
+{
+   // Records of a big endian timestamp and sequence number and a payload
+   std::vector<uint8_t> records;
+   for (uint32_t i = 0; i < 20000; ++i) {
+      const uint32_t time = 1600000000 + i * 37 + i % 5;
+      const uint32_t sequence = 70000 + i;
+      for (uint32_t value : { time, sequence })
+         for (int shift : { 24, 16, 8, 0 })
+            records.push_back(uint8_t(value >> shift));
+      for (int j = 0; j < 8; ++j)
+         records.push_back(uint8_t("payload!"[j] + i % 3));
+   }
+   auto inputData = fromBytes(records);
+
+   auto createChain = [](bool delta) {
+      auto c = std::make_unique<EncoderChain>();
+      if (delta)
+         c->addEncoder(std::make_unique<DeltaEncoder>(4, 16));
+      c->addEncoder(std::make_unique<Padder>(Padder::PaddingType::EvenBytes));
+      c->addEncoder(EncoderFactory::createMarkovEncoder(DEF_SYMBOLSIZE, DEF_PROBABILITY_THRESHOLD));
+      c->addEncoder(EncoderFactory::createHuffmanTransducer(DEF_SYMBOLSIZE));
+      return c;
+   };
+
+   auto plain = createChain(false);
+   auto delta = createChain(true);
+   auto plainEncoded = plain->encode(inputData);
+   auto deltaEncoded = delta->encode(inputData);
+   auto d = std::unique_ptr<EncoderChain>(EncoderChain::deserializerFactory(delta->serialize()));
+   return d->decode(deltaEncoded) == inputData &&
+          deltaEncoded.size() + delta->serialize().size() <
+            (plainEncoded.size() + plain->serialize().size()) / 2;
+}
+
+// Native encoders ############################################################
+
+bool
+markovEncoderT_dynamic_match()
+{
+   auto inputData = readBinary("../samples/sip_flow.pcap", 0);
+   inputData.resize(inputData.size() - inputData.size() % DEF_SYMBOLSIZE);
+
+   MarkovEncoder m(inputData, DEF_SYMBOLSIZE, DEF_PROBABILITY_THRESHOLD);
+   MarkovEncoderT<uint16_t> t(inputData, DEF_PROBABILITY_THRESHOLD);
+
+   auto encoded = t.encode(inputData);
+   if (encoded != m.encode(inputData) || t.decode(encoded) != inputData) {
+      return false;
+   }
+
+   auto d = std::unique_ptr<MarkovEncoder>(EncoderFactory::deserializeMarkovEncoder(t.serialize()));
+   return dynamic_cast<MarkovEncoderT<uint16_t>*>(d.get()) && d->decode(encoded) == inputData;
+}
+
+bool
+markovEncoder_parallel_match()
+{
+   bool result = true;
+   auto inputData = readBinary("../samples/war_and_peace.txt", 600000);
+
+   for (size_t symbolSize : { 8, 12, 16 }) {
+      auto m = EncoderFactory::createMarkovEncoder(symbolSize, DEF_PROBABILITY_THRESHOLD);
+      m->setup(inputData);
+
+      // At least three chunks, the result must not depend on the number of threads
+      ThreadPool::configure(1);
+      auto serial = m->encode(inputData);
+      ThreadPool::configure(4);
+      auto parallel = m->encode(inputData);
+      ThreadPool::configure(0);
+
+      result = result && serial == parallel && m->decode(parallel) == inputData;
+   }
+   return result;
+}
+
+bool
+markovEncoder_restart_match()
+{
+   bool result = true;
+   auto inputData = readBinary("../samples/text_data.txt", 100000);
+
+   for (size_t symbolSize : { 8, 12, 16 }) {
+      auto m = EncoderFactory::createMarkovEncoder(symbolSize, DEF_PROBABILITY_THRESHOLD);
+      m->setup(inputData);
+      m->setRestartInterval(1000);
+      auto encoded = m->encode(inputData);
+
+      // The interval is rounded up to whole blocks and survives serialization
+      auto d =
+        std::unique_ptr<MarkovEncoder>(EncoderFactory::deserializeMarkovEncoder(m->serialize()));
+      result = result && m->getRestartInterval() == 1024 && d->getRestartInterval() == 1024;
+
+      ThreadPool::configure(4);
+      result = result && d->decode(encoded) == inputData;
+      ThreadPool::configure(0);
+
+      // Restart points are literals
+      for (size_t i = 0; i < encoded.size(); i += 1024 * symbolSize)
+         result = result && slice(encoded, i, symbolSize) == slice(inputData, i, symbolSize);
+   }
+
+   MarkovEncoder m(inputData, 16, DEF_PROBABILITY_THRESHOLD);
+   MarkovEncoderT<uint16_t> t(inputData, DEF_PROBABILITY_THRESHOLD);
+   m.setRestartInterval(64);
+   t.setRestartInterval(64);
+   return result && m.encode(inputData) == t.encode(inputData);
+}
+
+bool
+markovEncoder_predictionStats_match()
+{
+   bool result = true;
+   auto inputData = readBinary("../samples/text_data.txt", 100000);
+
+   for (size_t symbolSize : { 8, 12, 16 }) {
+      auto m = EncoderFactory::createMarkovEncoder(symbolSize, DEF_PROBABILITY_THRESHOLD);
+      m->setup(inputData);
+      m->setRestartInterval(1000);
+      m->setCollectPredictionStats(true);
+      m->encode(inputData);
+      auto stats = m->getPredictionStats(4);
+
+      // Reference from the encoding map, restart points every 1024 symbols
+      const auto map = m->getEncodingMap();
+      uint64_t hits = 0, misses = 0, unpredicted = 0;
+      for (size_t i = 0; i < inputData.size() / symbolSize; ++i) {
+         auto it = map.find(slice(inputData, (i ? i - 1 : 0) * symbolSize, symbolSize));
+         if (i % 1024 == 0 || it == map.end())
+            ++unpredicted;
+         else if (it->second == slice(inputData, i * symbolSize, symbolSize))
+            ++hits;
+         else
+            ++misses;
+      }
+      result = result && stats.hits == hits && stats.misses == misses &&
+               stats.unpredicted == unpredicted && hits && stats.topMisses.size() == 4;
+      for (size_t i = 1; i < stats.topMisses.size(); ++i)
+         result = result && stats.topMisses[i - 1].misses >= stats.topMisses[i].misses;
+   }
+
+   // The fused Markov + Huffman encode of a chain counts the same
+   auto m = EncoderFactory::createMarkovEncoder(DEF_SYMBOLSIZE, DEF_PROBABILITY_THRESHOLD);
+   m->setup(inputData);
+   m->setCollectPredictionStats(true);
+   m->encode(inputData);
+   auto expected = m->getPredictionStats();
+
+   // Trained by the chain, so that it is fused with the HuffmanTransducer
+   auto fused = EncoderFactory::createMarkovEncoder(DEF_SYMBOLSIZE, DEF_PROBABILITY_THRESHOLD);
+   fused->setCollectPredictionStats(true);
+   MarkovEncoder* markov = fused.get();
+   EncoderChain c;
+   c.addEncoder(std::move(fused));
+   c.addEncoder(EncoderFactory::createHuffmanTransducer(DEF_SYMBOLSIZE));
+   c.encode(inputData);
+   auto stats = markov->getPredictionStats();
+   return result && stats.hits == expected.hits && stats.misses == expected.misses &&
+          stats.unpredicted == expected.unpredicted &&
+          stats.topMisses.front().context == expected.topMisses.front().context;
+}
+
+template<typename T>
+bool
+markovKernels_reference_match(MarkovKernels::Mode mode)
+{
+   const size_t numSymbols = 100003;
+   const T unused = T(~T(0));
+
+   // Random symbols except the unused one, every third symbol without a prediction
+   auto random = getExpRandomData(numSymbols * sizeof(T) * 8);
+   auto inputBlocks = getBlocks(random);
+   for (size_t i = 0; i < numSymbols; ++i) {
+      if (getSymbol<T>(inputBlocks.data(), i) == unused)
+         setSymbol<T>(inputBlocks.data(), i, 0);
+   }
+   const auto inputData = fromBlocks(std::move(inputBlocks), random.size());
+   const auto* input = getBlocks(inputData).data();
+
+   std::vector<uint32_t> table(size_t(1) << (sizeof(T) * 8));
+   for (size_t s = 0; s < table.size(); ++s)
+      table[s] = s % 3 ? T(s + 1) : UINT32_MAX;
+
+   auto blocks = getBlocks(inputData);
+   MarkovKernels::encode<T>(input, blocks.data(), 1, numSymbols, table.data(), unused, mode);
+
+   for (size_t i = 1; i < numSymbols; ++i) {
+      T symbol = getSymbol<T>(input, i);
+      uint32_t predicted = table[getSymbol<T>(input, i - 1)];
+      T expected = mode == MarkovKernels::Mode::Xor
+                     ? T(symbol ^ (predicted == UINT32_MAX ? 0 : predicted))
+                     : (symbol == predicted ? unused : symbol);
+      if (getSymbol<T>(blocks.data(), i) != expected)
+         return false;
+   }
+
+   MarkovKernels::decode<T>(blocks.data(), 1, numSymbols, table.data(), unused, mode);
+   return blocks == getBlocks(inputData);
+}
+
+bool
+markovKernels_default_match()
+{
+   return markovKernels_reference_match<uint8_t>(MarkovKernels::Mode::Xor) &&
+          markovKernels_reference_match<uint8_t>(MarkovKernels::Mode::UnusedSymbol) &&
+          markovKernels_reference_match<uint16_t>(MarkovKernels::Mode::Xor) &&
+          markovKernels_reference_match<uint16_t>(MarkovKernels::Mode::UnusedSymbol);
+}
+
+bool
+huffmanTransducerT_dynamic_match()
+{
+   bool result = true;
+   auto inputData = readBinary("../samples/text_data.txt", 100000);
+
+   for (size_t symbolSize : { 8, 16 }) {
+      auto h = EncoderFactory::createHuffmanTransducer(symbolSize);
+      h->setup(inputData);
+      auto encoded = h->encode(inputData);
+
+      // The dynamic decoder must understand the native encoder and vice versa
+      auto d = std::unique_ptr<HuffmanTransducer>(
+        HuffmanTransducer::deserializerFactory(h->serialize()));
+      result = result && d->decode(encoded) == inputData;
+      result = result && h->decode(d->encode(inputData)) == inputData;
+      result = result && h->getTableSize() == d->getTableSize();
+   }
+   return result;
+}
+
+bool
+huffmanTransducer_escape_match()
+{
+   bool result = true;
+   auto inputData = readBinary("../samples/binary_data", 60000);
+
+   // Only the 256 most frequent symbols get a code, the rest is escaped
+   for (size_t symbolSize : { 8, 24, 32 }) {
+      auto h = EncoderFactory::createHuffmanTransducer(symbolSize);
+      h->setMaxCodes(256);
+      h->setup(inputData);
+      result = result && h->getEncodingMap().size() <= 256 + 1;
+      result = result && (symbolSize == 8 || h->hasEscape());
+
+      auto encoded = h->encode(inputData);
+      result = result && h->decode(encoded) == inputData;
+
+      auto d = std::unique_ptr<HuffmanTransducer>(
+        EncoderFactory::deserializeHuffmanTransducer(h->serialize()));
+      result = result && d->hasEscape() == h->hasEscape();
+      result = result && d->decode(encoded) == inputData;
+   }
+   return result;
+}
+
+// EncoderChain ###############################################################
+
+bool
+encoderChain_fused_match()
+{
+   bool result = true;
+   auto inputData = readBinary("../samples/war_and_peace.txt", 200001);
+
+   for (size_t restartInterval : { 0, 4096 }) {
+      auto createMarkov = [&]() {
+         auto m = EncoderFactory::createMarkovEncoder(DEF_SYMBOLSIZE, DEF_PROBABILITY_THRESHOLD);
+         m->setRestartInterval(restartInterval);
+         return m;
+      };
+
+      EncoderChain c;
+      c.addEncoder(std::make_unique<Padder>(Padder::PaddingType::EvenBytes));
+      c.addEncoder(createMarkov());
+      c.addEncoder(EncoderFactory::createHuffmanTransducer(DEF_SYMBOLSIZE));
+      auto encoded = c.encode(inputData);
+
+      // The same encoders one after the other
+      auto padded = Padder(Padder::PaddingType::EvenBytes).encode(inputData);
+      auto m = createMarkov();
+      m->setup(padded);
+      auto markovEncoded = m->encode(padded);
+      auto h = EncoderFactory::createHuffmanTransducer(DEF_SYMBOLSIZE);
+      h->setup(markovEncoded);
+      result = result && encoded == h->encode(markovEncoded);
+
+      auto d = std::unique_ptr<EncoderChain>(EncoderChain::deserializerFactory(c.serialize()));
+      result = result && d->decode(encoded) == inputData;
+   }
+   return result;
+}
+
+bool
+encoderChain_inPlace_match()
+{
+   bool result = true;
+   auto inputData = readBinary("../samples/war_and_peace.txt", 100001);
+
+   for (auto mode : { Padder::WholeBytes, Padder::EvenBytes, Padder::OddBytes }) {
+      auto data = inputData;
+      data.resize(data.size() + 3);
+      Padder p(mode), q(mode);
+      auto padded = p.encode(data);
+      auto inPlace = data;
+      q.encodeInPlace(inPlace);
+      result = result && padded == inPlace && p.serialize() == q.serialize();
+      q.decodeInPlace(inPlace);
+      result = result && inPlace == data;
+   }
+
+   // Symbol sizes that differ, so that no stages are fused
+   auto createChain = []() {
+      auto c = std::make_unique<EncoderChain>();
+      c->addEncoder(std::make_unique<Padder>(Padder::PaddingType::EvenBytes));
+      c->addEncoder(EncoderFactory::createMarkovEncoder(16, DEF_PROBABILITY_THRESHOLD));
+      c->addEncoder(EncoderFactory::createHuffmanTransducer(8));
+      return c;
+   };
+   auto c = createChain();
+   auto encoded = c->encode(inputData);
+   auto copy = inputData;
+   result = result && createChain()->encode(std::move(copy)) == encoded;
+
+   auto d = std::unique_ptr<EncoderChain>(EncoderChain::deserializerFactory(c->serialize()));
+   result = result && d->decode(std::move(encoded)) == inputData;
+   return result;
+}
+
+bool
+encoderChain_sampled_match()
+{
+   bool result = true;
+   auto inputData = readBinary("../samples/war_and_peace.txt", 400000);
+
+   // Rare symbols that the sample may miss, also candidates for the unused symbol
+   auto bytes = toBytes(inputData);
+   for (size_t i = 0; i < 16; ++i)
+      bytes[150001 + 7 * i] = uint8_t(0xff - i);
+   inputData = fromBytes(bytes);
+
+   auto sample = sampleBlocks(inputData, 8192, 4096, 24);
+   // Blocks of 4096 bytes rounded down to whole 64 bit words and symbols
+   result = result && sample.size() == 2 * 32640 &&
+            slice(sample, 0, 32640) == slice(inputData, 0, 32640);
+
+   for (size_t symbolSize : { 8, 16 }) {
+      auto m = EncoderFactory::createMarkovEncoder(symbolSize, DEF_PROBABILITY_THRESHOLD);
+      m->setTrainingSampleSize(16384);
+      auto h = EncoderFactory::createHuffmanTransducer(symbolSize);
+      h->setTrainingSampleSize(16384);
+
+      EncoderChain c;
+      c.addEncoder(std::make_unique<Padder>(Padder::PaddingType::EvenBytes));
+      c.addEncoder(std::move(m));
+      c.addEncoder(std::move(h));
+      auto encoded = c.encode(inputData);
+
+      auto d = std::unique_ptr<EncoderChain>(EncoderChain::deserializerFactory(c.serialize()));
+      result = result && d->decode(encoded) == inputData;
+
+      // Huffman alone, the symbols missing from the sample go through the escape
+      auto h2 = EncoderFactory::createHuffmanTransducer(symbolSize);
+      h2->setTrainingSampleSize(16384);
+      h2->setup(inputData);
+      result = result && h2->decode(h2->encode(inputData)) == inputData;
+   }
+   return result;
+}
+
+// SymbolStatistics ###########################################################
+
+bool
+matchProbabilities(const CodeProbabilityMap& a, const CodeProbabilityMap& b)
+{
+   if (a.size() != b.size())
+      return false;
+   for (const auto& p : a) {
+      auto it = b.find(p.first);
+      if (it == b.end() || std::abs(it->second - p.second) > 1e-9)
+         return false;
+   }
+   return true;
+}
+
+bool
+symbolStatistics_default_match()
+{
+   bool result = true;
+   auto inputData = readBinary("../samples/text_data.txt", 96000);
+
+   for (size_t symbolSize : { 8, 12, 16 }) {
+      SymbolStatistics s(inputData, symbolSize);
+      auto probabilities = getStatistics(inputData, symbolSize);
+      result = result && matchProbabilities(s.getProbabilities(), probabilities);
+
+      // The largest symbol that does not occur
+      uint64_t unused = 0;
+      result = result && s.findUnusedSymbol(unused);
+      for (uint64_t u = unused + 1; u < (uint64_t(1) << symbolSize); ++u)
+         result = result && probabilities.count(convertToBitSet(u, symbolSize));
+      result = result && !probabilities.count(convertToBitSet(unused, symbolSize));
+   }
+   return result;
+}
+
+bool
+symbolStatistics_markovOutput_match()
+{
+   bool result = true;
+   auto inputData = readBinary("../samples/war_and_peace.txt", 200000);
+
+   for (size_t restartInterval : { 0, 64 }) {
+      auto m = EncoderFactory::createMarkovEncoder(DEF_SYMBOLSIZE, DEF_PROBABILITY_THRESHOLD);
+      m->setRestartInterval(restartInterval);
+      m->setup(inputData);
+
+      // Derived from the model without looking at the encoded data
+      auto encoded = m->encode(inputData);
+      result = result && matchProbabilities(m->getEncodedStatistics(),
+                                            getStatistics(encoded, DEF_SYMBOLSIZE));
+   }
+   return result;
+}
+
+bool
+symbolStatistics_entropy_match()
+{
+   bool result = true;
+   auto inputData = readBinary("../samples/text_data.txt", 96000);
+
+   for (size_t symbolSize : { 8, 16 }) {
+      SymbolStatistics s(inputData, symbolSize);
+      auto h = EncoderFactory::createHuffmanTransducer(symbolSize);
+      h->setup(inputData);
+      result = result && std::abs(s.getEntropy() - h->getEntropy()) < 1e-9;
+      result = result && s.getConditionalEntropy() > 0 &&
+               s.getConditionalEntropy() < s.getEntropy();
+   }
+
+   // Two blocks of 1000 bytes from the beginning and the middle of the file
+   auto sample = readSample("../samples/text_data.txt", 2000, 1000);
+   auto file = readBinary("../samples/text_data.txt", 0);
+   const size_t middle = getFileSize("../samples/text_data.txt") / 1000 / 2 * 1000;
+   bitSet expected = slice(file, 0, 8000);
+   append(expected, slice(file, middle * 8, 8000));
+   result = result && sample == expected;
+
+   return result;
+}
+
+bool
+symbolStatistics_parallel_match()
+{
+   bool result = true;
+   auto inputData = readBinary("../samples/war_and_peace.txt", 2400000);
+
+   // Enough symbols for at least three chunks, the result must not depend on
+   // the number of threads
+   for (size_t symbolSize : { 8, 12, 16, 24 }) {
+      ThreadPool::configure(1);
+      SymbolStatistics serial(inputData, symbolSize);
+      auto m = EncoderFactory::createMarkovEncoder(symbolSize, DEF_PROBABILITY_THRESHOLD);
+      m->setup(inputData);
+      auto serialEncoded = m->encode(inputData);
+
+      ThreadPool::configure(4);
+      SymbolStatistics parallel(inputData, symbolSize);
+      m->setup(inputData);
+      auto parallelEncoded = m->encode(inputData);
+      ThreadPool::configure(0);
+
+      uint64_t serialUnused = 0, parallelUnused = 0;
+      serial.findUnusedSymbol(serialUnused);
+      parallel.findUnusedSymbol(parallelUnused);
+      result = result && serial.getCounts() == parallel.getCounts() &&
+               serialUnused == parallelUnused &&
+               std::abs(serial.getConditionalEntropy() - parallel.getConditionalEntropy()) < 1e-9;
+
+      auto expected = serial.getPredictions(DEF_PROBABILITY_THRESHOLD);
+      auto predictions = parallel.getPredictions(DEF_PROBABILITY_THRESHOLD);
+      result = result && !predictions.empty() && expected.size() == predictions.size();
+      for (const auto& p : predictions) {
+         auto it = expected.find(p.first);
+         result = result && it != expected.end() && it->second.next == p.second.next &&
+                  it->second.count == p.second.count;
+      }
+
+      result =
+        result && serialEncoded == parallelEncoded && m->decode(parallelEncoded) == inputData;
+   }
+   return result;
+}
+
+bool
+transitionSketch_predictions_match()
+{
+   bool result = true;
+   auto inputData = readBinary("../samples/war_and_peace.txt", 200000);
+
+   for (size_t symbolSize : { 8, 16 }) {
+      // Dense for 8 bit symbols, hashed for 16 bit ones
+      const size_t budget = 256 << 10;
+      SymbolStatistics exact(inputData, symbolSize);
+      SymbolStatistics bounded(inputData, symbolSize, true, budget);
+      TransitionSketch sketch(symbolSize, budget);
+      result = result && sketch.isDense() == (symbolSize == 8) && sketch.getMemoryUsage() <= budget;
+
+      std::map<std::pair<uint64_t, uint64_t>, uint64_t> transitions;
+      const size_t numSymbols = inputData.size() / symbolSize;
+      for (size_t i = 1; i < numSymbols; ++i)
+         ++transitions[{ slice(inputData, (i - 1) * symbolSize, symbolSize).to_ulong(),
+                         slice(inputData, i * symbolSize, symbolSize).to_ulong() }];
+
+      // Guaranteed counts never overestimate, most predictions survive
+      auto expected = exact.getPredictions(DEF_PROBABILITY_THRESHOLD);
+      auto predictions = bounded.getPredictions(DEF_PROBABILITY_THRESHOLD);
+      size_t matches = 0;
+      for (const auto& p : predictions) {
+         result = result && p.second.count <= transitions[{ p.first, p.second.next }];
+         auto it = expected.find(p.first);
+         matches += it != expected.end() && it->second.next == p.second.next;
+      }
+      result = result && matches >= expected.size() * 9 / 10;
+   }
+
+   try {
+      TransitionSketch tooSmall(16, 100);
+      result = false;
+   } catch (std::exception& E) {
+   }
+
+   // Round trips of the fused chain on text and on high entropy data
+   for (auto path : { "../samples/text_data.txt", "../samples/binary_data" }) {
+      auto data = readBinary(path, 100000);
+      auto m = EncoderFactory::createMarkovEncoder(DEF_SYMBOLSIZE, DEF_PROBABILITY_THRESHOLD);
+      m->setTrainingMemoryBudget(64 << 10);
+      m->setRestartInterval(1024);
+      EncoderChain c;
+      c.addEncoder(std::move(m));
+      c.addEncoder(EncoderFactory::createHuffmanTransducer(DEF_SYMBOLSIZE));
+      auto encoded = c.encode(data);
+      auto d = std::unique_ptr<EncoderChain>(EncoderChain::deserializerFactory(c.serialize()));
+      result = result && d->decode(encoded) == data;
+   }
+   return result;
+}
+
+// BlockContainer #############################################################
+
+bool
+blockContainer_range_match()
+{
+   bool result = true;
+   auto inputData = readBinary("../samples/text_data.txt", 50000);
+   const std::string path = "blockContainer_test.bin";
+   const size_t blockSize = 16000;
+
+   // The third block is stored
+   std::vector<BlockContainer::Block> blocks;
+   for (size_t offset = 0; offset < inputData.size() / 8; offset += blockSize) {
+      const size_t rawSize = std::min(blockSize, inputData.size() / 8 - offset);
+      auto raw = slice(inputData, offset * 8, rawSize * 8);
+      if (blocks.size() == 2) {
+         blocks.push_back({ raw, rawSize, BlockContainer::Stored });
+         continue;
+      }
+
+      EncoderChain c;
+      c.addEncoder(std::make_unique<Padder>(Padder::PaddingType::EvenBytes));
+      c.addEncoder(EncoderFactory::createMarkovEncoder(DEF_SYMBOLSIZE, DEF_PROBABILITY_THRESHOLD));
+      c.addEncoder(EncoderFactory::createHuffmanTransducer(DEF_SYMBOLSIZE));
+      auto encoded = c.encode(raw);
+      blocks.push_back({ BlockContainer::packBlock(c.serialize(), encoded), rawSize, 0 });
+   }
+   BlockContainer::write(path, blocks);
+
+   result = result && BlockContainer::isContainer(path) &&
+            !BlockContainer::isContainer("../samples/text_data.txt");
+
+   BlockContainer c(path);
+   result = result && c.getRawSize() == 50000 && c.getIndex().size() == 4 &&
+            c.getIndex()[2].flags == BlockContainer::Stored && c.getIndex()[2].length == 16000;
+
+   // Inside one block, across blocks, inside and across the stored block, the
+   // last bytes and the whole data
+   for (auto range : std::vector<std::pair<size_t, size_t>>{ { 100, 10 },
+                                                             { 15990, 20 },
+                                                             { 1000, 40000 },
+                                                             { 33000, 100 },
+                                                             { 47990, 20 },
+                                                             { 49999, 1 },
+                                                             { 0, 50000 } })
+      result = result && c.decodeRange(range.first, range.second) ==
+                           slice(inputData, range.first * 8, range.second * 8);
+
+   try {
+      c.decodeRange(49999, 2);
+      result = false;
+   } catch (std::exception& E) {
+   }
+
+   std::remove(path.c_str());
+   return result;
+}
+
+bool
+blockContainer_append_match()
+{
+   bool result = true;
+   auto inputData = readBinary("../samples/war_and_peace.txt", 500000);
+   const std::string path = "blockContainer_append_test.bin";
+   const auto& level = CompressionLevel::get(CompressionLevel::Default);
+   const size_t blockSize = 64000;
+
+   // A missing file is created
+   std::remove(path.c_str());
+   BlockContainer::append(path, level.encodeBlocks(slice(inputData, 0, 300000 * 8), blockSize));
+   std::vector<BlockContainer::IndexEntry> index;
+   uint64_t dataSize = 0;
+   {
+      BlockContainer c(path);
+      index = c.getIndex();
+      dataSize = c.getDataSize();
+   }
+   std::ifstream in{ path, std::ios::binary };
+   std::vector<char> oldBytes(dataSize);
+   in.read(oldBytes.data(), oldBytes.size());
+   in.close();
+
+   BlockContainer::append(path,
+                          level.encodeBlocks(slice(inputData, 300000 * 8, 200000 * 8), blockSize));
+
+   // The old blocks and their entries are untouched
+   BlockContainer c(path);
+   result = result && c.getRawSize() == 500000 && c.getIndex().size() == index.size() + 4 &&
+            c.getIndex()[index.size()].rawOffset == 300000 &&
+            c.getIndex()[index.size()].compressedOffset == dataSize;
+   for (size_t i = 0; i < index.size(); ++i)
+      result = result && c.getIndex()[i].compressedOffset == index[i].compressedOffset &&
+               c.getIndex()[i].length == index[i].length;
+
+   in.open(path, std::ios::binary);
+   std::vector<char> newBytes(dataSize);
+   in.read(newBytes.data(), newBytes.size());
+   result = result && newBytes == oldBytes && c.decodeRange(0, 500000) == inputData &&
+            c.decodeRange(299990, 20) == slice(inputData, 299990 * 8, 20 * 8);
+
+   std::remove(path.c_str());
+   return result;
+}
+
+bool
+blockContainer_version_match()
+{
+   bool result = true;
+   const std::string path = "blockContainer_version_test.bin";
+
+   // A stored block of 4 bytes, its index entry without flags and the footer
+   // of version 1
+   std::vector<uint8_t> bytes{ 'a', 'b', 'c', 'd' };
+   std::vector<BlockContainer::Block> blocks{ { fromBytes(bytes), 4, BlockContainer::Stored } };
+   for (uint64_t value : { 0ull, 0ull, 4ull, 4ull, 1ull, 0x5844494b4c425448ull })
+      for (int i = 0; i < 8; ++i)
+         bytes.push_back(uint8_t(value >> 8 * i));
+   std::ofstream{ path, std::ios::binary }.write(reinterpret_cast<const char*>(bytes.data()),
+                                                  bytes.size());
+
+   result = result && BlockContainer::isContainer(path);
+   try {
+      BlockContainer c(path);
+      result = false;
+   } catch (std::exception& E) {
+      result = result && std::string(E.what()).find("version 1") != std::string::npos;
+   }
+
+   // Appending leaves the old container as it is
+   try {
+      BlockContainer::append(path, blocks);
+      result = false;
+   } catch (std::exception& E) {
+   }
+   std::ifstream in{ path, std::ios::binary | std::ios::ate };
+   result = result && size_t(in.tellg()) == bytes.size();
+   in.close();
+
+   // A newer version than known is rejected as well
+   auto packed = BlockContainer::pack(blocks);
+   packed[packed.size() - 16]++;
+   try {
+      BlockContainer c(packed.data(), packed.size());
+      result = false;
+   } catch (std::exception& E) {
+      result = result && std::string(E.what()).find("version 3") != std::string::npos;
+   }
+
+   std::remove(path.c_str());
+   return result;
+}
+
+// CompressionLevel ###########################################################
+
+bool
+compressionLevel_roundTrip_match()
+{
+   bool result = true;
+   auto inputData = readBinary("../samples/war_and_peace.txt", 100001);
+
+   for (int level : { CompressionLevel::Min - 1, CompressionLevel::Max + 1 }) {
+      try {
+         CompressionLevel::get(level);
+         result = false;
+      } catch (std::out_of_range& E) {
+      }
+   }
+
+   // The default level is the chain --encode used before the levels
+   auto defaultLevel = CompressionLevel::get(CompressionLevel::Default);
+   result = result && defaultLevel.symbolSize == DEF_SYMBOLSIZE && defaultLevel.markov &&
+            defaultLevel.threshold == DEF_PROBABILITY_THRESHOLD &&
+            !defaultLevel.trainingSampleSize;
+
+   for (int level = CompressionLevel::Min; level <= CompressionLevel::Max; ++level) {
+      auto c = CompressionLevel::get(level).createChain();
+      auto encoded = c->encode(inputData);
+      auto d = std::unique_ptr<EncoderChain>(EncoderChain::deserializerFactory(c->serialize()));
+      result = result && CompressionLevel::get(level).level == level &&
+               d->decode(encoded) == inputData;
+   }
+   return result;
+}
+
+bool
+compressionLevel_symbolSize_match()
+{
+   bool result = true;
+   auto inputData = readBinary("../samples/text_data.txt", 200001);
+   const std::string path = "symbolSize_test.bin";
+
+   // The estimates are close to the packed blocks, text prefers 16 bit symbols
+   for (int l : { 1, 6 }) {
+      for (size_t symbolSize : { 8, 16 }) {
+         auto level = CompressionLevel::get(l);
+         level.symbolSize = symbolSize;
+         auto c = level.createChain();
+         auto encoded = c->encode(inputData);
+         double packedSize = BlockContainer::packBlock(c->serialize(), encoded).size();
+         result = result && std::abs(level.estimateSize(inputData) - packedSize) < packedSize / 100;
+      }
+
+      double estimatedSize = 0;
+      auto selected = CompressionLevel::get(l).selectSymbolSize(inputData, estimatedSize);
+      result = result && selected.symbolSize == 16 && selected.level == l &&
+               std::abs(estimatedSize - selected.estimateSize(inputData)) < 1;
+   }
+
+   // The chain of the estimate encodes with the trained models as estimated
+   for (int l : { 1, 6 }) {
+      double estimatedSize = 0;
+      std::unique_ptr<EncoderChain> c;
+      CompressionLevel::get(l).selectSymbolSize(inputData, estimatedSize, &c);
+      auto encoded = c->encode(inputData);
+      double packedSize = BlockContainer::packBlock(c->serialize(), encoded).size();
+      auto d = std::unique_ptr<EncoderChain>(EncoderChain::deserializerFactory(c->serialize()));
+      result = result && std::abs(estimatedSize - packedSize) < packedSize / 100 &&
+               d->decode(encoded) == inputData;
+   }
+
+   // Markov cannot encode high entropy data, it is estimated without as by level 1
+   double estimatedSize = 0;
+   double level1Size = 0;
+   std::unique_ptr<EncoderChain> binaryChain;
+   auto binaryData = readBinary("../samples/binary_data", 100000);
+   auto selected = CompressionLevel::get(CompressionLevel::Default)
+                     .selectSymbolSize(binaryData, estimatedSize, &binaryChain);
+   CompressionLevel::get(1).selectSymbolSize(binaryData, level1Size);
+   result = result && !selected.markov && estimatedSize <= level1Size &&
+            binaryChain->getNumEncoders() == 2;
+
+   // The decoder checks the chain against the recorded symbol size
+   auto c = CompressionLevel::get(CompressionLevel::Default).createChain();
+   auto packed = BlockContainer::packBlock(c->serialize(), c->encode(inputData));
+   BlockContainer::write(path,
+                         { { packed, 200001, BlockContainer::getSymbolSizeFlag(16) },
+                           { packed, 200001, BlockContainer::getSymbolSizeFlag(8) } });
+   BlockContainer container(path);
+   result = result && BlockContainer::getSymbolSize(container.getIndex()[0].flags) == 16 &&
+            container.decodeBlock(0) == inputData;
+   try {
+      container.decodeBlock(1);
+      result = false;
+   } catch (std::exception& E) {
+   }
+
+   std::remove(path.c_str());
+   return result;
+}
+
+bool
+compressionLevel_highEntropy_match()
+{
+   bool result = true;
+   auto inputData = readBinary("../samples/binary_data", 1000000);
+
+   // Every byte value occurs, so Markov cannot encode the blocks: the higher
+   // levels still compress as well as level 1 instead of storing them
+   size_t level1Size = 0;
+   for (int l = CompressionLevel::Min; l <= CompressionLevel::Max; ++l) {
+      const auto level = CompressionLevel::get(l);
+      auto blocks = level.encodeBlocks(inputData, level.getBlockSize(inputData.size() / 8));
+      const size_t size = BlockContainer::pack(blocks).size();
+      if (l == CompressionLevel::Min)
+         level1Size = size;
+      result = result && size < inputData.size() / 8 && size <= level1Size;
+   }
+   return result;
+}
+
+// CompressionMethods #########################################################
+
+bool
+compressionMethods_buffer_match()
+{
+   auto input = toBytes(readBinary("../samples/war_and_peace.txt", 300001));
+   std::vector<uint8_t> compressed(cm_compress_bound(input.size()));
+   std::vector<uint8_t> decompressed(input.size());
+   size_t compressedSize = 0;
+   size_t decompressedSize = 0;
+   uint64_t rawSize = 0;
+
+   bool result = cm_compress(input.data(),
+                             input.size(),
+                             compressed.data(),
+                             compressed.size(),
+                             &compressedSize,
+                             CM_DEFAULT_LEVEL) == CM_OK &&
+                 compressedSize < input.size();
+   compressed.resize(compressedSize);
+   result = result &&
+            cm_decompressed_size(compressed.data(), compressed.size(), &rawSize) == CM_OK &&
+            rawSize == input.size() &&
+            cm_decompress(compressed.data(),
+                          compressed.size(),
+                          decompressed.data(),
+                          decompressed.size(),
+                          &decompressedSize) == CM_OK &&
+            decompressed == input;
+
+   // Errors are returned, the required size with them
+   std::vector<uint8_t> small(10);
+   size_t size = 0;
+   result = result &&
+            cm_decompress(compressed.data(), compressed.size(), small.data(), 10, &size) ==
+              CM_BUFFER_TOO_SMALL &&
+            size == input.size() &&
+            cm_compress(input.data(), input.size(), small.data(), 10, &size, 1) ==
+              CM_BUFFER_TOO_SMALL &&
+            cm_compress(input.data(), input.size(), small.data(), 10, &size, 10) ==
+              CM_INVALID_ARGUMENT;
+
+   auto corrupt = compressed;
+   corrupt.back() ^= 1;
+   result = result &&
+            cm_decompress(
+              corrupt.data(), corrupt.size(), decompressed.data(), decompressed.size(), &rawSize) ==
+              CM_CORRUPT_DATA &&
+            cm_decompress_range(
+              compressed.data(), compressed.size(), input.size() - 5, 10, small.data()) ==
+              CM_INVALID_ARGUMENT;
+
+   // Only the covering blocks are decoded
+   std::vector<uint8_t> range(1000);
+   result = result &&
+            cm_decompress_range(
+              compressed.data(), compressed.size(), 150000, range.size(), range.data()) == CM_OK &&
+            std::equal(range.begin(), range.end(), input.begin() + 150000);
+
+   // Independent calls run concurrently, a shared model included
+   cm_model* model = nullptr;
+   result = result && cm_model_train(input.data(), 100000, 4, &model) == CM_OK;
+   std::atomic<bool> failed{ false };
+   std::vector<std::thread> threads;
+
+   for (size_t i = 0; i < 8; ++i) {
+      threads.emplace_back([&, i]() {
+         std::vector<uint8_t> part(input.begin() + i * 25000, input.begin() + (i + 1) * 25000);
+         std::vector<uint8_t> packed(cm_compress_bound(part.size()));
+         std::vector<uint8_t> unpacked(part.size());
+         size_t packedSize = 0;
+         size_t unpackedSize = 0;
+         cm_status status =
+           i % 2 ? cm_compress_with_model(
+                     model, part.data(), part.size(), packed.data(), packed.size(), &packedSize)
+                 : cm_compress(
+                     part.data(), part.size(), packed.data(), packed.size(), &packedSize, i + 1);
+         if (status == CM_OK)
+            status = cm_decompress(
+              packed.data(), packedSize, unpacked.data(), unpacked.size(), &unpackedSize);
+         if (status != CM_OK || unpacked != part)
+            failed = true;
+      });
+   }
+
+   for (auto& t : threads)
+      t.join();
+   cm_model_free(model);
+   return result && !failed;
+}
+
+static int
+appendTo(void* opaque, const void* data, size_t size)
+{
+   auto* out = static_cast<std::vector<uint8_t>*>(opaque);
+   auto* bytes = static_cast<const uint8_t*>(data);
+   out->insert(out->end(), bytes, bytes + size);
+   return 0;
+}
+
+static int
+readFrom(void* opaque, void* buffer, size_t size, uint64_t offset)
+{
+   auto* in = static_cast<const std::vector<uint8_t>*>(opaque);
+   if (offset > in->size() || size > in->size() - offset)
+      return 1;
+   std::copy_n(in->begin() + offset, size, static_cast<uint8_t*>(buffer));
+   return 0;
+}
+
+bool
+compressionMethods_stream_match()
+{
+   bool result = true;
+   auto input = toBytes(readBinary("../samples/war_and_peace.txt", 1500001));
+   std::vector<uint8_t> sample(input.begin(), input.begin() + 200000);
+
+   // A saved model compresses as the trained one
+   cm_model* trained = nullptr;
+   cm_model* loaded = nullptr;
+   cm_model* truncated = nullptr;
+   size_t modelSize = 0;
+   result = result && cm_model_train(sample.data(), sample.size(), CM_DEFAULT_LEVEL, &trained) ==
+                        CM_OK &&
+            cm_model_save(trained, nullptr, 0, &modelSize) == CM_OK;
+   std::vector<uint8_t> saved(modelSize);
+   result = result && cm_model_save(trained, saved.data(), saved.size(), &modelSize) == CM_OK &&
+            cm_model_load(saved.data(), saved.size(), &loaded) == CM_OK &&
+            cm_model_load(saved.data(), saved.size() / 2, &truncated) == CM_CORRUPT_DATA;
+
+   // Written in pieces, one container after the other
+   for (const cm_model* model : { (const cm_model*)nullptr, (const cm_model*)loaded }) {
+      std::vector<uint8_t> container;
+      cm_cctx* cctx = nullptr;
+      result = result && cm_cctx_create(CM_DEFAULT_LEVEL, model, appendTo, &container, &cctx) ==
+                           CM_OK;
+
+      for (size_t i = 0; result && i < input.size(); i += 100000) {
+         const size_t n = std::min<size_t>(100000, input.size() - i);
+         result = cm_cctx_write(cctx, input.data() + i, n) == CM_OK;
+      }
+      result = result && cm_cctx_end(cctx) == CM_OK;
+
+      // Read back in pieces that straddle the blocks
+      cm_dctx* dctx = nullptr;
+      std::vector<uint8_t> decompressed;
+      std::vector<uint8_t> buffer(300000);
+      size_t readSize = 0;
+      result = result &&
+               cm_dctx_create(readFrom, &container, container.size(), &dctx) == CM_OK &&
+               cm_dctx_raw_size(dctx) == input.size();
+      while (result && cm_dctx_read(dctx, buffer.data(), buffer.size(), &readSize) == CM_OK &&
+             readSize)
+         decompressed.insert(decompressed.end(), buffer.begin(), buffer.begin() + readSize);
+      result = result && decompressed == input &&
+               cm_dctx_read_at(dctx, 1048000, 1000, buffer.data()) == CM_OK &&
+               std::equal(buffer.begin(), buffer.begin() + 1000, input.begin() + 1048000);
+      cm_dctx_free(dctx);
+
+      // The context is reused for the next container
+      container.clear();
+      result = result && cm_cctx_write(cctx, "abc", 3) == CM_OK && cm_cctx_end(cctx) == CM_OK;
+      size_t size = 0;
+      result = result &&
+               cm_decompress(container.data(), container.size(), buffer.data(), 3, &size) ==
+                 CM_OK &&
+               size == 3 && std::equal(buffer.begin(), buffer.begin() + 3, "abc");
+      cm_cctx_free(cctx);
+   }
+
+   // Appended to a container, the tail replaces its index
+   std::vector<uint8_t> container;
+   std::vector<uint8_t> tail;
+   cm_cctx* cctx = nullptr;
+   uint64_t offset = 0;
+   result = result && cm_cctx_create(1, nullptr, appendTo, &container, &cctx) == CM_OK &&
+            cm_cctx_write(cctx, input.data(), 300000) == CM_OK && cm_cctx_end(cctx) == CM_OK;
+   cm_cctx_free(cctx);
+   result = result && cm_cctx_create(CM_DEFAULT_LEVEL, nullptr, appendTo, &tail, &cctx) == CM_OK &&
+            cm_cctx_append(cctx, readFrom, &container, container.size(), &offset) == CM_OK &&
+            cm_cctx_append(cctx, readFrom, &container, container.size(), &offset) ==
+              CM_INVALID_ARGUMENT &&
+            cm_cctx_write(cctx, input.data() + 300000, 200000) == CM_OK &&
+            cm_cctx_end(cctx) == CM_OK;
+   cm_cctx_free(cctx);
+   container.resize(offset);
+   container.insert(container.end(), tail.begin(), tail.end());
+   std::vector<uint8_t> appended(500000);
+   size_t appendedSize = 0;
+   result = result &&
+            cm_decompress(
+              container.data(), container.size(), appended.data(), 500000, &appendedSize) ==
+              CM_OK &&
+            std::equal(appended.begin(), appended.end(), input.begin());
+
+   // A failed read is not reported as corrupt data
+   std::vector<uint8_t> shortFile(10);
+   cm_dctx* dctx = nullptr;
+   result = result && cm_dctx_create(readFrom, &shortFile, 100, &dctx) == CM_IO_ERROR;
+
+   cm_model_free(trained);
+   cm_model_free(loaded);
+   return result;
+}
+
+// PcapSplitter ###############################################################
+
+bool
+pcapSplitter_merge_match()
+{
+   auto inputData = readBinary("../samples/sip_flow.pcap", 0);
+   if (!PcapSplitter::isPcap(inputData) || PcapSplitter::isPcap(bitSet(24 * 8))) {
+      return false;
+   }
+
+   auto substreams = PcapSplitter::split(inputData);
+   if (substreams.size() != PcapSplitter::NumSubstreams ||
+       substreams[PcapSplitter::GlobalHeader].size() != 24 * 8 ||
+       substreams[PcapSplitter::RecordHeaders].empty() ||
+       substreams[PcapSplitter::ProtocolHeaders].empty()) {
+      std::cout << "Unexpected pcap substreams!" << std::endl;
+      return false;
+   }
+   return PcapSplitter::merge(substreams) == inputData;
+}
+
+// AllocationStats ############################################################
+
+bool
+allocationStats_chain_match()
+{
+   bool result = true;
+   auto inputData = readBinary("../samples/war_and_peace.txt", 100001);
+   auto createChain = []() {
+      auto c = std::make_unique<EncoderChain>();
+      c->addEncoder(std::make_unique<Padder>(Padder::PaddingType::EvenBytes));
+      c->addEncoder(EncoderFactory::createMarkovEncoder(DEF_SYMBOLSIZE, DEF_PROBABILITY_THRESHOLD));
+      c->addEncoder(EncoderFactory::createHuffmanTransducer(DEF_SYMBOLSIZE));
+      return c;
+   };
+
+   AllocationStats::setEnabled(true);
+   {
+      AllocationStats::Scope scope;
+      auto c = createChain();
+      c->encode(inputData);
+      const auto& stages = c->getStageStats();
+      result = stages.size() == 2 && stages[0].name == "padder" &&
+               stages[1].name == "markov+huffman";
+
+      // The copy of the padder holds the whole input
+      uint64_t allocations = 0;
+      for (const auto& s : stages) {
+         allocations += s.allocations.allocations;
+         result = result && s.allocations.allocations && s.allocations.bytes &&
+                  s.allocations.peakBytes <= scope.get().peakBytes;
+      }
+      result = result && stages[0].allocations.peakBytes >= int64_t(inputData.size() / 8) &&
+               scope.get().allocations >= allocations;
+   }
+   AllocationStats::setEnabled(false);
+
+   // Nothing is recorded while the counting is disabled
+   auto c = createChain();
+   c->encode(inputData);
+   return result && c->getStageStats().empty();
+}
+
+// ThreadPool #################################################################
+
+static void
+runInline(void* opaque, cm_task_fn task, void* argument)
+{
+   ++*static_cast<std::atomic<size_t>*>(opaque);
+   task(argument);
+}
+
+bool
+threadPool_default_match()
+{
+   ThreadPool::configure(4, { 0 });
+   std::vector<size_t> counts(100000, 0);
+   ThreadPool::parallelFor(counts.size(), [&](size_t i) { ++counts[i]; });
+   bool result = ThreadPool::getNumThreads() == 4 &&
+                 size_t(std::count(counts.begin(), counts.end(), 1)) == counts.size();
+
+   // Nested loops run serially on their thread, exceptions reach the caller
+   std::atomic<size_t> nested{ 0 };
+   ThreadPool::parallelFor(8, [&](size_t) {
+      const auto id = std::this_thread::get_id();
+      ThreadPool::parallelFor(8, [&](size_t) { nested += std::this_thread::get_id() == id; });
+   });
+   result = result && nested == 64;
+   try {
+      ThreadPool::parallelFor(100, [](size_t i) {
+         if (i == 42)
+            throw std::runtime_error("42");
+      });
+      result = false;
+   } catch (std::runtime_error& E) {
+      result = result && std::string(E.what()) == "42";
+   }
+
+   // The executor of the application gets the helpers, the pool starts no threads
+   std::atomic<size_t> tasks{ 0 };
+   result = result && cm_set_executor(runInline, &tasks, 4) == CM_OK;
+   ThreadPool::parallelFor(counts.size(), [&](size_t i) { ++counts[i]; });
+   result = result && tasks == 3 &&
+            size_t(std::count(counts.begin(), counts.end(), 2)) == counts.size();
+
+   result = result && cm_set_threads(0, nullptr, 0) == CM_OK &&
+            ThreadPool::getNumThreads() == std::max(1u, std::thread::hardware_concurrency());
+   return result;
+}
+
+// Tracer #####################################################################
+
+bool
+tracer_chain_match()
+{
+   auto inputData = readBinary("../samples/war_and_peace.txt", 100001);
+   auto createChain = []() {
+      auto c = std::make_unique<EncoderChain>();
+      c->addEncoder(std::make_unique<Padder>(Padder::PaddingType::EvenBytes));
+      c->addEncoder(EncoderFactory::createMarkovEncoder(DEF_SYMBOLSIZE, DEF_PROBABILITY_THRESHOLD));
+      c->addEncoder(EncoderFactory::createHuffmanTransducer(DEF_SYMBOLSIZE));
+      return c;
+   };
+
+   // Nothing is recorded while the tracer is disabled
+   Tracer::setEnabled(true);
+   Tracer::setEnabled(false);
+   createChain()->encode(inputData);
+   bool result = Tracer::getNumSpans() == 0;
+
+   // padder, setup (markov), setup (huffman) and markov+huffman
+   Tracer::setEnabled(true);
+   createChain()->encode(inputData);
+   Tracer::setEnabled(false);
+   result = result && Tracer::getNumSpans() == 4;
+
+   const std::string path = "tracer_test.json";
+   Tracer::write(path);
+   std::ifstream in{ path };
+   std::string json((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+   result = result && json.find("\"traceEvents\"") != std::string::npos &&
+            json.find("\"name\":\"markov+huffman\",\"cat\":\"ht\",\"ph\":\"X\"") !=
+              std::string::npos &&
+            json.find("\"name\":\"setup\"") != std::string::npos &&
+            json.find("\"thread_name\"") != std::string::npos;
+
+   std::remove(path.c_str());
+   return result;
+}
+
 // HuffmanTransducer ##########################################################
 
 class TestExecutor
@@ -221,11 +1508,48 @@ class TestExecutor
       TEST_FUNCTION(appendBits_default_match);
       TEST_FUNCTION(findMostZeros_default_match);
       TEST_FUNCTION(countZeros_default_match);
+      TEST_FUNCTION(convertBytes_default_match);
       TEST_FUNCTION(sliceBitSet_default_match);
       TEST_FUNCTION(convertToBitSet_default_match);
 
       TEST_FUNCTION(deserialize_huffman_encoding_match);
       TEST_FUNCTION(deserialize_markov_encoding_match);
+      TEST_FUNCTION(deltaEncoder_roundTrip_match);
+      TEST_FUNCTION(deltaEncoder_chain_match);
+
+      TEST_FUNCTION(markovEncoderT_dynamic_match);
+      TEST_FUNCTION(huffmanTransducerT_dynamic_match);
+      TEST_FUNCTION(huffmanTransducer_escape_match);
+      TEST_FUNCTION(markovKernels_default_match);
+      TEST_FUNCTION(markovEncoder_parallel_match);
+      TEST_FUNCTION(markovEncoder_restart_match);
+      TEST_FUNCTION(markovEncoder_predictionStats_match);
+
+      TEST_FUNCTION(encoderChain_fused_match);
+      TEST_FUNCTION(encoderChain_inPlace_match);
+      TEST_FUNCTION(encoderChain_sampled_match);
+
+      TEST_FUNCTION(symbolStatistics_default_match);
+      TEST_FUNCTION(symbolStatistics_markovOutput_match);
+      TEST_FUNCTION(symbolStatistics_entropy_match);
+      TEST_FUNCTION(symbolStatistics_parallel_match);
+      TEST_FUNCTION(transitionSketch_predictions_match);
+
+      TEST_FUNCTION(blockContainer_range_match);
+      TEST_FUNCTION(blockContainer_append_match);
+      TEST_FUNCTION(blockContainer_version_match);
+
+      TEST_FUNCTION(compressionLevel_roundTrip_match);
+      TEST_FUNCTION(compressionLevel_symbolSize_match);
+      TEST_FUNCTION(compressionLevel_highEntropy_match);
+      TEST_FUNCTION(compressionMethods_buffer_match);
+      TEST_FUNCTION(compressionMethods_stream_match);
+
+      TEST_FUNCTION(pcapSplitter_merge_match);
+
+      TEST_FUNCTION(allocationStats_chain_match);
+      TEST_FUNCTION(tracer_chain_match);
+      TEST_FUNCTION(threadPool_default_match);
    }
 
    void addTestCase(bool (*testFunction)(), std::string name)